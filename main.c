@@ -0,0 +1,1234 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * main.c
+ * Author: Nathan Cochran
+ * Analysis of Algorithms - TSP Project
+ *
+ * The tsp command: reads an instance from a file or stdin, solves it
+ * with the solver library (tsp.h) using the algorithm chosen on the
+ * command line, and writes the tour to [input file].tour or stdout.
+ *
+ * Use tsp -h for usage information
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "tsp.h"
+
+
+//CONSTANTS:
+
+//Limits and buffer sizes:
+#define FILENAME_LEN 1024
+
+//In batch mode, the number of instances (per worker) read ahead of the workers:
+#define BATCH_QUEUE_MAX 4
+
+//In server mode, the number of connections waiting to be accepted, and the binary requests:
+//their magic number and format version, and the most cities they may have:
+#define DAEMON_BACKLOG 64
+#define REQUEST_MAGIC "TSPI"
+#define REQUEST_VERSION 1
+#define REQUEST_MAX_CITIES 100000000
+
+//Binary tours start with this magic number and format version (as in tsp.c):
+#define TOUR_MAGIC "TSPT"
+#define TOUR_VERSION 1
+
+
+//STRUCTS:
+
+//An instance waiting to be solved in batch or server mode: an input file (from the manifest),
+//the text of an instance from the stream or a request, or the id, x and y of each city of a binary
+//request, and its position in the manifest or stream (counting from 1).  For a request, also
+//the connection's socket, whether it came in binary, whether a worker is done with it, and
+//whether that worker answered it (one dropped at shutdown is answered by its connection):
+typedef struct batch_job {
+    struct batch_job * next;
+    char * filename;
+    char * text;
+    long len;
+    int * cities;
+    int num_cities;
+    int index;
+    int fd;
+    int binary;
+    int done;
+    int answered;
+} batch_job;
+
+
+//FUNCTION PROTOTYPES:
+
+void get_options(int argc, char **argv, tsp_options *options);
+void sig_handler(int sig);
+void stats_sig_handler(int sig);
+void install_sig_handlers(void);
+int update_tour(tsp_solver *tsp);
+int run_batch(tsp_options *options);
+int read_manifest(FILE *file);
+int read_stream(FILE *file);
+long read_instance(FILE *file, const char *start, long start_len, char **text);
+int start_pool(tsp_options *options);
+void finish_pool(void);
+batch_job * batch_new(char *filename, char *text, long len, int index);
+int batch_push(batch_job *job);
+batch_job * batch_pop(void);
+void batch_free(batch_job *job);
+void * batch_worker(void *arg);
+void batch_solve(tsp_arena *arena, batch_job *job, int worker);
+void * batch_signals(void *arg);
+int run_daemon(tsp_options *options);
+void * daemon_connection(void *arg);
+batch_job * read_request(FILE *file, int fd);
+void daemon_reply(tsp_solver *tsp, batch_job *job, int distance);
+int format_failure(char *buf, int binary);
+
+
+//STATIC VARIABLES:
+
+//Options:
+static int use_anneal = 0;
+static int use_nearest_neighbor = 0;
+static int use_two_opt = 0;
+static int use_two_opt_neighbors = 0;
+static int use_lin_kernighan = 0;
+static int use_iterated_local_search = 0;
+static int in_file = 0;
+static char in_filename[FILENAME_LEN];
+static char out_filename[FILENAME_LEN+8];
+static int warm_start = 0;
+static char warm_filename[FILENAME_LEN];
+static int use_update = 0;
+static char update_filename[FILENAME_LEN];
+static char stats_filename[FILENAME_LEN];
+static char * manifest_filename = NULL;
+static int use_stream = 0;
+static char * socket_filename = NULL;
+
+//The solver, for the signal handlers, and the signal that stopped it (if any):
+static tsp_solver * solver;
+static volatile sig_atomic_t stop_signal = 0;
+
+//Batch and server modes: the options every instance is solved with, the worker threads, the
+//instances waiting for a worker (taken in order), whether there are more to come, the solver
+//each worker is running (for stopping them), and the number of instances that could not be
+//solved (and, at shutdown, the requests dropped but not yet told so by their connections).
+//All of them are guarded by batch_lock, which is also held while writing to stdout,
+//and batch_finished is signalled whenever a request has been answered:
+static tsp_options batch_options;
+static pthread_t * batch_workers;
+static batch_job * batch_head = NULL;
+static batch_job * batch_tail = NULL;
+static int batch_queued = 0;
+static int batch_max_queued;
+static int batch_num_workers;
+static int batch_more = 1;
+static tsp_solver ** batch_running;
+static int batch_failed = 0;
+static int batch_dropped = 0;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batch_room = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batch_finished = PTHREAD_COND_INITIALIZER;
+
+//The signals taken by batch_signals, and the server's listening socket:
+static sigset_t batch_sigset;
+static int daemon_fd = -1;
+
+int main (int argc, char * argv[]) {
+    tsp_options options;
+
+    //Get command line options:
+    tsp_default_options(&options);
+    get_options(argc, argv, &options);
+    if(socket_filename != NULL)
+        return run_daemon(&options);
+    if(manifest_filename != NULL || use_stream)
+        return run_batch(&options);
+
+    //Set up the solver (which starts the clock for the time limit),
+    //then install the SIGINT/SIGTERM signal handlers:
+    solver = tsp_create(&options, NULL);
+    if(solver == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    install_sig_handlers();
+
+    //Read input (or the cache of it), and the tour to start from:
+    if(tsp_read(solver, in_file ? in_filename : NULL) < 0) {
+        tsp_free(solver);
+        return EXIT_FAILURE;
+    }
+
+    //If stopped while reading the input, there is nothing to print:
+    if(stop_signal) {
+        tsp_free(solver);
+        return EXIT_FAILURE;
+    }
+    if(warm_start && tsp_read_tour(solver, warm_filename) < 0) {
+        tsp_free(solver);
+        return EXIT_FAILURE;
+    }
+
+    //Solve (or, with -u, update the tour given), then print the solution
+    //(and the statistics, if asked for):
+    if(tsp_solve(solver) < 0) {
+        fprintf(stderr, "Error: could not solve the instance\n");
+        tsp_free(solver);
+        return EXIT_FAILURE;
+    }
+    if(use_update && !stop_signal && update_tour(solver) < 0) {
+        tsp_free(solver);
+        return EXIT_FAILURE;
+    }
+    if(tsp_write_tour(solver) < 0) {
+        fprintf(stderr, "Error: could not write the tour\n");
+        tsp_free(solver);
+        return EXIT_FAILURE;
+    }
+    tsp_write_stats(solver);
+
+    tsp_free(solver);
+    return EXIT_SUCCESS;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the command line options and sets the appropriate solver options and static variables
+ * representing them
+ * Param:   int argc -  The length of the argument vector
+ * Param:   char ** argv -  The argument vector
+ * Param:   tsp_options * options -  The solver's options (filled in with the defaults)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void get_options(int argc, char ** argv, tsp_options * options) {
+    int opt;
+    tsp_options defaults;
+
+    while((opt = getopt(argc, argv, "abBcC:dD:f:g:hHij:kKlm:M:np:s:S:tT:u:vw:")) != -1) {
+        switch(opt) {
+            case 'a':
+                use_anneal = 1;
+                break;
+            case 'n':
+                use_nearest_neighbor = 1;
+                break;
+            case 'H':
+                options->use_hilbert = 1;
+                break;
+            case 'K':
+                options->use_kmeans = 1;
+                break;
+            case 'f':
+                in_file = 1;
+                snprintf(in_filename, FILENAME_LEN, "%s", optarg);
+                snprintf(out_filename, sizeof(out_filename), "%s%s", in_filename, ".tour");
+                options->out_filename = out_filename;
+                break;
+            case 'M':
+                manifest_filename = optarg;
+                break;
+            case 'B':
+                use_stream = 1;
+                break;
+            case 'D':
+                socket_filename = optarg;
+                break;
+            case 'j':
+                options->num_workers = atoi(optarg);
+                break;
+            case 'c':
+                options->use_cache = 1;
+                break;
+            case 'C':
+                options->checkpoint_interval = atof(optarg);
+                break;
+            case 'w':
+                warm_start = 1;
+                snprintf(warm_filename, FILENAME_LEN, "%s", optarg);
+                break;
+            case 'u':
+                use_update = 1;
+                snprintf(update_filename, FILENAME_LEN, "%s", optarg);
+                break;
+            case 't':
+                use_two_opt = 1;
+                break;
+            case 'k':
+                use_two_opt_neighbors = 1;
+                break;
+            case 'l':
+                use_lin_kernighan = 1;
+                break;
+            case 'i':
+                use_iterated_local_search = 1;
+                break;
+            case 'p':
+                options->num_threads = atoi(optarg);
+                break;
+            case 'g':
+                options->num_cells = atoi(optarg);
+                break;
+            case 's':
+                options->seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'T':
+                options->time_limit = atof(optarg);
+                break;
+            case 'S':
+                snprintf(stats_filename, FILENAME_LEN, "%s", optarg);
+                options->stats_filename = stats_filename;
+                break;
+            case 'b':
+                options->binary_output = 1;
+                break;
+            case 'm':
+                options->matrix_max_cities = atoi(optarg);
+                break;
+            case 'v':
+                options->verbose = 1;
+                break;
+            case 'd':
+                options->verbose = 1;
+                options->debug = 1;
+                break;
+            case 'h':
+            default:
+                tsp_default_options(&defaults);
+                printf("Usage: %s -[abBcdHikKlntv] -[p threads] -[g cells] -[j workers] -[M manifest] -[D socket] -[s seed] -[T seconds] -[C seconds] -[w tour_file] -[u update_file] -[S stats_file] -[m max_cities] -[f filename]\n", argv[0]);
+                printf("Algorithms:\n");
+                printf("\t-Default: Nathan's Hybrid (honestly the best choice)\n");
+                printf("\t-n: Nearest Neighbor (only)\n");
+                printf("\t-t: Two-opt\n");
+                printf("\t-k: Two-opt with nearest neighbor lists (fast on large inputs)\n");
+                printf("\t-l: Lin-Kernighan style (chains of 2-opt moves plus Or-opt, with neighbor lists)\n");
+                printf("\t-i: Iterated local search (double-bridge kicks repaired with 2-opt and Or-opt)\n");
+                printf("\t-a: Simulated Anneal\n");
+                printf("\t-H: Build the first tour along a Hilbert curve (O(n log n)) instead of with nearest neighbor\n");
+                printf("\t    (with -n, use it alone)\n");
+                printf("\t-p: Parallel Tempering (one simulated anneal replica per thread,\n");
+                printf("\t    each at a different temperature, swapping paths periodically)\n");
+                printf("Partition:\n");
+                printf("\t-g: Split the cities into a grid of about this many cells, solve the cells in parallel\n");
+                printf("\t    (one per processor) with the algorithm chosen above, then join them and repair the seams\n");
+                printf("\t-K: Make the cells k-means clusters instead (better for clustered cities)\n");
+                printf("Batch and server modes:\n");
+                printf("\t-M: Solve each of the input files listed (one per line) in this file (- for stdin),\n");
+                printf("\t    several at once, writing each [input file].tour as it is solved\n");
+                printf("\t-B: Solve each of the instances read from stdin, which are separated by lines of EOF,\n");
+                printf("\t    several at once, writing each tour to stdout (after a line of INSTANCE: [number]) as it is solved\n");
+                printf("\t-D: Server mode: solve the instances sent to this Unix domain socket, as text or binary\n");
+                printf("\t    (see README), answering each with its tour\n");
+                printf("\t-j: Number of instances (or cells, with -g) solved at once (default: one per processor)\n");
+                printf("\t    Options chosen above (and -T) apply to each instance; -w and -S are not used\n");
+                printf("Randomness:\n");
+                printf("\t-s: Seed for the random number generator (default: the current time),\n");
+                printf("\t    so that runs can be repeated\n");
+                printf("Time limit:\n");
+                printf("\t-T: Stop after this many seconds (counted from startup) and print the best path found\n");
+                printf("Display modes:\n");
+                printf("\t-v: Verbose (minor progress messages)\n");
+                printf("\t-d: Debug (lots of detailed messages)\n");
+                printf("\t-S: Write statistics (move counts, phase timings, improvement over time) as JSON\n");
+                printf("\t    to this file at exit, and whenever a SIGUSR1 signal is received\n");
+                printf("Distances:\n");
+                printf("\t-m: Largest number of cities to use a distance matrix for (default %d);\n", defaults.matrix_max_cities);
+                printf("\t    larger inputs calculate distances on the fly from the coordinates\n");
+                printf("Input/Output:\n");
+                printf("\t-f: Specify file to use as input/source file\n");
+                printf("\t    Note: this will result in a output file named [input file].tour\n");
+                printf("\t-b: Output the tour in binary format (see README)\n");
+                printf("\t-C: Every this many seconds, write the best path so far to the output file (needs -f)\n");
+                printf("\t-w: Start from the tour in this file (e.g. an earlier .tour) instead of nearest neighbor\n");
+                printf("\t-u: Update the tour given with -w after adding and removing the cities in this file\n");
+                printf("\t    (lines of id x y to add or move a city, or just id to remove one), repairing it\n");
+                printf("\t    only around the changes instead of solving again (see README)\n");
+                printf("\t-c: Cache the parsed input, neighbor lists and distance matrix in [input file].cache\n");
+                printf("\t    (written on the first run, and loaded instead of the input file on later runs)\n");
+
+                exit(EXIT_SUCCESS);
+        }
+    }
+
+    //The algorithm to improve the first tour with, if more than one is given:
+    if(use_nearest_neighbor)
+        options->algorithm = TSP_NONE;
+    else if(use_anneal)
+        options->algorithm = TSP_ANNEAL;
+    else if(options->num_threads > 0)
+        options->algorithm = TSP_PARALLEL_TEMPERING;
+    else if(use_iterated_local_search)
+        options->algorithm = TSP_ITERATED_LOCAL_SEARCH;
+    else if(use_lin_kernighan)
+        options->algorithm = TSP_LIN_KERNIGHAN;
+    else if(use_two_opt_neighbors)
+        options->algorithm = TSP_TWO_OPT_NEIGHBORS;
+    else if(use_two_opt)
+        options->algorithm = TSP_TWO_OPT;
+
+    //To update a tour, the solve only takes it as it is (then tsp_update repairs it around the changes):
+    if(use_update) {
+        if(!warm_start) {
+            fprintf(stderr, "Error: -u needs the tour to update (-w)\n");
+            exit(EXIT_FAILURE);
+        }
+        options->algorithm = TSP_NONE;
+    }
+}
+
+
+//UPDATE MODE:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads the changes to the instance from the update file (-u): a line of id, x and y for each city
+ * to add (or move, if its id is in the instance already), and a line of just the id for each city
+ * to remove (blank lines and lines starting with # are skipped), then updates the solver's tour
+ * Param:   tsp_solver * tsp -  The solver, with the tour to update
+ * Return:  int -  The distance of the updated tour, or -1 if the file could not be read or the tour updated
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int update_tour(tsp_solver * tsp) {
+    FILE * file;
+    char * line = NULL;
+    size_t size = 0;
+    int * cities = NULL, * ids = NULL, * grown;
+    int num_add = 0, num_remove = 0, add_size = 0, remove_size = 0;
+    int id, fields, ok, distance;
+    double x, y;
+
+    file = fopen(update_filename, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Error: could not open %s\n", update_filename);
+        return -1;
+    }
+
+    ok = 1;
+    while(ok && getline(&line, &size, file) >= 0) {
+        fields = sscanf(line, "%d %lf %lf", &id, &x, &y);
+        if(fields <= 0 || line[0] == '#')
+            continue;
+
+        if(fields == 3) {
+            if(num_add == add_size) {
+                add_size = add_size ? 2*add_size : 64;
+                grown = realloc(cities, add_size * 3 * sizeof(int));
+                if(grown == NULL) {
+                    ok = 0;
+                    break;
+                }
+                cities = grown;
+            }
+            cities[3*num_add] = id;
+            cities[3*num_add+1] = (int)(x + (x < 0 ? -.5 : .5));
+            cities[3*num_add+2] = (int)(y + (y < 0 ? -.5 : .5));
+            num_add++;
+        }
+        else if(fields == 1) {
+            if(num_remove == remove_size) {
+                remove_size = remove_size ? 2*remove_size : 64;
+                grown = realloc(ids, remove_size * sizeof(int));
+                if(grown == NULL) {
+                    ok = 0;
+                    break;
+                }
+                ids = grown;
+            }
+            ids[num_remove++] = id;
+        }
+        else {
+            fprintf(stderr, "Error: %s: expected id x y, or just id, but got: %s", update_filename, line);
+            ok = 0;
+        }
+    }
+    fclose(file);
+    free(line);
+
+    distance = ok ? tsp_update(tsp, cities, num_add, ids, num_remove) : -1;
+    free(cities);
+    free(ids);
+    return distance;
+}
+
+
+//BATCH MODE:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves many instances (from a manifest, -M, or a stream, -B) on the pool of worker threads.
+ * The instances are read on this thread while the workers solve them
+ * Param:   tsp_options * options -  The options to solve each instance with
+ * Return:  int -  EXIT_SUCCESS, or EXIT_FAILURE if any instance could not be read or solved
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int run_batch(tsp_options * options) {
+    int result;
+    FILE * file;
+
+    file = stdin;
+    if(manifest_filename != NULL && strcmp(manifest_filename, "-") != 0) {
+        file = fopen(manifest_filename, "r");
+        if(file == NULL) {
+            fprintf(stderr, "Error: could not open %s\n", manifest_filename);
+            return EXIT_FAILURE;
+        }
+    }
+    if(start_pool(options) < 0)
+        return EXIT_FAILURE;
+    if(options->verbose)
+        printf("Solving instances with %d workers...\n", batch_num_workers);
+
+    if(manifest_filename != NULL)
+        result = read_manifest(file);
+    else
+        result = read_stream(file);
+    if(file != stdin)
+        fclose(file);
+
+    finish_pool();
+    if(options->verbose && stop_signal)
+        printf("Received signal %d: stopped\n", (int)stop_signal);
+    return result == 0 && batch_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads a manifest: the input files to solve, one per line (blank lines
+ * and lines starting with # are skipped)
+ * Param:   FILE * file -  The manifest
+ * Return:  int -  0, or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int read_manifest(FILE * file) {
+    char * line = NULL, * filename;
+    size_t size = 0;
+    long len;
+    int index = 0;
+    batch_job * job;
+
+    while(!stop_signal && (len = getline(&line, &size, file)) >= 0) {
+        while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r' || line[len-1] == ' ' || line[len-1] == '\t'))
+            line[--len] = '\0';
+        if(len == 0 || line[0] == '#')
+            continue;
+        filename = strdup(line);
+        job = batch_new(filename, NULL, 0, ++index);
+        if(job == NULL) {
+            free(filename);
+            free(line);
+            return -1;
+        }
+        batch_push(job);
+    }
+    free(line);
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads a stream of instances (see read_instance)
+ * Param:   FILE * file -  The stream
+ * Return:  int -  0, or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int read_stream(FILE * file) {
+    char * text;
+    long len = 0;
+    int index = 0;
+    batch_job * job;
+
+    while(!stop_signal && (len = read_instance(file, NULL, 0, &text)) >= 0) {
+        job = batch_new(NULL, text, len, ++index);
+        if(job == NULL) {
+            free(text);
+            return -1;
+        }
+        batch_push(job);
+    }
+    return len < -1 ? -1 : 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads the text of the next instance from a stream.  Each instance is ended by a line of EOF
+ * (as TSPLIB files are, so they can simply be concatenated) or by the end of the stream,
+ * and instances with nothing in them are skipped
+ * Param:   FILE * file -  The stream
+ * Param:   const char * start -  Text already read from the start of the instance, or NULL
+ * Param:   long start_len -  Its length
+ * Param:   char ** text -  Location to store the instance (malloc'd, without its EOF line)
+ * Return:  long -  The length of the instance, -1 at the end of the stream, or -2 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+long read_instance(FILE * file, const char * start, long start_len, char ** text) {
+    char * line = NULL, * chunk, * buf = NULL, * grown;
+    size_t size = 0;
+    long n, buf_len = 0, buf_size = 0, line_start = 0, i;
+    int blank = 1, done = 0, at_end;
+
+    do {
+        //The text given comes before the first line read:
+        if(start != NULL) {
+            chunk = (char *)start;
+            n = start_len;
+            start = NULL;
+        }
+        else {
+            n = getline(&line, &size, file);
+            chunk = line;
+        }
+        at_end = n < 0;
+
+        if(!at_end) {
+            if(buf_len + n > buf_size) {
+                buf_size = buf_size ? 2*buf_size : 4096;
+                while(buf_len + n > buf_size)
+                    buf_size *= 2;
+                grown = realloc(buf, buf_size);
+                if(grown == NULL) {
+                    free(buf);
+                    free(line);
+                    return -2;
+                }
+                buf = grown;
+            }
+            memcpy(buf + buf_len, chunk, n);
+            buf_len += n;
+            if(n == 0 || chunk[n-1] != '\n')
+                continue;
+        }
+
+        //At the end of each line, check for the EOF line ending the instance (which is dropped):
+        n = buf_len - line_start;
+        if(n >= 3 && strncmp(buf + line_start, "EOF", 3) == 0 &&
+           (long)strspn(buf + line_start + 3, " \t\r\n") >= n - 3) {
+            buf_len = line_start;
+            done = 1;
+        }
+        for(i=line_start; i<buf_len && blank; i++) {
+            if(buf[i] != ' ' && buf[i] != '\t' && buf[i] != '\r' && buf[i] != '\n')
+                blank = 0;
+        }
+        line_start = buf_len;
+        if(at_end)
+            done = 1;
+        else if(done && blank) {
+            done = 0;
+            buf_len = line_start = 0;
+        }
+    } while(!done);
+
+    free(line);
+    if(blank) {
+        free(buf);
+        return -1;
+    }
+    *text = buf;
+    return buf_len;
+}
+
+
+//WORKER POOL:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Starts the pool of worker threads that batch and server modes solve instances on, each
+ * with an arena its solvers allocate from, which is reset (not freed) between instances.
+ * The signals are taken from then on by a thread of their own (see batch_signals)
+ * Param:   tsp_options * options -  The options to solve each instance with
+ * Return:  int -  0, or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int start_pool(tsp_options * options) {
+    long w;
+    pthread_t signals;
+
+    //Each instance is solved on one thread, with its own copy of the options:
+    batch_options = *options;
+    batch_options.out_filename = NULL;
+    batch_options.stats_filename = NULL;
+    batch_num_workers = options->num_workers > 0 ? options->num_workers : sysconf(_SC_NPROCESSORS_ONLN);
+    if(batch_num_workers < 1)
+        batch_num_workers = 1;
+    batch_max_queued = batch_num_workers * BATCH_QUEUE_MAX;
+    batch_workers = malloc(batch_num_workers * sizeof(pthread_t));
+    batch_running = calloc(batch_num_workers, sizeof(tsp_solver *));
+    if(batch_workers == NULL || batch_running == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        return -1;
+    }
+
+    //(The signals are blocked here, before starting the other threads, which inherit it):
+    sigemptyset(&batch_sigset);
+    sigaddset(&batch_sigset, SIGINT);
+    sigaddset(&batch_sigset, SIGTERM);
+    sigaddset(&batch_sigset, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &batch_sigset, NULL);
+    pthread_create(&signals, NULL, batch_signals, NULL);
+    pthread_detach(signals);
+
+    for(w=0; w<batch_num_workers; w++) {
+        pthread_create(&batch_workers[w], NULL, batch_worker, (void *)w);
+    }
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Lets the workers finish the instances queued (unless stopped), then drops whatever was left,
+ * waiting for the connections of the requests dropped to answer them
+ * Param:   void
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void finish_pool(void) {
+    int i;
+    batch_job * job;
+
+    pthread_mutex_lock(&batch_lock);
+    batch_more = 0;
+    pthread_cond_broadcast(&batch_ready);
+    pthread_mutex_unlock(&batch_lock);
+    for(i=0; i<batch_num_workers; i++) {
+        pthread_join(batch_workers[i], NULL);
+    }
+
+    //(A request's connection answers it with -1, and frees it):
+    pthread_mutex_lock(&batch_lock);
+    while((job = batch_pop()) != NULL) {
+        batch_failed++;
+        if(job->fd >= 0) {
+            job->done = 1;
+            batch_dropped++;
+            pthread_cond_broadcast(&batch_finished);
+        }
+        else
+            batch_free(job);
+    }
+    while(batch_dropped > 0)
+        pthread_cond_wait(&batch_finished, &batch_lock);
+    pthread_mutex_unlock(&batch_lock);
+
+    free(batch_workers);
+    free(batch_running);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Makes an instance to queue for the workers
+ * Param:   char * filename -  The input file (malloc'd, taken over by the job), or NULL
+ * Param:   char * text -  Or the instance (malloc'd, taken over by the job)
+ * Param:   long len -  The length of the instance
+ * Param:   int index -  Its position in the manifest or stream (counting from 1)
+ * Return:  batch_job * -  The instance, or NULL if out of memory (or filename and text are both NULL)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+batch_job * batch_new(char * filename, char * text, long len, int index) {
+    batch_job * job;
+
+    if(filename == NULL && text == NULL)
+        return NULL;
+    job = calloc(1, sizeof(batch_job));
+    if(job == NULL)
+        return NULL;
+    job->filename = filename;
+    job->text = text;
+    job->len = len;
+    job->index = index;
+    job->fd = -1;
+    return job;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Queues an instance for the workers, waiting while the queue is full.  Once stopped,
+ * the instance is dropped instead (counted as not solved, and freed unless it is a request)
+ * Param:   batch_job * job -  The instance
+ * Return:  int -  0, or -1 if it was dropped
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int batch_push(batch_job * job) {
+    pthread_mutex_lock(&batch_lock);
+    while(batch_queued >= batch_max_queued && !stop_signal)
+        pthread_cond_wait(&batch_room, &batch_lock);
+    if(stop_signal) {
+        batch_failed++;
+        pthread_mutex_unlock(&batch_lock);
+        if(job->fd < 0)
+            batch_free(job);
+        return -1;
+    }
+
+    job->next = NULL;
+    if(batch_tail != NULL)
+        batch_tail->next = job;
+    else
+        batch_head = job;
+    batch_tail = job;
+    batch_queued++;
+    pthread_cond_signal(&batch_ready);
+    pthread_mutex_unlock(&batch_lock);
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Takes the next instance off the queue (with batch_lock held)
+ * Param:   void
+ * Return:  batch_job * -  The instance, or NULL if the queue is empty
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+batch_job * batch_pop(void) {
+    batch_job * job = batch_head;
+
+    if(job == NULL)
+        return NULL;
+    batch_head = job->next;
+    if(batch_head == NULL)
+        batch_tail = NULL;
+    batch_queued--;
+    pthread_cond_signal(&batch_room);
+    return job;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Frees an instance taken off the queue
+ * Param:   batch_job * job -  The instance
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void batch_free(batch_job * job) {
+    free(job->filename);
+    free(job->text);
+    free(job->cities);
+    free(job);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * A worker: solves instances from the queue until there are no more, or it is stopped.
+ * A request is handed back to its connection when answered, anything else is freed
+ * Param:   void * arg -  The worker's number
+ * Return:  void * -  NULL
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void * batch_worker(void * arg) {
+    int worker = (long)arg;
+    tsp_arena * arena;
+    batch_job * job;
+
+    arena = tsp_arena_create(0);
+    for(;;) {
+        pthread_mutex_lock(&batch_lock);
+        while(batch_head == NULL && batch_more && !stop_signal)
+            pthread_cond_wait(&batch_ready, &batch_lock);
+        job = stop_signal ? NULL : batch_pop();
+        pthread_mutex_unlock(&batch_lock);
+        if(job == NULL)
+            break;
+
+        batch_solve(arena, job, worker);
+        if(job->fd >= 0) {
+            pthread_mutex_lock(&batch_lock);
+            job->done = 1;
+            job->answered = 1;
+            pthread_cond_broadcast(&batch_finished);
+            pthread_mutex_unlock(&batch_lock);
+        }
+        else
+            batch_free(job);
+    }
+    tsp_arena_free(arena);
+    return NULL;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves an instance with a solver allocating from the worker's arena, and writes its tour:
+ * to [input file].tour for a file, to stdout for an instance from the stream, or back
+ * to the connection it came from for a request
+ * Param:   tsp_arena * arena -  The worker's arena (NULL to use malloc, if it couldn't be created)
+ * Param:   batch_job * job -  The instance
+ * Param:   int worker -  The worker's number
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void batch_solve(tsp_arena * arena, batch_job * job, int worker) {
+    tsp_options options = batch_options;
+    tsp_allocator allocator;
+    tsp_solver * tsp;
+    char out[FILENAME_LEN+8], failed[16];
+    int i, result = -1, distance = -1;
+
+    //Everything the last instance allocated is given back at once:
+    if(arena != NULL) {
+        tsp_arena_reset(arena);
+        tsp_arena_allocator(arena, &allocator);
+    }
+    options.num_workers = 1;
+    options.verbose = 0;
+    if(job->filename != NULL) {
+        snprintf(out, sizeof(out), "%s%s", job->filename, ".tour");
+        options.out_filename = out;
+    }
+    if(job->fd >= 0)
+        options.binary_output = job->binary;
+    tsp = tsp_create(&options, arena != NULL ? &allocator : NULL);
+
+    //(If stopped since this instance was taken, it is stopped at once):
+    pthread_mutex_lock(&batch_lock);
+    batch_running[worker] = tsp;
+    if(tsp != NULL && stop_signal)
+        tsp_stop(tsp, stop_signal);
+    pthread_mutex_unlock(&batch_lock);
+
+    if(tsp != NULL) {
+        if(job->filename != NULL)
+            result = tsp_read(tsp, job->filename);
+        else if(job->text != NULL)
+            result = tsp_parse(tsp, job->text, job->len);
+        else {
+            for(i=0, result=0; i<job->num_cities && result == 0; i++) {
+                result = tsp_add_city(tsp, job->cities[3*i], job->cities[3*i+1], job->cities[3*i+2]);
+            }
+        }
+    }
+    if(result == 0)
+        distance = tsp_solve(tsp);
+
+    pthread_mutex_lock(&batch_lock);
+    batch_running[worker] = NULL;
+    pthread_mutex_unlock(&batch_lock);
+
+    //A request is answered outside the lock, so that a slow client holds up no one else:
+    if(job->fd >= 0) {
+        daemon_reply(tsp, job, distance);
+        if(batch_options.verbose)
+            printf("Solved request %d (%d cities): %d\n", job->index, tsp ? tsp_num_cities(tsp) : 0, distance);
+        tsp_free(tsp);
+        return;
+    }
+
+    //An instance from the stream that could not be solved still gets its INSTANCE line,
+    //followed by a tour length of -1, so that the tours after it can be told apart:
+    pthread_mutex_lock(&batch_lock);
+    if(job->filename == NULL)
+        printf("INSTANCE: %d\n", job->index);
+    if(distance < 0) {
+        batch_failed++;
+        if(job->filename != NULL)
+            fprintf(stderr, "Error: could not solve %s\n", job->filename);
+        else {
+            fprintf(stderr, "Error: could not solve instance %d\n", job->index);
+            fwrite(failed, 1, format_failure(failed, batch_options.binary_output), stdout);
+            fflush(stdout);
+        }
+    }
+    else if(tsp_write_tour(tsp) < 0) {
+        batch_failed++;
+        if(job->filename != NULL)
+            fprintf(stderr, "Error: could not write the tour of %s\n", job->filename);
+        else
+            fprintf(stderr, "Error: could not write the tour of instance %d\n", job->index);
+    }
+    else if(job->filename != NULL && batch_options.verbose)
+        printf("Solved %s: %d\n", job->filename, distance);
+    pthread_mutex_unlock(&batch_lock);
+
+    tsp_free(tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Takes the signals in batch and server modes (blocked on every other thread).  SIGINT or
+ * SIGTERM stops the solvers running (which still write their tours), the reading of more
+ * instances and the accepting of more connections.  As with sig_handler, a second one ends
+ * the program at once.  SIGUSR1 is ignored
+ * Param:   void * arg -  Unused
+ * Return:  void * -  Never returns
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void * batch_signals(void * arg) {
+    sigset_t set = batch_sigset;
+    int i, sig;
+
+    do {
+        sigwait(&set, &sig);
+    } while(sig == SIGUSR1);
+
+    pthread_mutex_lock(&batch_lock);
+    stop_signal = sig;
+    for(i=0; i<batch_num_workers; i++) {
+        if(batch_running[i] != NULL)
+            tsp_stop(batch_running[i], sig);
+    }
+    pthread_cond_broadcast(&batch_ready);
+    pthread_cond_broadcast(&batch_room);
+    pthread_mutex_unlock(&batch_lock);
+
+    //(Shutting the listening socket down wakes up accept):
+    if(daemon_fd >= 0)
+        shutdown(daemon_fd, SHUT_RDWR);
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    sigdelset(&set, SIGUSR1);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    for(;;)
+        pause();
+    return NULL;
+}
+
+
+//SERVER MODE:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Serves requests on a Unix domain socket until stopped by SIGINT or SIGTERM.  Each connection
+ * sends instances (see read_request) one after another, and each is queued for the pool of
+ * workers (which, with their arenas, stay warm between requests) and answered with its tour
+ * Param:   tsp_options * options -  The options to solve each instance with
+ * Return:  int -  EXIT_SUCCESS, or EXIT_FAILURE if the socket could not be set up
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int run_daemon(tsp_options * options) {
+    int fd;
+    struct sockaddr_un addr;
+    struct stat st;
+    pthread_t thread;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(socket_filename) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: the socket path %s is too long\n", socket_filename);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, socket_filename);
+
+    //A socket left behind by an earlier server is replaced (but nothing else is):
+    if(stat(socket_filename, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socket_filename);
+    daemon_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(daemon_fd < 0 || bind(daemon_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(daemon_fd, DAEMON_BACKLOG) < 0) {
+        fprintf(stderr, "Error: could not listen on %s\n", socket_filename);
+        return EXIT_FAILURE;
+    }
+
+    //Clients that go away before their answer shouldn't end the server:
+    signal(SIGPIPE, SIG_IGN);
+    if(start_pool(options) < 0)
+        return EXIT_FAILURE;
+    if(options->verbose)
+        printf("Listening on %s with %d workers...\n", socket_filename, batch_num_workers);
+
+    while(!stop_signal) {
+        fd = accept(daemon_fd, NULL, NULL);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        if(pthread_create(&thread, NULL, daemon_connection, (void *)(long)fd) != 0)
+            close(fd);
+        else
+            pthread_detach(thread);
+    }
+
+    close(daemon_fd);
+    unlink(socket_filename);
+    finish_pool();
+    if(options->verbose)
+        printf("Received signal %d: stopped\n", (int)stop_signal);
+    return EXIT_SUCCESS;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Serves one connection: reads its requests one at a time, queues each, and waits for
+ * it to be answered (by the worker that solves it) before reading the next
+ * Param:   void * arg -  The connection's socket
+ * Return:  void * -  NULL
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void * daemon_connection(void * arg) {
+    int fd = (long)arg;
+    FILE * file;
+    batch_job * job;
+    static int requests = 0;
+
+    file = fdopen(fd, "r");
+    if(file == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    while(!stop_signal && (job = read_request(file, fd)) != NULL) {
+        pthread_mutex_lock(&batch_lock);
+        job->index = ++requests;
+        pthread_mutex_unlock(&batch_lock);
+
+        //An invalid binary request is answered at once, and ends the connection
+        //(whatever follows it can't be told apart), as is one dropped when stopped:
+        if(job->text == NULL && job->cities == NULL) {
+            daemon_reply(NULL, job, -1);
+            batch_free(job);
+            break;
+        }
+        if(batch_push(job) < 0)
+            daemon_reply(NULL, job, -1);
+        else {
+            pthread_mutex_lock(&batch_lock);
+            while(!job->done)
+                pthread_cond_wait(&batch_finished, &batch_lock);
+            pthread_mutex_unlock(&batch_lock);
+
+            //(One dropped at shutdown, before a worker took it, is answered here):
+            if(!job->answered) {
+                daemon_reply(NULL, job, -1);
+                pthread_mutex_lock(&batch_lock);
+                batch_dropped--;
+                pthread_cond_broadcast(&batch_finished);
+                pthread_mutex_unlock(&batch_lock);
+            }
+        }
+        batch_free(job);
+    }
+
+    fclose(file);
+    return NULL;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads a request from a connection: either an instance as text (in either input format,
+ * ended by a line of EOF or by the client shutting down its side of the connection), or in
+ * binary: REQUEST_MAGIC, then the format version, the number of cities, and the id, x and y
+ * of each city (all 32-bit integers, in the machine's native byte order)
+ * Param:   FILE * file -  The connection
+ * Param:   int fd -  Its socket, which the answer is written to
+ * Return:  batch_job * -  The request (with neither text nor cities if it is invalid),
+ *                         or NULL at the end of the connection (or if out of memory)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+batch_job * read_request(FILE * file, int fd) {
+    char magic[4];
+    int header[2];
+    long len, n;
+    char * text = NULL;
+    batch_job * job;
+
+    job = calloc(1, sizeof(batch_job));
+    if(job == NULL)
+        return NULL;
+    job->fd = fd;
+
+    //Text is told from binary by its first 4 bytes (the shortest request, "EOF\n", has 4 too):
+    n = fread(magic, 1, 4, file);
+    if(n == 4 && memcmp(magic, REQUEST_MAGIC, 4) == 0) {
+        job->binary = 1;
+        if(fread(header, sizeof(int), 2, file) != 2) {
+            free(job);
+            return NULL;
+        }
+        if(header[0] != REQUEST_VERSION || header[1] < 1 || header[1] > REQUEST_MAX_CITIES)
+            return job;
+        job->cities = malloc(3L * header[1] * sizeof(int));
+        if(job->cities == NULL || fread(job->cities, 3 * sizeof(int), header[1], file) != (size_t)header[1]) {
+            batch_free(job);
+            return NULL;
+        }
+        job->num_cities = header[1];
+        return job;
+    }
+
+    len = n > 0 ? read_instance(file, magic, n, &text) : -1;
+    if(len < 0) {
+        free(job);
+        return NULL;
+    }
+    job->text = text;
+    job->len = len;
+    return job;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Answers a request with its tour, in the framing it came in: as text, the standard output format
+ * followed by a line of EOF, or in binary, the binary output format.  A request that could not be
+ * solved is answered with a tour length of -1 (and, in binary, no cities)
+ * Param:   tsp_solver * tsp -  The solver that solved it (or NULL)
+ * Param:   batch_job * job -  The request
+ * Param:   int distance -  The length of its tour, or -1 if it could not be solved
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void daemon_reply(tsp_solver * tsp, batch_job * job, int distance) {
+    char failed[16];
+
+    if(distance < 0 || tsp_write_tour_fd(tsp, job->fd) < 0)
+        write(job->fd, failed, format_failure(failed, job->binary));
+    if(!job->binary)
+        write(job->fd, "EOF\n", 4);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Formats the output for an instance that could not be solved: a tour length of -1 with no
+ * cities, in the standard or the binary output format
+ * Param:   char * buf -  Location to store it (16 bytes)
+ * Param:   int binary -  Whether to use the binary format
+ * Return:  int -  The number of bytes stored
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int format_failure(char * buf, int binary) {
+    int header[3] = {TOUR_VERSION, 0, -1};
+
+    if(!binary) {
+        memcpy(buf, "-1\n", 3);
+        return 3;
+    }
+    memcpy(buf, TOUR_MAGIC, 4);
+    memcpy(buf + 4, header, sizeof(header));
+    return 16;
+}
+
+
+//SIGNAL HANDLERS:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Signal handler for SIGINT or SIGTERM signals.  Only stops the solver: the algorithms
+ * check for it and return, and main prints the solution as usual.
+ * The handler is reset by the first signal, so a second one ends the program at once
+ * Param:   int sig -  The signal received
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void sig_handler(int sig) {
+    stop_signal = sig;
+    tsp_stop(solver, sig);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Signal handler for SIGUSR1 signals.  Only asks the solver for its statistics (-S),
+ * which are written the next time an algorithm checks for it
+ * Param:   int sig -  The signal received
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void stats_sig_handler(int sig) {
+    tsp_request_stats(solver);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Installs the signal handlers for SIGINT and SIGTERM, and for SIGUSR1
+ * Param:   void
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void install_sig_handlers(void) {
+    struct sigaction siga;
+
+    siga.sa_handler = sig_handler;
+    sigemptyset(&siga.sa_mask);
+    siga.sa_flags = SA_RESETHAND;
+
+    sigaction(SIGTERM, &siga, NULL);
+    sigaction(SIGINT, &siga, NULL);
+
+    //SIGUSR1 may come any number of times, and shouldn't interrupt reading the input:
+    siga.sa_handler = stats_sig_handler;
+    siga.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &siga, NULL);
+}
@@ -5,12 +5,13 @@
  * Date: 8/28/2013
  *
  * Includes a variety of algorithms for solving the travelling
- * salesman problem: nearest neighbor, 2-opt, simulated anneal,
- * and a combination of 2-opt and simulated anneal.
+ * salesman problem: nearest neighbor, 2-opt, Lin-Kernighan style,
+ * iterated local search, simulated anneal, parallel tempering, and a combination of 2-opt and simulated anneal.
  *
- * Use tsp -h for usage information
+ * This is the solver library: see tsp.h for its interface, and main.c for the tsp command
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,206 +19,1402 @@
 #include <signal.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_SCAN 1
+#endif
+#include "tsp.h"
 
 
 //CONSTANTS:
 
 //Limits and buffer sizes:
-#define LINE_MAX 128
-#define WORD_MAX 64
-#define MAX_CITIES 32768 
+#define FILENAME_LEN 1024
+#define READ_CHUNK 65536
+
+//Binary tour files start with this magic number and format version:
+#define TOUR_MAGIC "TSPT"
+#define TOUR_VERSION 1
+
+//Instance cache files start with this magic number and format version:
+#define CACHE_MAGIC "TSPC"
+#define CACHE_VERSION 2
+
+//Above this many cities, distances are calculated on the fly
+//instead of being stored in a matrix (can be changed with -m):
+#define MATRIX_MAX_CITIES 10000
+
+//Largest distance that can be stored in the 16-bit distance matrix:
+#define MAX_DISTANCE_16 65535
+
+//Number of city pairs sampled to estimate the average distance
+//when there is no distance matrix:
+#define AVG_SAMPLES 100000
 
 //Control values for anneal/hybrid algorithm:
 #define SATISFIED 10000
-#define START_TEMP (avg_distance/40.0)
-#define END_TEMP (avg_distance/10.0)
+#define START_TEMP (tsp->avg_distance/40.0)
+#define END_TEMP (tsp->avg_distance/10.0)
 
 //Only for anneal:
 #define DELTA_TEMP (.9999)
 
+//Moves that make the path longer by more than this many times the temperature
+//are always rejected (exp(-ACCEPT_MAX_EXP) is too small to matter), and the
+//number of entries per unit in the table of exp(-x) for 0 <= x < ACCEPT_MAX_EXP:
+#define ACCEPT_MAX_EXP 40
+#define EXP_TABLE_STEPS 64
+
+//Only for iterated local search: the number of kicks in a row without a shorter
+//path before stopping, and the longest segment moved by a double-bridge kick:
+#define ILS_SATISFIED 10000
+#define ILS_KICK_LEN 50
+
+//Only for parallel tempering: the temperatures of the coldest and hottest replicas,
+//the number of moves each replica tries between exchanges, and the number of
+//exchange rounds without a new best path before stopping:
+#define PT_MIN_TEMP (START_TEMP/1000.0)
+#define PT_MAX_TEMP (START_TEMP)
+#define PT_EXCHANGE_STEPS 10000
+#define PT_SATISFIED 100
+
+//With a time limit (-T), the clock is checked once every this many moves tried
+//(a power of 2), and this fraction of the time limit is kept back for printing the solution:
+#define TIME_CHECK_INTERVAL 256
+#define TIME_RESERVE (.05)
+
+//Cities are placed on a Hilbert curve through a grid of 2^HILBERT_BITS by 2^HILBERT_BITS cells:
+#define HILBERT_BITS 16
+
+//Cities at a time checked by two_opt_scan when looking for 2-opt swaps worth trying:
+#define SCAN_BLOCK 64
+
+//Number of nearest neighbors kept per city for the neighbor list algorithms:
+#define NUM_NEIGHBORS 10
+
+//Only for lin-kernighan: the deepest chain of 2-opt moves tried,
+//the number of neighbors tried at each depth (1 beyond the listed depths),
+//and the longest segment moved by an Or-opt move:
+#define LK_MAX_DEPTH 10
+#define LK_BREADTH {5, 5, 3}
+#define OR_OPT_MAX_LEN 3
+
+//Only for the partition (-g): at least this many cities per cell, the share
+//of the time left (with a time limit) spent solving the cells rather than repairing the seams,
+//and the smallest number of cities to find the neighbor lists for with more than one thread:
+#define CELL_MIN_CITIES 8
+#define CELL_TIME_SHARE .75
+#define NEIGHBOR_THREAD_MIN 10000
+
+//Only for k-means cells (-K): the rounds of Lloyd's algorithm, run on a sample
+//of this many cities per cell before every city is given to its nearest center:
+#define KMEANS_ROUNDS 10
+#define KMEANS_SAMPLE 200
+
+//Phases of a run, each timed for the statistics written with -S:
+#define PHASE_READ 0
+#define PHASE_DISTANCES 1
+#define PHASE_CONSTRUCTION 2
+#define PHASE_IMPROVEMENT 3
+#define PHASE_OUTPUT 4
+#define NUM_PHASES 5
+
+//Points on the improvement trace (-S) are at least this many seconds apart:
+#define TRACE_INTERVAL .01
+
+//Tours with at least this many cities are kept in a two-level list
+//(smaller ones in a plain array):
+#define TWO_LEVEL_MIN_CITIES 5000
+
+//Arenas (tsp_arena) hand out memory aligned to this many bytes (a cache line),
+//from blocks of at least this many bytes:
+#define ARENA_ALIGN 64
+#define ARENA_MIN_BLOCK (1L << 20)
+
 
 //STRUCTS:
 
-//Information for a single city, as read in:
-typedef struct city {
-    int id;
-    int x;
-    int y;
-} city;
+//A city in the two-level list: its neighbors in its segment's own direction,
+//its sequence number (increasing in that direction), and its segment:
+typedef struct tour_node {
+    int next;
+    int prev;
+    int seq;
+    int parent;
+} tour_node;
+
+//A segment of the two-level list: its first and last cities (in its own direction),
+//whether it is traversed in reverse, its neighboring segments, its rank in the
+//order of segments, and its number of cities:
+typedef struct tour_segment {
+    int first;
+    int last;
+    int reversed;
+    int next;
+    int prev;
+    int rank;
+    int size;
+} tour_segment;
+
+
+//The header of an instance cache file: the magic number and format version,
+//the number of cities, the number of neighbors per city in the neighbor lists (0 if none),
+//the size of the distance matrix entries (0 if none, 16 or 32 bits), the average distance,
+//and the size and modification time (to the nanosecond) of the input file it was made from.  It is followed by
+//the city ids, x and y coordinates, the neighbor lists and the distance matrix:
+typedef struct cache_header {
+    char magic[4];
+    int32_t version;
+    int32_t num_cities;
+    int32_t num_neighbors;
+    int32_t matrix_bits;
+    int32_t avg_distance;
+    int64_t source_size;
+    int64_t source_mtime;
+    int64_t source_mtime_nsec;
+} cache_header;
+
+//A city's position along the Hilbert curve, for sorting the cities by it:
+typedef struct curve_point {
+    uint64_t key;
+    int index;
+} curve_point;
+
+//The state of a xoshiro256** random number generator:
+typedef struct rng_state {
+    uint64_t s[4];
+} rng_state;
+
+//Move counters for the statistics written with -S: the candidate moves whose change
+//in length was calculated, the moves made, the moves made that lengthened the tour,
+//and the improvements of the best tour found:
+typedef struct solver_stats {
+    long long evaluated;
+    long long accepted;
+    long long uphill;
+    long long improvements;
+} solver_stats;
+
+//A point on the improvement trace: the time (since startup) and the best distance then:
+typedef struct trace_point {
+    double time;
+    int distance;
+} trace_point;
+
+//A parallel tempering replica: the solver it belongs to, the path it is working on and its distance,
+//its (fixed) temperature, the best distance it has found (and whether its path
+//has been saved with set_best if it is that best), its own random number generator,
+//its move counters (added to the totals at each exchange), and its thread:
+typedef struct replica {
+    tsp_solver * tsp;
+    int * path;
+    int dst;
+    double temp;
+    int best;
+    int saved;
+    rng_state rng;
+    solver_stats stats;
+    pthread_t thread;
+} replica;
+
+//A share of the cities calc_neighbors finds the neighbor lists of on a thread: the solver,
+//and the first index in its list of cities and one past the last:
+typedef struct neighbor_range {
+    tsp_solver * tsp;
+    int lo;
+    int hi;
+} neighbor_range;
+
+//The cells of a partition, shared by the threads solving them (see partition_tour):
+//the solver, its cities grouped by cell and where each cell starts in them, the tours
+//of the cells (in the same places), the time each cell may take, and the next cell to solve
+//(taken under the lock):
+typedef struct partition_work {
+    tsp_solver * tsp;
+    int * order;
+    int * cell_start;
+    int * tours;
+    double budget;
+    int next;
+    pthread_mutex_t lock;
+} partition_work;
+
+//A block of an arena's memory (which follows the header), and how much of it is handed out:
+typedef struct arena_block {
+    struct arena_block * next;
+    size_t size;
+    size_t used;
+} arena_block;
+
+//An arena (tsp_arena in tsp.h): its blocks, the newest (the one allocated from) first,
+//their total size, and where the last allocation from the newest block starts
+//(so that it can be grown or given back in place):
+struct tsp_arena {
+    arena_block * blocks;
+    size_t total;
+    size_t last;
+    pthread_mutex_t lock;
+};
+
+//A solver (tsp_solver in tsp.h), holding everything the algorithms work on.  Only one thread
+//works on a solver at a time, apart from the threads it starts itself (and tsp_stop, etc.):
+struct tsp_solver {
+
+    //Where memory comes from (see tsp_allocator), and the solver this one is
+    //solving a cell for (which stops when it does), if any:
+    tsp_allocator alloc;
+    tsp_solver * parent;
+
+    //The original ids of the cities (in input order), and the coordinates of each city.
+    //Everything else refers to a city by its index in these arrays (0 to num_cities-1),
+    //and only the output translates back to the original ids
+    //(all grown as needed while reading the input):
+    int * city_ids;
+    int num_cities;
+    int cities_size;
+    int * city_x;
+    int * city_y;
+
+    //The tour to start from, if one was given (as original ids, translated by start_tour):
+    int * start_ids;
+    int start_len;
+
+    //The triangular matrix of distances between cities, packed into a single
+    //array with 16-bit entries if all distances fit and 32-bit entries otherwise
+    //(both NULL if distances are calculated on the fly),
+    //and the average distance between cities:
+    unsigned short * distances16;
+    unsigned int * distances32;
+    int avg_distance;
+    int matrix_max_cities;
+
+    //The lists of nearest neighbors (sorted by distance) for each city id
+    //(and the list of cities calc_neighbors is finding them for, or, while tsp_update repairs a tour,
+    //which lists have been found so far, see neighbor_list), and the queue of cities still to be examined
+    //(a city not in the queue has its don't-look bit set):
+    int * neighbors;
+    int * neighbor_list;
+    char * neighbors_found;
+    int * queue;
+    char * queued;
+    int queue_head;
+    int queue_len;
+    int queue_size;
+
+    //The partition (-g): the cell each city is in (kept for repairing the seams between
+    //the cells), and the number of cells solved at once (and of threads finding the
+    //neighbor lists), one per processor unless given:
+    int * cell_of;
+    int num_workers;
+
+    //The tour that the tour operations (tour_next, tour_move, etc.) work on.
+    //Small tours are kept in tour_path, with the index of each city id in position.
+    //Large ones are kept in a two-level list: the cities are split into segments of
+    //about sqrt(n) cities that can each be traversed in either direction, so reversing
+    //a section of the tour only relinks whole segments (after splitting the two at its
+    //ends).  Positions in the tour are counted from tour_head:
+    int * tour_path;
+    int tour_len;
+    int tour_head;
+    int * position;
+    int two_level;
+    tour_node * nodes;
+    tour_segment * segments;
+    int * seg_scratch;
+    int num_segments;
+    int max_segments;
+
+    //The tour_moves made since tour_log_clear() (4 cities each, stored as the move
+    //that undoes them), kept so that they can be undone by tour_log_undo():
+    int * tour_log;
+    int tour_log_len;
+    int tour_log_size;
+    int tour_logging;
+
+    //The k-d tree over the city coordinates.  The city ids are ordered so that the
+    //middle element of each range splits the range along the dimension in kd_dim
+    //(0 for x, 1 for y); kd_alive holds the number of cities not yet removed in the
+    //subtree rooted at each middle element, and kd_slot holds each city id's index:
+    int * kd_ids;
+    char * kd_dim;
+    int * kd_alive;
+    char * kd_removed;
+    int * kd_slot;
+    int kd_size;
+
+    //The random number generator used by the single-threaded algorithms, and the seed
+    //it (and each parallel tempering replica's generator) was seeded from:
+    rng_state rng;
+    uint64_t seed;
+
+    //The time limit (0 if none), and the time (as returned by get_time)
+    //by which the algorithms must stop to leave time for printing the solution:
+    double time_limit;
+    double deadline;
+
+    //The time between checkpoints (0 if none), and the time
+    //(as returned by get_time) of the next checkpoint:
+    double checkpoint_interval;
+    double next_checkpoint;
+
+    //The signal given to tsp_stop, if any (0 if none), which tells the algorithms
+    //to stop and leave their best path to be printed:
+    volatile sig_atomic_t stop_signal;
+
+    //Set (by no_memory) when an allocation fails, which stops the algorithms as a signal does,
+    //and makes tsp_solve and tsp_update return -1:
+    int out_of_memory;
+
+    //Set by tsp_request_stats to ask for the statistics to be written at the next check:
+    volatile sig_atomic_t stats_signal;
+
+    //The statistics written with tsp_write_stats: the move counters, the time spent in each phase,
+    //the current phase and when it (and the run) started, and the improvement trace:
+    solver_stats stats;
+    double phase_time[NUM_PHASES];
+    int phase;
+    double phase_start;
+    double run_start;
+    trace_point * trace;
+    int trace_len;
+    int trace_size;
+
+    //The optimal distance/path found thus far
+    //(printed on a SIGTERM or SIGINT), and the lock held while it is updated:
+    int best_distance;
+    int * best_path;
+    pthread_mutex_t best_lock;
+
+    //The buffer the solution is formatted into by print_solution
+    //(allocated up front, so that printing needs no memory allocation):
+    char * out_buf;
+
+    //The parallel tempering replicas (one per thread, from coldest to hottest),
+    //the barrier they meet at between exchanges, the exchange round counts,
+    //and the best distance at the last exchange:
+    replica * replicas;
+    int num_replicas;
+    pthread_barrier_t temper_barrier;
+    int temper_round;
+    int temper_idle;
+    int temper_last_best;
+
+    //The options chosen (see tsp_options):
+    int algorithm;
+    int use_hilbert;
+    int num_threads;
+    int num_cells;
+    int use_kmeans;
+    int verbose;
+    int debug;
+
+    //The input and output options/filenames (in_file and out_file
+    //are set if the input was read from, or the output goes to, a file):
+    int in_file;
+    char in_filename[FILENAME_LEN];
+    int out_file;
+    char out_filename[FILENAME_LEN+8];
+    int binary_output;
+    int use_cache;
+    int use_stats;
+    char stats_filename[FILENAME_LEN];
+    char cache_filename[FILENAME_LEN+8];
+
+    //The memory-mapped instance cache, if one was loaded, and whether
+    //the distance matrix and neighbor lists point into it (rather than being allocated):
+    char * cache_map;
+    long cache_len;
+    int distances_cached;
+    int neighbors_cached;
+};
 
 
 //FUNCTION PROTOTYPES:
 
-void get_options(int argc, char **argv);
-void set_best(int distance, int *path);
-void swap(int i, int j, int *array);
-void copy_array(int *to, int *from, int len);
-int get_list_of_cities(int *list);
-void read_input(void);
-city *read_city(char *line);
-void print_distances(void);
-void print_distance(int i, int j);
-void print_cities(void);
-void print_city(city *c);
-void print_solution(void);
-void calc_distances(int max_id);
-int calc_distance(city *a, city *b);
-int get_distance(int i, int j);
-int calc_path_dist(int *path, int len);
-void free_distances(void);
-void nearest_neighbor(int *path, int len);
-int swap_closest(int *remaining, int num_remaining);
-void two_opt(int *path, int len);
-void hybrid(int * path, int len);
-void anneal(int *path, int len);
-int anneal_accept(int new_dst, int old_dst, double temp);
-double change_temp(double old_temp);
-void two_opt_swap(int i, int j, int *path);
-int two_opt_dist(int old_dist, int i, int j, int *path, int len);
-void sig_handler(int sig);
-void install_sig_handlers(void);
-double get_max(double a, double b);
+static void set_best(tsp_solver *tsp, int distance, int *path);
+static void swap(int i, int j, int *array);
+static int compare_ints(const void *a, const void *b);
+static void copy_array(int *to, int *from, int len);
+static int get_list_of_cities(tsp_solver *tsp, int *list);
+static int read_input(tsp_solver *tsp);
+static int parse_input(tsp_solver *tsp, char *p, char *end);
+static char * read_tsplib_header(tsp_solver *tsp, char *p, char *end);
+static int read_city(tsp_solver *tsp, char *p, char *eol);
+static int add_city(tsp_solver *tsp, int id, int x, int y);
+static int grow_cities(tsp_solver *tsp, int size);
+static int read_tour(tsp_solver *tsp, const char *filename);
+static int start_tour(tsp_solver *tsp, int *path);
+static int check_city_ids(tsp_solver *tsp);
+static int compare_city_ids(const void *a, const void *b, void *arg);
+static char * skip_space(char *p, char *end);
+static char * parse_int(char *p, char *end, long *value);
+static char * parse_coord(char *p, char *end, int *value);
+static int print_solution(tsp_solver *tsp);
+static long format_tour(tsp_solver *tsp, char *buf, int distance, int *path, int len);
+static long format_tour_binary(tsp_solver *tsp, char *buf, int distance, int *path, int len);
+static char * format_int(char *p, int value);
+static int write_all(int fd, char *buf, long len);
+static void set_phase(tsp_solver *tsp, int next);
+static void stats_improved(tsp_solver *tsp, int dst);
+static void stats_trace(tsp_solver *tsp, int dst);
+static void write_stats(tsp_solver *tsp);
+static int load_cache(tsp_solver *tsp);
+static void write_cache(tsp_solver *tsp);
+static long cache_matrix_size(tsp_solver *tsp);
+static int uncache_cities(tsp_solver *tsp);
+static int calc_distances(tsp_solver *tsp, int max_id);
+static int calc_distance(tsp_solver *tsp, int i, int j);
+static void calc_avg_distance(tsp_solver *tsp, int *list, int len, int max_id);
+static int get_distance(tsp_solver *tsp, int i, int j);
+static long tri_index(int i, int j);
+static int calc_max_distance(tsp_solver *tsp);
+static int calc_path_dist(tsp_solver *tsp, int *path, int len);
+static void free_distances(tsp_solver *tsp);
+static void improve(tsp_solver *tsp, int *path, int len, int max_id);
+static int solve_path(tsp_solver *tsp, int *path, int max_id);
+static void nearest_neighbor(tsp_solver *tsp, int *path, int len);
+static void hilbert_tour(tsp_solver *tsp, int *path, int len);
+static int hilbert_renumber(tsp_solver *tsp);
+static uint64_t hilbert_key(uint32_t x, uint32_t y);
+static int compare_curve_points(const void *a, const void *b);
+static void two_opt(tsp_solver *tsp, int *path, int len);
+static void hybrid(tsp_solver *tsp, int * path, int len);
+static void partition_tour(tsp_solver *tsp, int *path, int len);
+static int partition_cells(tsp_solver *tsp, int *order, int len, int **cell_start);
+static int cluster_cells(tsp_solver *tsp, int *order, int len, int **cell_start);
+static void free_clusters(tsp_solver *tsp, int *sample, double *center, double *sum, double *d2,
+                          int *cluster, int *count, int *tour, int *rank);
+static int kmeans_nearest(tsp_solver *tsp, int id, double *center, int k);
+static void * solve_cells(void *arg);
+static void solve_cell(tsp_solver *tsp, partition_work *work, int c);
+static void stitch_cells(tsp_solver *tsp, int *tours, int *cell_start, int *path);
+static void partition_repair(tsp_solver *tsp, int *path, int len, int max_id);
+static int compare_x(const void *a, const void *b, void *arg);
+static int compare_y(const void *a, const void *b, void *arg);
+static int update_repair(tsp_solver *tsp, int *list, int *path, char *bridged, int len, int first, int dst);
+static int update_cut(tsp_solver *tsp, int *path, char *bridged, int *drop, int num_drop, int *dst);
+static int update_insert(tsp_solver *tsp, int *path, int len, int first, int *dst);
+static void anneal(tsp_solver *tsp, int *path, int len);
+static int anneal_accept(int new_dst, int old_dst, double temp, rng_state *r);
+static void init_exp_table(void);
+static void init_tables(void);
+static double change_temp(double old_temp);
+static void parallel_tempering(tsp_solver *tsp, int *path, int len);
+static void free_replicas(tsp_solver *tsp);
+static void * temper_replica(void *arg);
+static void temper_exchange(tsp_solver *tsp);
+static void two_opt_swap(int i, int j, int *path);
+static int two_opt_dist(tsp_solver *tsp, int old_dist, int i, int j, int *path, int len);
+static int two_opt_flip_dist(tsp_solver *tsp, int old_dist, int a, int c);
+static int two_opt_scan(tsp_solver *tsp, int a, int *c, int head, double limit);
+static int scan_block(tsp_solver *tsp, int p, int a, int *cs, int m, double limit);
+#ifdef HAVE_AVX2_SCAN
+static int scan_block_avx2(tsp_solver *tsp, int p, int a, int *cs, int m, double limit);
+static __m256d distance_avx2(__m256d x1, __m256d y1, __m256d x2, __m256d y2);
+#endif
+static void init_scan(void);
+static void two_opt_neighbors(tsp_solver *tsp, int *path, int len);
+static int two_opt_neighbor_move(tsp_solver *tsp, int a, int *dst);
+static int init_neighbors(tsp_solver *tsp, int *list, int len, int max_id);
+static int calc_neighbors(tsp_solver *tsp, int *list, int len, int max_id);
+static void * calc_neighbors_range(void *arg);
+static int * neighbor_list(tsp_solver *tsp, int id);
+static void free_neighbors(tsp_solver *tsp);
+static void queue_push(tsp_solver *tsp, int id);
+static int queue_pop(tsp_solver *tsp);
+static void lin_kernighan(tsp_solver *tsp, int *path, int len);
+static void lk_improve(tsp_solver *tsp, int *path, int len, int dst);
+static int lk_step(tsp_solver *tsp, int t1, int t2, int gain, int depth);
+static int or_opt_move(tsp_solver *tsp, int s1, int *dst);
+static void iterated_local_search(tsp_solver *tsp, int *path, int len);
+static int ils_kick(tsp_solver *tsp, int a);
+static void ils_repair(tsp_solver *tsp, int *dst);
+static int tour_init(tsp_solver *tsp, int *path, int len);
+static void tour_get_path(tsp_solver *tsp, int *path);
+static void tour_free(tsp_solver *tsp);
+static int tour_next(tsp_solver *tsp, int a);
+static int tour_prev(tsp_solver *tsp, int a);
+static int tour_between(tsp_solver *tsp, int a, int b, int c);
+static long tour_key(tsp_solver *tsp, int a);
+static int tour_city_at(tsp_solver *tsp, int i);
+static void tour_flip(tsp_solver *tsp, int b, int c);
+static void tour_move(tsp_solver *tsp, int a, int b, int c, int d);
+static int tour_span(tsp_solver *tsp, int b, int c);
+static void tour_reverse(tsp_solver *tsp, int i, int j);
+static void tour_build_segments(tsp_solver *tsp);
+static void tour_split(tsp_solver *tsp, int x);
+static void tour_flip_segments(tsp_solver *tsp, int b, int c);
+static void tour_set_next(tsp_solver *tsp, int a, int b);
+static void tour_set_prev(tsp_solver *tsp, int a, int b);
+static void tour_log_clear(tsp_solver *tsp);
+static void tour_log_undo(tsp_solver *tsp);
+static int kd_build(tsp_solver *tsp, int *list, int len, int max_id);
+static void kd_build_range(tsp_solver *tsp, int lo, int hi);
+static void kd_select(tsp_solver *tsp, int lo, int hi, int nth, int dim);
+static void kd_remove(tsp_solver *tsp, int id);
+static void kd_restore(tsp_solver *tsp);
+static void kd_restore_range(tsp_solver *tsp, int lo, int hi);
+static int kd_nearest(tsp_solver *tsp, int id, int k, int *found);
+static void kd_search(tsp_solver *tsp, int lo, int hi, double x, double y, int exclude, int k, int *found, double *found_dst, int *num);
+static void kd_free(tsp_solver *tsp);
+static double get_max(double a, double b);
+static double get_time(void);
+static int should_stop(tsp_solver *tsp);
+static int checkpoint_due(tsp_solver *tsp);
+static void write_checkpoint(tsp_solver *tsp);
+static void rng_seed(rng_state *r, uint64_t seed);
+static uint64_t rng_next(rng_state *r);
+static int rng_int(rng_state *r, int n);
+static double rng_double(rng_state *r);
+static void * mem_alloc(tsp_solver *tsp, size_t size);
+static int no_memory(tsp_solver *tsp);
+static void * mem_calloc(tsp_solver *tsp, size_t num, size_t size);
+static void * mem_realloc(tsp_solver *tsp, void *ptr, size_t old_size, size_t size);
+static void mem_free(tsp_solver *tsp, void *ptr);
+static void * std_alloc(void *data, size_t size);
+static void * std_realloc(void *data, void *ptr, size_t old_size, size_t size);
+static void std_free(void *data, void *ptr);
+static arena_block * arena_grow(tsp_arena *arena, size_t size);
+static void * arena_alloc(void *data, size_t size);
+static void * arena_realloc(void *data, void *ptr, size_t old_size, size_t size);
+static void arena_free(void *data, void *ptr);
+
+//Not static, so that they can be called from a debugger:
+void print_distances(tsp_solver *tsp);
+void print_distance(tsp_solver *tsp, int i, int j);
+void print_cities(tsp_solver *tsp);
+void print_city(tsp_solver *tsp, int id);
 
 
 //STATIC VARIABLES:
 
-//The list of cities and their coordinates:
-static city * cities[MAX_CITIES];
-static int num_cities;
-
-//The matrix of distances between cities
-//and the average distance between cities:
-static int ** distances;
-static int avg_distance;
-
-//The optimal distance/path found thus far
-//(printed on a SIGTERM or SIGINT):
-static int best_distance;
-static int * best_path;
-
-//The command line options chosen:
-static int use_anneal = 0;
-static int use_nearest_neighbor = 0;
-static int use_two_opt = 0;
-static int verbose = 0;
-static int debug = 0;
-
-//The input and output options/filenames:
-static int in_file = 0;
-static char in_filename[WORD_MAX];
-static int out_file = 0;
-static char out_filename[WORD_MAX];
-
-int main (int argc, char * argv[]) {
-    int * path;
-    int max_id;
+//The table of exp(-x) used by anneal_accept, and the function two_opt_scan checks blocks
+//of cities with (chosen by init_scan for the processor), shared by every solver:
+static double exp_table[ACCEPT_MAX_EXP*EXP_TABLE_STEPS + 1];
+static int (* scan_kernel)(tsp_solver * tsp, int p, int a, int * cs, int m, double limit);
+
+//Makes sure the tables above are set up once, by the first tsp_create:
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+
+//SOLVER:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Fills in the default options: the hybrid algorithm, starting from a nearest neighbor tour,
+ * with no time limit, seeded from the current time, and writing to stdout
+ * Param:   tsp_options * options -  The options to fill in
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void tsp_default_options(tsp_options * options) {
+    memset(options, 0, sizeof(tsp_options));
+    options->algorithm = TSP_HYBRID;
+    options->seed = time(NULL);
+    options->matrix_max_cities = MATRIX_MAX_CITIES;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Creates a solver with no cities yet.  Its clock starts now: with a time limit,
+ * adding or reading the cities counts against it too
+ * Param:   const tsp_options * options -  The options (copied, with the filenames, so they need not be kept)
+ * Param:   const tsp_allocator * allocator -  Where the solver gets its memory from (copied),
+ *                                             or NULL for malloc, realloc and free
+ * Return:  tsp_solver * -  The solver, or NULL if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+tsp_solver * tsp_create(const tsp_options * options, const tsp_allocator * allocator) {
+    tsp_solver * tsp;
+    tsp_allocator standard = {std_alloc, std_realloc, std_free, NULL};
+    double now;
+
+    pthread_once(&tables_once, init_tables);
+    if(allocator == NULL)
+        allocator = &standard;
+    tsp = allocator->alloc(allocator->data, sizeof(tsp_solver));
+    if(tsp == NULL)
+        return NULL;
+    memset(tsp, 0, sizeof(tsp_solver));
+    tsp->alloc = *allocator;
+    tsp->best_distance = -1;
+    pthread_mutex_init(&tsp->best_lock, NULL);
+
+    tsp->algorithm = options->algorithm;
+    tsp->use_hilbert = options->use_hilbert;
+    tsp->num_threads = options->num_threads > 0 ? options->num_threads : 1;
+    tsp->num_cells = options->num_cells;
+    tsp->use_kmeans = options->use_kmeans;
+    tsp->matrix_max_cities = options->matrix_max_cities;
+    tsp->use_cache = options->use_cache;
+    tsp->binary_output = options->binary_output;
+    tsp->verbose = options->verbose || options->debug;
+    tsp->debug = options->debug;
+    if(options->out_filename) {
+        tsp->out_file = 1;
+        snprintf(tsp->out_filename, sizeof(tsp->out_filename), "%s", options->out_filename);
+    }
+    if(options->stats_filename) {
+        tsp->use_stats = 1;
+        snprintf(tsp->stats_filename, FILENAME_LEN, "%s", options->stats_filename);
+    }
+
+    tsp->num_workers = options->num_workers;
+    if(tsp->num_workers <= 0)
+        tsp->num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if(tsp->num_workers < 1)
+        tsp->num_workers = 1;
+
+    //Seed the random number generator:
+    tsp->seed = options->seed;
+    if(tsp->verbose)
+        printf("Random seed: %llu\n", (unsigned long long)tsp->seed);
+    rng_seed(&tsp->rng, tsp->seed);
+    if(tsp->debug)
+        printf("Scanning 2-opt swaps with %s\n", scan_kernel == scan_block ? "scalar code" : "AVX2");
+
+    //Start the clock, set the deadline for the algorithms, if there is a time limit,
+    //and the time of the first checkpoint:
+    now = get_time();
+    tsp->run_start = tsp->phase_start = now;
+    tsp->phase = PHASE_READ;
+    tsp->time_limit = options->time_limit;
+    if(tsp->time_limit > 0)
+        tsp->deadline = now + tsp->time_limit * (1 - TIME_RESERVE);
+    tsp->checkpoint_interval = options->checkpoint_interval;
+    tsp->next_checkpoint = now + tsp->checkpoint_interval;
+
+    return tsp;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Frees a solver and everything it allocated
+ * Param:   tsp_solver * tsp -  The solver (may be NULL)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void tsp_free(tsp_solver * tsp) {
+    if(tsp == NULL)
+        return;
+
+    free_distances(tsp);
+    kd_free(tsp);
+    if(!tsp->neighbors_cached)
+        mem_free(tsp, tsp->neighbors);
+    if(tsp->cache_map)
+        munmap(tsp->cache_map, tsp->cache_len);
+    else {
+        mem_free(tsp, tsp->city_ids);
+        mem_free(tsp, tsp->city_x);
+        mem_free(tsp, tsp->city_y);
+    }
+    mem_free(tsp, tsp->start_ids);
+    mem_free(tsp, tsp->cell_of);
+    mem_free(tsp, tsp->best_path);
+    mem_free(tsp, tsp->out_buf);
+    mem_free(tsp, tsp->trace);
+    pthread_mutex_destroy(&tsp->best_lock);
+    tsp->alloc.free(tsp->alloc.data, tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Adds a city to the instance (before tsp_solve)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int id -  The city's id (used only in the tours given back)
+ * Param:   int x -  Its x coordinate
+ * Param:   int y -  Its y coordinate
+ * Return:  int -  0, or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_add_city(tsp_solver * tsp, int id, int x, int y) {
+    return add_city(tsp, id, x, y);
+}
 
-    //Install the SIGINT/SIGTERM signal handlers:
-    install_sig_handlers();
 
-    //Get command line options:
-    get_options(argc, argv);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads the cities of the instance from a file (or from its cache, with use_cache) or stdin
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   const char * filename -  The input file, or NULL for stdin
+ * Return:  int -  0, or -1 if the input could not be read
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_read(tsp_solver * tsp, const char * filename) {
+    if(filename) {
+        tsp->in_file = 1;
+        snprintf(tsp->in_filename, FILENAME_LEN, "%s", filename);
+        snprintf(tsp->cache_filename, sizeof(tsp->cache_filename), "%s%s", tsp->in_filename, ".cache");
+    }
+
+    if(tsp->use_cache && !tsp->in_file && tsp->verbose)
+        printf("Can only cache input from a file (-f), not using a cache...\n");
+    if(tsp->use_cache && tsp->in_file && load_cache(tsp))
+        return 0;
 
-    //Read input, get list of cities:
-    if(verbose)
+    if(tsp->verbose)
         printf("Reading input...\n");
-    read_input();
+    return read_input(tsp);
+}
 
-    //Initialize variables to hold paths:
-    best_path = malloc((num_cities) * sizeof(int));
-    path = malloc((num_cities) * sizeof(int));
 
-    //Get simple list of city ids into our working path:
-    max_id = get_list_of_cities(path);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads the cities of the instance from text in memory, in the same formats as tsp_read
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   const char * text -  The instance (which need not end with a newline)
+ * Param:   long len -  Its length
+ * Return:  int -  0, or -1 if the input could not be read
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_parse(tsp_solver * tsp, const char * text, long len) {
+    //(The parser only reads the text):
+    return parse_input(tsp, (char *)text, (char *)text + len);
+}
+
 
-    //Get matrix of distances between cities:
-    if(verbose)
-        printf("Calculating distances...\n");
-    calc_distances(max_id);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gives the tour to start from, instead of building one.  It is checked by tsp_solve,
+ * which fails if it doesn't visit every city exactly once
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   const int * ids -  The tour (the cities' ids, in order)
+ * Param:   int len -  The length of the tour
+ * Return:  int -  0, or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_set_tour(tsp_solver * tsp, const int * ids, int len) {
+    int i;
 
-    //Call nearest_neighbor algorithm to get a good first approximation:
-    if(verbose)
-        printf("Calling nearest neighbor algorithm...\n");
-    nearest_neighbor(path, num_cities);
+    mem_free(tsp, tsp->start_ids);
+    tsp->start_ids = mem_alloc(tsp, (len > 0 ? len : 1) * sizeof(int));
+    if(tsp->start_ids == NULL) {
+        tsp->start_len = 0;
+        return -1;
+    }
+    for(i=0; i<len; i++) {
+        tsp->start_ids[i] = ids[i];
+    }
+    tsp->start_len = len;
+    return 0;
+}
 
-    //Unless nearest neighbor is being used alone,
-    //call another algorithm to improve the answer:
-    if(!use_nearest_neighbor) {
 
-        //Simulated Anneal:
-        if(use_anneal) {
-            if(verbose)
-                printf("Calling anneal...\n");
-            anneal(path, num_cities);
-        }
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads the tour to start from (see tsp_set_tour) from a file, e.g. an earlier .tour
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   const char * filename -  The tour file (in standard or binary format)
+ * Return:  int -  0, or -1 if the file could not be read
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_read_tour(tsp_solver * tsp, const char * filename) {
+    return read_tour(tsp, filename) ? 0 : -1;
+}
 
-        //Two-opt:
-        else if(use_two_opt) {
-            if(verbose)
-                printf("Calling two-opt...\n");
-            two_opt(path, num_cities);
-        }
 
-        //Default: Hybrid algorithm 
-        else {
-            if(verbose)
-                printf("Calling hybrid algorithm...\n");
-            hybrid(path, num_cities);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves the instance: builds a first tour (or starts from the given one), then improves it with the
+ * algorithm chosen, until it is done, the time limit is reached or tsp_stop is called
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  The distance of the best tour found, or -1 if there are no cities, two cities have the same id,
+ *                  the tour to start from isn't a tour of these cities (or it is out of memory)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_solve(tsp_solver * tsp) {
+    int * path;
+    int max_id, result;
+
+    if(tsp->num_cities < 1 || tsp->best_path)
+        return -1;
+
+    //(A cache holds the cities already checked and renumbered):
+    if(!tsp->cache_map) {
+        if(check_city_ids(tsp) < 0)
+            return -1;
+        if(tsp->verbose)
+            printf("Renumbering cities along a Hilbert curve...\n");
+        if(hilbert_renumber(tsp) < 0)
+            return -1;
+    }
+
+    //Initialize variables to hold paths, and room for the solution as text (up to 11 characters
+    //and a newline for each number), which is also enough for the binary format:
+    tsp->best_path = mem_alloc(tsp, (tsp->num_cities) * sizeof(int));
+    tsp->out_buf = mem_alloc(tsp, (tsp->num_cities+1) * 12L);
+    path = mem_alloc(tsp, (tsp->num_cities) * sizeof(int));
+    if(tsp->best_path == NULL || tsp->out_buf == NULL || path == NULL) {
+        mem_free(tsp, path);
+        return no_memory(tsp);
+    }
+
+    //Get simple list of city ids into our working path, and solve:
+    max_id = get_list_of_cities(tsp, path);
+    result = solve_path(tsp, path, max_id);
+
+    if(tsp->verbose && tsp->stop_signal)
+        printf("Received signal %d: stopping...\n", (int)tsp->stop_signal);
+
+    //Free memory allocated for distances matrix and spatial index
+    //(everything the tours are given back with is kept until tsp_free):
+    free_distances(tsp);
+    kd_free(tsp);
+    mem_free(tsp, path);
+
+    //(A solve that ran out of memory part way has no tour to speak of):
+    if(result < 0 || tsp->out_of_memory)
+        return -1;
+    return tsp->best_distance;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Changes the instance after tsp_solve by removing and adding a few cities, and repairs the best tour
+ * around the changes instead of solving again: the cities removed are cut out of it, those added are put in
+ * where they lengthen it least (see update_insert), and lin_kernighan's moves are made starting from only
+ * the cities next to the changes.  A city added with the id of one in the instance moves it.  May be called
+ * any number of times (the time limit still counts from tsp_create)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   const int * cities -  The cities to add, as the id, x and y coordinates of each
+ * Param:   int num_add -  The number of cities to add
+ * Param:   const int * ids -  The ids of the cities to remove (any not in the instance are ignored)
+ * Param:   int num_remove -  The number of ids
+ * Return:  int -  The distance of the repaired tour, or -1 if there is no tour to repair, a city is added twice
+ *                 (leaving the tour as it was), no cities are left or it is out of memory (the solver then has no tour)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_update(tsp_solver * tsp, const int * cities, int num_add, const int * ids, int num_remove) {
+    int i, n, len, dst, first, ok;
+    int * path, * list, * drop;
+    char * bridged;
+    void * grown;
+
+    if(tsp->best_distance < 0)
+        return -1;
+    if(tsp->verbose)
+        printf("Updating the tour: removing %d cities and adding %d...\n", num_remove, num_add);
+
+    //(Running out of memory in an earlier update left either no tour or a whole one):
+    tsp->out_of_memory = 0;
+
+    //Everything indexed by city is renumbered, and the neighbor lists found again:
+    free_neighbors(tsp);
+    mem_free(tsp, tsp->cell_of);
+    tsp->cell_of = NULL;
+
+    //The ids to cut out, sorted (a city added replaces any with its id):
+    n = tsp->num_cities;
+    drop = mem_alloc(tsp, (num_remove + num_add + 1) * sizeof(int));
+    path = mem_alloc(tsp, (n + num_add + 1) * sizeof(int));
+    bridged = mem_calloc(tsp, n + 1, sizeof(char));
+    if(drop == NULL || path == NULL || bridged == NULL || uncache_cities(tsp) < 0) {
+        mem_free(tsp, drop);
+        mem_free(tsp, path);
+        mem_free(tsp, bridged);
+        return no_memory(tsp);
+    }
+    for(i=0; i<num_remove; i++) {
+        drop[i] = ids[i];
+    }
+    for(i=0; i<num_add; i++) {
+        drop[num_remove+i] = cities[3*i];
+    }
+    qsort(drop + num_remove, num_add, sizeof(int), compare_ints);
+    for(i=1; i<num_add; i++) {
+        if(drop[num_remove+i] == drop[num_remove+i-1]) {
+            fprintf(stderr, "Error: city id %d is added more than once\n", drop[num_remove+i]);
+            mem_free(tsp, drop);
+            mem_free(tsp, path);
+            mem_free(tsp, bridged);
+            return -1;
         }
     }
+    qsort(drop, num_remove + num_add, sizeof(int), compare_ints);
+
+    //Change the instance (with no tour to be seen in the meantime), and make room for the new tour:
+    pthread_mutex_lock(&tsp->best_lock);
+    dst = tsp->best_distance;
+    tsp->best_distance = -1;
+    len = update_cut(tsp, path, bridged, drop, num_remove + num_add, &dst);
+    first = tsp->num_cities;
+    ok = len >= 0;
+    for(i=0; i<num_add && ok; i++) {
+        ok = add_city(tsp, cities[3*i], cities[3*i+1], cities[3*i+2]) == 0;
+    }
+    if(ok && (grown = mem_realloc(tsp, tsp->best_path, n * sizeof(int), (tsp->num_cities+1) * sizeof(int))) != NULL)
+        tsp->best_path = grown;
+    else
+        ok = 0;
+    if(ok && (grown = mem_realloc(tsp, tsp->out_buf, (n+1) * 12L, (tsp->num_cities+1) * 12L)) != NULL)
+        tsp->out_buf = grown;
+    else
+        ok = 0;
+    pthread_mutex_unlock(&tsp->best_lock);
+    list = mem_alloc(tsp, (tsp->num_cities+1) * sizeof(int));
+    if(!ok || list == NULL || tsp->num_cities < 1) {
+        if(!ok || list == NULL)
+            no_memory(tsp);
+        mem_free(tsp, list);
+        mem_free(tsp, drop);
+        mem_free(tsp, path);
+        mem_free(tsp, bridged);
+        return -1;
+    }
 
-    //Print solution:
-    print_solution();
-    
-    //Free memory allocated for distances matrix:
-    free_distances();
+    ok = update_repair(tsp, list, path, bridged, len, first, dst) == 0;
+    free_neighbors(tsp);
+    kd_free(tsp);
+
+    mem_free(tsp, list);
+    mem_free(tsp, drop);
+    mem_free(tsp, path);
+    mem_free(tsp, bridged);
+    if(!ok || tsp->out_of_memory)
+        return -1;
+    return tsp->best_distance;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the number of cities in the instance
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  The number of cities
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_num_cities(tsp_solver * tsp) {
+    return tsp->num_cities;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the best tour found thus far (which may be called from another thread during tsp_solve)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * ids -  Location to store the tour, as the cities' ids (room for tsp_num_cities of them)
+ * Return:  int -  The distance of the tour, or -1 if there is no tour yet (ids is left as it was)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_get_tour(tsp_solver * tsp, int * ids) {
+    int i, distance;
+
+    pthread_mutex_lock(&tsp->best_lock);
+    distance = tsp->best_distance;
+    for(i=0; i<tsp->num_cities && distance >= 0; i++) {
+        ids[i] = tsp->city_ids[tsp->best_path[i]];
+    }
+    pthread_mutex_unlock(&tsp->best_lock);
+    return distance;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes the best tour found to the output file (or stdout), as print_solution
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  0, or -1 if there is no tour yet or it could not be written
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_write_tour(tsp_solver * tsp) {
+    int result;
+
+    if(tsp->best_distance < 0)
+        return -1;
+
+    set_phase(tsp, PHASE_OUTPUT);
+    pthread_mutex_lock(&tsp->best_lock);
+    result = print_solution(tsp);
+    pthread_mutex_unlock(&tsp->best_lock);
+    return result;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes the best tour found to a file descriptor (e.g. a socket) instead, in the same format
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int fd -  The file descriptor
+ * Return:  int -  0, or -1 if there is no tour yet or it could not be written
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_write_tour_fd(tsp_solver * tsp, int fd) {
+    long len;
+    int result;
+
+    if(tsp->best_distance < 0)
+        return -1;
+
+    pthread_mutex_lock(&tsp->best_lock);
+    if(tsp->binary_output)
+        len = format_tour_binary(tsp, tsp->out_buf, tsp->best_distance, tsp->best_path, tsp->num_cities);
+    else
+        len = format_tour(tsp, tsp->out_buf, tsp->best_distance, tsp->best_path, tsp->num_cities);
+    result = write_all(fd, tsp->out_buf, len);
+    pthread_mutex_unlock(&tsp->best_lock);
+    return result;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes the statistics to the statistics file, as write_stats
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  0, or -1 if there is no statistics file
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int tsp_write_stats(tsp_solver * tsp) {
+    if(!tsp->use_stats)
+        return -1;
+    write_stats(tsp);
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Asks the solver to stop: the algorithms check for it (with should_stop) and return,
+ * leaving the best tour found.  Only records the request, so it is safe in a signal handler
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int sig -  The signal asking for the stop (or any other non-zero number)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void tsp_stop(tsp_solver * tsp, int sig) {
+    tsp->stop_signal = sig;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Asks the solver to write its statistics: should_stop writes them the next time an
+ * algorithm calls it.  Only records the request, so it is safe in a signal handler
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void tsp_request_stats(tsp_solver * tsp) {
+    tsp->stats_signal = 1;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Sets up the tables shared by every solver (once, with pthread_once)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void init_tables(void) {
+    init_exp_table();
+    init_scan();
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The steps of tsp_solve between setting up the paths and freeing what the algorithms used:
+ * the distances, the spatial index, the first tour and the algorithm chosen to improve it
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The list of cities.  At completion, contains the best path found
+ * Param:   int max_id -  The largest city id
+ * Return:  int -  0, or -1 if the tour to start from can't be used (or out of memory)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int solve_path(tsp_solver * tsp, int * path, int max_id) {
+    //Get matrix of distances between cities (unless it was cached, there are too many
+    //cities to store it, or the first tour is used alone and not cached, which gains nothing from it):
+    set_phase(tsp, PHASE_DISTANCES);
+    if(tsp->distances_cached) {
+        if(tsp->verbose)
+            printf("Using cached distances...\n");
+    }
+    else if(tsp->algorithm == TSP_NONE && !(tsp->use_cache && tsp->in_file && !tsp->cache_map)) {
+        if(tsp->verbose)
+            printf("Only building a tour, calculating distances on the fly...\n");
+    }
+    else if(tsp->num_cities > tsp->matrix_max_cities) {
+        if(tsp->verbose)
+            printf("Too many cities for a distance matrix, calculating distances on the fly...\n");
+        if(!tsp->cache_map)
+            calc_avg_distance(tsp, path, tsp->num_cities, max_id);
+    }
+    else {
+        if(tsp->verbose)
+            printf("Calculating distances...\n");
+        if(calc_distances(tsp, max_id) < 0)
+            return -1;
+    }
+
+    //Build the spatial index used for proximity queries:
+    if(tsp->verbose)
+        printf("Building spatial index...\n");
+    if(kd_build(tsp, path, tsp->num_cities, max_id) < 0)
+        return -1;
+
+    //Cache the input, neighbor lists and distances for next time:
+    if(tsp->use_cache && tsp->in_file && !tsp->cache_map) {
+        if(tsp->verbose)
+            printf("Writing cache %s...\n", tsp->cache_filename);
+        if(calc_neighbors(tsp, path, tsp->num_cities, max_id) < 0)
+            return -1;
+        write_cache(tsp);
+    }
+
+    //Start from the given tour, or call nearest_neighbor algorithm to get a good first approximation:
+    set_phase(tsp, PHASE_CONSTRUCTION);
+    if(tsp->start_ids) {
+        if(start_tour(tsp, path) < 0)
+            return -1;
+        if(tsp->verbose)
+            printf("Starting from the given tour...\n");
+        set_best(tsp, calc_path_dist(tsp, path, tsp->num_cities), path);
+    }
+    else if(tsp->num_cells > 0) {
+        if(tsp->verbose)
+            printf("Solving %d cells with %d workers...\n", tsp->num_cells, tsp->num_workers);
+        partition_tour(tsp, path, tsp->num_cities);
+    }
+    else if(tsp->use_hilbert) {
+        if(tsp->verbose)
+            printf("Building a tour along the Hilbert curve...\n");
+        hilbert_tour(tsp, path, tsp->num_cities);
+    }
+    else {
+        if(tsp->verbose)
+            printf("Calling nearest neighbor algorithm...\n");
+        nearest_neighbor(tsp, path, tsp->num_cities);
+    }
+    stats_trace(tsp, tsp->best_distance);
+    if(tsp->out_of_memory)
+        return -1;
 
-    return EXIT_SUCCESS;
+    //Unless the first tour is being used alone (or the solver has been stopped),
+    //call another algorithm to improve the answer:
+    set_phase(tsp, PHASE_IMPROVEMENT);
+    if(tsp->algorithm != TSP_NONE && !tsp->stop_signal && tsp->num_cities > 1) {
+
+        //With a partition, the cells are already improved, leaving the seams between them:
+        if(tsp->num_cells > 0) {
+            if(tsp->verbose)
+                printf("Repairing the tour around the cell boundaries...\n");
+            partition_repair(tsp, path, tsp->num_cities, max_id);
+        }
+        else
+            improve(tsp, path, tsp->num_cities, max_id);
+    }
+    return 0;
 }
 
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Improves a path with the algorithm chosen (tsp_options.algorithm)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The path to improve
+ * Param:   int len -  The length of the path
+ * Param:   int max_id -  The largest city id
+ * Return:  void -  The improved path is left at the location specified by the path pointer
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void improve(tsp_solver * tsp, int * path, int len, int max_id) {
+    //Simulated Anneal:
+    if(tsp->algorithm == TSP_ANNEAL) {
+        if(tsp->verbose)
+            printf("Calling anneal...\n");
+        anneal(tsp, path, len);
+    }
+
+    //Parallel tempering:
+    else if(tsp->algorithm == TSP_PARALLEL_TEMPERING) {
+        if(tsp->verbose)
+            printf("Calling parallel tempering with %d threads...\n", tsp->num_threads);
+        parallel_tempering(tsp, path, len);
+    }
+
+    //Iterated local search:
+    else if(tsp->algorithm == TSP_ITERATED_LOCAL_SEARCH) {
+        if(tsp->verbose)
+            printf("Calculating neighbor lists...\n");
+        if(init_neighbors(tsp, path, len, max_id) < 0)
+            return;
+        if(tsp->verbose)
+            printf("Calling iterated local search...\n");
+        iterated_local_search(tsp, path, len);
+        free_neighbors(tsp);
+    }
+
+    //Lin-Kernighan style:
+    else if(tsp->algorithm == TSP_LIN_KERNIGHAN) {
+        if(tsp->verbose)
+            printf("Calculating neighbor lists...\n");
+        if(init_neighbors(tsp, path, len, max_id) < 0)
+            return;
+        if(tsp->verbose)
+            printf("Calling lin-kernighan...\n");
+        lin_kernighan(tsp, path, len);
+        free_neighbors(tsp);
+    }
+
+    //Two-opt with neighbor lists:
+    else if(tsp->algorithm == TSP_TWO_OPT_NEIGHBORS) {
+        if(tsp->verbose)
+            printf("Calculating neighbor lists...\n");
+        if(init_neighbors(tsp, path, len, max_id) < 0)
+            return;
+        if(tsp->verbose)
+            printf("Calling two-opt with neighbor lists...\n");
+        two_opt_neighbors(tsp, path, len);
+        free_neighbors(tsp);
+    }
+
+    //Two-opt:
+    else if(tsp->algorithm == TSP_TWO_OPT) {
+        if(tsp->verbose)
+            printf("Calling two-opt...\n");
+        two_opt(tsp, path, len);
+    }
+
+    //Default: Hybrid algorithm 
+    else {
+        if(tsp->verbose)
+            printf("Calling hybrid algorithm...\n");
+        hybrid(tsp, path, len);
+    }
+}
+
 
 //NEAREST NEIGHBOR ALGORITHM:
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Creates a path by progressively selecting the nearest neighbor to the last city added to the path
+ * Creates a path by progressively selecting the nearest neighbor to the last city added to the path.
+ * Visited cities are removed from the k-d tree, so each step is a single nearest-unvisited query
+ * Param:   tsp_solver * tsp -  The solver
  * Param:   int * path -  Contains the list of cities to build the path from.  At completion, contains the newly created path
  * Param:   int len -  The length of the path (the number of cities)
  * Return:  void
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void nearest_neighbor(int * path, int len) {
+static void nearest_neighbor(tsp_solver * tsp, int * path, int len) {
     int i, dst;
 
     dst = 0;
+    kd_remove(tsp, path[0]);
     for(i=0; i<len-1; i++) {
-        dst += swap_closest(&path[i], (len-i));
+        kd_nearest(tsp, path[i], 1, &path[i+1]);
+        kd_remove(tsp, path[i+1]);
+        dst += get_distance(tsp, path[i], path[i+1]);
     }
+    kd_restore(tsp);
 
-    dst += get_distance(path[len-1], path[0]);
-    set_best(dst, path);
+    dst += get_distance(tsp, path[len-1], path[0]);
+    set_best(tsp, dst, path);
 }
 
+
+//HILBERT CURVE ALGORITHM:
+
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Swaps into the second position in the list the city that is closest to the city in the first position in the list
- * Param:   int * remaining -  Pointer to a (section of) a list of cities
- * Param:   int num_remaining -  The number of cities remaining before the end of the list
- * Return:  int -  The distance from the city in the first position in the list to the city in the second position in the list
+ * Creates a path that visits the cities in the order of a Hilbert curve through the plane.
+ * hilbert_renumber has already numbered the cities in that order, so this only lists them
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  Location to store the path
+ * Param:   int len -  The length of the path (the number of cities)
+ * Return:  void
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-int swap_closest(int * remaining, int num_remaining) {
-    int i, cur, best;
-    
-    cur = remaining[0];
-    best = 1;
+static void hilbert_tour(tsp_solver * tsp, int * path, int len) {
+    int i;
+
+    for(i=0; i<len; i++) {
+        path[i] = i;
+    }
+    set_best(tsp, calc_path_dist(tsp, path, len), path);
+}
+
 
-    for(i=2; i<num_remaining; i++) {
-        if(get_distance(cur, remaining[i]) < get_distance(cur, remaining[best])) {
-            best = i;
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Renumbers the cities in the order of a Hilbert curve through the plane (sorting them by their
+ * position along it), so that cities close together in the plane are mostly close together in
+ * city_x, city_y and everything else indexed by city, and the local searches stay in cache
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  0, or -1 if out of memory (the cities are left as they were)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int hilbert_renumber(tsp_solver * tsp) {
+    int i, min_x, max_x, min_y, max_y;
+    int * ids, * x, * y;
+    double scale;
+    curve_point * points;
+
+    if(tsp->num_cities < 2)
+        return 0;
+
+    //Scale the coordinates (keeping their proportions) to the curve's grid:
+    min_x = max_x = tsp->city_x[0];
+    min_y = max_y = tsp->city_y[0];
+    for(i=1; i<tsp->num_cities; i++) {
+        if(tsp->city_x[i] < min_x) min_x = tsp->city_x[i];
+        if(tsp->city_x[i] > max_x) max_x = tsp->city_x[i];
+        if(tsp->city_y[i] < min_y) min_y = tsp->city_y[i];
+        if(tsp->city_y[i] > max_y) max_y = tsp->city_y[i];
+    }
+    scale = get_max((double)max_x - min_x, (double)max_y - min_y);
+    scale = scale > 0 ? ((1 << HILBERT_BITS) - 1) / scale : 0;
+
+    points = mem_alloc(tsp, tsp->num_cities * sizeof(curve_point));
+    if(points == NULL)
+        return no_memory(tsp);
+    for(i=0; i<tsp->num_cities; i++) {
+        points[i].key = hilbert_key((uint32_t)((tsp->city_x[i] - (double)min_x) * scale),
+                                    (uint32_t)((tsp->city_y[i] - (double)min_y) * scale));
+        points[i].index = i;
+    }
+    qsort(points, tsp->num_cities, sizeof(curve_point), compare_curve_points);
+
+    ids = mem_alloc(tsp, tsp->num_cities * sizeof(int));
+    x = mem_alloc(tsp, tsp->num_cities * sizeof(int));
+    y = mem_alloc(tsp, tsp->num_cities * sizeof(int));
+    if(ids == NULL || x == NULL || y == NULL) {
+        mem_free(tsp, y);
+        mem_free(tsp, x);
+        mem_free(tsp, ids);
+        mem_free(tsp, points);
+        return no_memory(tsp);
+    }
+    for(i=0; i<tsp->num_cities; i++) {
+        ids[i] = tsp->city_ids[points[i].index];
+        x[i] = tsp->city_x[points[i].index];
+        y[i] = tsp->city_y[points[i].index];
+    }
+    mem_free(tsp, tsp->city_ids);
+    mem_free(tsp, tsp->city_x);
+    mem_free(tsp, tsp->city_y);
+    tsp->city_ids = ids;
+    tsp->city_x = x;
+    tsp->city_y = y;
+    tsp->cities_size = tsp->num_cities;
+    mem_free(tsp, points);
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Returns the position of a cell of the grid along the Hilbert curve through it
+ * Param:   uint32_t x -  The cell's column (less than 2^HILBERT_BITS)
+ * Param:   uint32_t y -  The cell's row (less than 2^HILBERT_BITS)
+ * Return:  uint64_t -  The number of cells before it along the curve
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static uint64_t hilbert_key(uint32_t x, uint32_t y) {
+    uint32_t s, rx, ry, t, n;
+    uint64_t key;
+
+    n = 1u << HILBERT_BITS;
+    key = 0;
+    for(s=n/2; s>0; s/=2) {
+        rx = (x & s) > 0;
+        ry = (y & s) > 0;
+        key += (uint64_t)s * s * ((3 * rx) ^ ry);
+
+        //Rotate the quadrant so that the curve through it starts and ends in the right corners:
+        if(ry == 0) {
+            if(rx == 1) {
+                x = n-1 - x;
+                y = n-1 - y;
+            }
+            t = x;
+            x = y;
+            y = t;
         }
     }
+    return key;
+}
 
-    swap(1, best, remaining);
-    return get_distance(cur, remaining[1]);
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Compares two cities by their position along the Hilbert curve (then by their index), for qsort
+ * Param:   const void * a -  The first city's curve_point
+ * Param:   const void * b -  The second city's curve_point
+ * Return:  int -  Negative, zero or positive as a comes before, with or after b
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int compare_curve_points(const void * a, const void * b) {
+    const curve_point * p = a;
+    const curve_point * q = b;
+
+    if(p->key != q->key)
+        return p->key < q->key ? -1 : 1;
+    return (p->index > q->index) - (p->index < q->index);
 }
 
 
@@ -226,27 +1423,66 @@ int swap_closest(int * remaining, int num_remaining) {
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Iteratively improves on a given path by swapping 2 edges at a time in order to create a shorter path
+ * Param:   tsp_solver * tsp -  The solver
  * Param:   int * path -  The path to improve upon
  * Param:   int len -  The length of the path
  * Return:  void -  The improved path is left at the location specified by the path pointer
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void two_opt(int * path, int len) {
-    int i, j, dist;
+static void two_opt(tsp_solver * tsp, int * path, int len) {
+    int a, c, head, dst, dist, checks, stopped;
+    double limit = 0;
+
+    dst = calc_path_dist(tsp, path, len);
+    if(tour_init(tsp, path, len) < 0)
+        return;
+    head = tsp->tour_head;
+    checks = 0;
+    stopped = 0;
+
+    //For every pair of positions i<=j after the head, with cities a and c:
+    for(a=tour_next(tsp, head); a!=head && !stopped; a=tour_next(tsp, a)) {
+        for(c=a; c!=head; c=tour_next(tsp, c)) {
+
+            //Skip ahead to the next swap that could be shorter:
+            checks += two_opt_scan(tsp, a, &c, head, limit) + 1;
+            if(c == head)
+                break;
 
-    for(i=1; i<len; i++) {
-        for(j=i; j<len; j++) {
-            dist = two_opt_dist(best_distance, i, j, path, len);
-            if(dist < best_distance) {
-                if(debug) {
+            //(Moves tried are counted here, in bulk, to keep the inner loop tight):
+            if(checks >= TIME_CHECK_INTERVAL) {
+                tsp->stats.evaluated += checks;
+                checks = 0;
+                if(should_stop(tsp)) {
+                    stopped = 1;
+                    break;
+                }
+                if(checkpoint_due(tsp)) {
+                    tour_get_path(tsp, path);
+                    set_best(tsp, dst, path);
+                    write_checkpoint(tsp);
+                }
+            }
+            dist = two_opt_flip_dist(tsp, dst, a, c);
+            if(dist < dst) {
+                if(tsp->debug) {
                     printf("Two-opt found new path with distance: %d\n", dist);
                 }
-                two_opt_swap(i, j, path);
-                set_best(dist, path);
-                i=1;
+                tour_flip(tsp, a, c);
+                dst = dist;
+                tsp->stats.accepted++;
+                stats_improved(tsp, dst);
+                a=tour_next(tsp, head);
                 break;
             }
         }
     }
+
+    tsp->stats.evaluated += checks;
+
+    //Only improving swaps are made, so the final path is the best one:
+    tour_get_path(tsp, path);
+    set_best(tsp, dst, path);
+    tour_free(tsp);
 }
 
 
@@ -257,7 +1493,7 @@ void two_opt(int * path, int len) {
  * Param:   int * path -  The path to perform the swap on
  * Return:  void -  The swapped path is left in the location specified by the path pointer
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void two_opt_swap(int i, int j, int * path) {
+static void two_opt_swap(int i, int j, int * path) {
     while (i < j) {
         swap(i++, j--, path);
     }
@@ -266,6 +1502,7 @@ void two_opt_swap(int i, int j, int * path) {
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Returns the distance of the path that would result from the associated 2-opt swap without actually performing the swap
+ * Param:   tsp_solver * tsp -  The solver
  * Param:   int old_dist -  The distance of the path being changed
  * Param:   int i -  The first index of the section to reverse
  * Param:   int j -  The last index of the section to reverse
@@ -273,404 +1510,3978 @@ void two_opt_swap(int i, int j, int * path) {
  * Param:   int len -  The length of the path
  * Return:  int -  The length of the path that would result from the associated 2-opt swap
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-int two_opt_dist(int old_dist, int i, int j, int * path, int len) {
+static int two_opt_dist(tsp_solver * tsp, int old_dist, int i, int j, int * path, int len) {
     int new_dist;
     
     if(j == len-1) {
-        new_dist = old_dist - (get_distance(path[i-1], path[i]) + get_distance(path[j], path[0]));
-        new_dist += get_distance(path[i-1], path[j]) + get_distance(path[i], path[0]);
+        new_dist = old_dist - (get_distance(tsp, path[i-1], path[i]) + get_distance(tsp, path[j], path[0]));
+        new_dist += get_distance(tsp, path[i-1], path[j]) + get_distance(tsp, path[i], path[0]);
     }
     else {
-        new_dist = old_dist - (get_distance(path[i-1], path[i]) + get_distance(path[j], path[j+1]));
-        new_dist += get_distance(path[i-1], path[j]) + get_distance(path[i], path[j+1]);
+        new_dist = old_dist - (get_distance(tsp, path[i-1], path[i]) + get_distance(tsp, path[j], path[j+1]));
+        new_dist += get_distance(tsp, path[i-1], path[j]) + get_distance(tsp, path[i], path[j+1]);
     }
 
     return new_dist;
 }
 
 
-//SIMULATED ANNEAL ALGORITHM:
-
-
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Version of the simulated anneal algorithm
- * Param:   int * path -  The path to perform simulated anneal on
- * Param:   int len -  The length of the path
- * Return:  void -  The resulting path is left in the location specified by the path pointer
+ * Returns the distance of the tour that would result from reversing the section from city a to city c,
+ * without actually performing the reversal (two_opt_dist for the tour operations)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int old_dist -  The distance of the tour being changed
+ * Param:   int a -  The id of the first city of the section to reverse
+ * Param:   int c -  The id of the last city of the section to reverse
+ * Return:  int -  The length of the tour that would result from the reversal
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void anneal(int * path, int len) {
-    int i, j, dst, swp_dst, attempt;
-    double temp;
+static int two_opt_flip_dist(tsp_solver * tsp, int old_dist, int a, int c) {
+    int p, n, new_dist;
 
-    //Seed random number generator:
-    srand(time(NULL));
+    p = tour_prev(tsp, a);
+    n = tour_next(tsp, c);
+    new_dist = old_dist - (get_distance(tsp, p, a) + get_distance(tsp, c, n));
+    new_dist += get_distance(tsp, p, c) + get_distance(tsp, a, n);
 
-    //Get the current path's distance:
-    dst = calc_path_dist(path, len);
+    return new_dist;
+}
 
-    temp = START_TEMP;
-    attempt = 0;
-    while(attempt < SATISFIED) {
 
-        //Try a random 2-opt swap:
-        i = (rand() % (len-1)) + 1;
-        j = i + (rand() % (len-i));
-        swp_dst = two_opt_dist(dst, i, j, path, len);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Skips over the 2-opt swaps not worth trying with two_opt_flip_dist, for two_opt and hybrid:
+ * with a the first city of the section to reverse, checks the sections ending at c and up to
+ * SCAN_BLOCK-1 cities after it (stopping before head) a block at a time, with scan_kernel.
+ * A swap is worth trying if it makes the tour shorter, or longer by less than limit
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The id of the first city of the section to reverse
+ * Param:   int * c -  The id of the last city of the first section to check.  Moved on to the first swap
+ *                     worth trying, or to the city after the block (possibly head) if there is none
+ * Param:   int head -  The head of the tour
+ * Param:   double limit -  Longer tours are worth trying if longer by less than this (0 for none)
+ * Return:  int -  The number of swaps skipped
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int two_opt_scan(tsp_solver * tsp, int a, int * c, int head, double limit) {
+    int i, k, m, x;
+    int * cs;
+    int block[SCAN_BLOCK+1];
+
+    //The block is the cities c_0 (c) to c_m-1, followed by the city after them:
+    if(!tsp->two_level) {
+        //(In an array, the cities are already in order, up to the last one, whose next is the head):
+        i = tsp->position[*c];
+        m = tsp->tour_len-1 - i;
+        if(m > SCAN_BLOCK)
+            m = SCAN_BLOCK;
+        cs = tsp->tour_path + i;
+    }
+    else {
+        x = *c;
+        for(m=0; m<SCAN_BLOCK && x!=head; m++) {
+            block[m] = x;
+            x = tour_next(tsp, x);
+        }
+        block[m] = x;
+        cs = block;
+    }
 
-        //If the result is acceptable:
-        if(anneal_accept(swp_dst, dst, temp)) {
-            if(debug) {
-                printf("Anneal: temp: %f, old path: %d, new path : %d", temp, dst, swp_dst);
-                if(swp_dst > dst) 
-                    printf("\t < escape local optimum");
-                printf("\n");
-            }
+    k = scan_kernel(tsp, tour_prev(tsp, a), a, cs, m, limit);
+    *c = cs[k];
+    return k;
+}
 
-            //Update the path and it's distance:
-            two_opt_swap(i, j, path);
-            dst = swp_dst;
 
-            //Update the global best dst/path, if necessary:
-            if(dst < best_distance)
-                set_best(dst, path);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Finds the first of a block of 2-opt swaps worth trying (see two_opt_scan): reversing the section
+ * from a to cs[k], replacing edges (p, a) and (cs[k], cs[k+1]) with (p, cs[k]) and (a, cs[k+1])
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int p -  The id of the city before a
+ * Param:   int a -  The id of the first city of the sections
+ * Param:   int * cs -  The ids of the last cities of the sections, followed by the city after the last one
+ * Param:   int m -  The number of sections
+ * Param:   double limit -  Longer tours are worth trying if longer by less than this
+ * Return:  int -  The index in cs of the first swap worth trying, or m if there is none
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int scan_block(tsp_solver * tsp, int p, int a, int * cs, int m, double limit) {
+    int k, d_pa, delta;
+
+    d_pa = get_distance(tsp, p, a);
+    for(k=0; k<m; k++) {
+        delta = get_distance(tsp, p, cs[k]) + get_distance(tsp, a, cs[k+1]) - d_pa - get_distance(tsp, cs[k], cs[k+1]);
+        if(delta < 0 || (delta > 0 && delta < limit))
+            return k;
+    }
+    return m;
+}
 
-            //Reset attempt counter:
-            attempt = 0;
-        }
 
-        //If the result is unacceptable:
-        else
-            attempt++;
-            if(debug)
-                printf("Decline #%d\n", attempt);
+#ifdef HAVE_AVX2_SCAN
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * scan_block for processors with AVX2: four swaps at a time, calculating the distances from the
+ * coordinates in double precision exactly as calc_distance does (without fused multiply-adds, so
+ * that the rounding is the same), so the same swaps are found
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int p -  The id of the city before a
+ * Param:   int a -  The id of the first city of the sections
+ * Param:   int * cs -  The ids of the last cities of the sections, followed by the city after the last one
+ * Param:   int m -  The number of sections
+ * Param:   double limit -  Longer tours are worth trying if longer by less than this
+ * Return:  int -  The index in cs of the first swap worth trying, or m if there is none
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+__attribute__((target("avx2")))
+static int scan_block_avx2(tsp_solver * tsp, int p, int a, int * cs, int m, double limit) {
+    int k, mask;
+    __m128i ic, in;
+    __m256d px, py, ax, ay, cx, cy, nx, ny, d_pa, delta, zero, lim, worth;
+
+    px = _mm256_set1_pd(tsp->city_x[p]);
+    py = _mm256_set1_pd(tsp->city_y[p]);
+    ax = _mm256_set1_pd(tsp->city_x[a]);
+    ay = _mm256_set1_pd(tsp->city_y[a]);
+    d_pa = _mm256_set1_pd(get_distance(tsp, p, a));
+    zero = _mm256_setzero_pd();
+    lim = _mm256_set1_pd(limit);
+
+    for(k=0; k+4<=m; k+=4) {
+        ic = _mm_loadu_si128((__m128i *)(cs + k));
+        in = _mm_loadu_si128((__m128i *)(cs + k + 1));
+        cx = _mm256_cvtepi32_pd(_mm_i32gather_epi32(tsp->city_x, ic, 4));
+        cy = _mm256_cvtepi32_pd(_mm_i32gather_epi32(tsp->city_y, ic, 4));
+        nx = _mm256_cvtepi32_pd(_mm_i32gather_epi32(tsp->city_x, in, 4));
+        ny = _mm256_cvtepi32_pd(_mm_i32gather_epi32(tsp->city_y, in, 4));
+
+        delta = _mm256_add_pd(distance_avx2(px, py, cx, cy), distance_avx2(ax, ay, nx, ny));
+        delta = _mm256_sub_pd(delta, _mm256_add_pd(d_pa, distance_avx2(cx, cy, nx, ny)));
+
+        worth = _mm256_or_pd(_mm256_cmp_pd(delta, zero, _CMP_LT_OQ),
+                             _mm256_and_pd(_mm256_cmp_pd(delta, zero, _CMP_GT_OQ), _mm256_cmp_pd(delta, lim, _CMP_LT_OQ)));
+        mask = _mm256_movemask_pd(worth);
+        if(mask)
+            return k + __builtin_ctz(mask);
+    }
 
-        //Decrease the temperature:
-        temp = change_temp(temp);
+    //The last few one at a time:
+    return k + scan_block(tsp, p, a, cs + k, m - k, limit);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Calculates four distances at once, rounded as calc_distance does
+ * Param:   __m256d x1 -  The x coordinates of the first cities
+ * Param:   __m256d y1 -  The y coordinates of the first cities
+ * Param:   __m256d x2 -  The x coordinates of the second cities
+ * Param:   __m256d y2 -  The y coordinates of the second cities
+ * Return:  __m256d -  The distances (whole numbers)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+__attribute__((target("avx2")))
+static __m256d distance_avx2(__m256d x1, __m256d y1, __m256d x2, __m256d y2) {
+    __m256d dx, dy;
+
+    dx = _mm256_sub_pd(x1, x2);
+    dy = _mm256_sub_pd(y1, y2);
+    dx = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)));
+    return _mm256_floor_pd(_mm256_add_pd(dx, _mm256_set1_pd(0.5)));
+}
+#endif
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Chooses the fastest version of scan_block that the processor supports
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void init_scan(void) {
+    scan_kernel = scan_block;
+#ifdef HAVE_AVX2_SCAN
+    if(__builtin_cpu_supports("avx2"))
+        scan_kernel = scan_block_avx2;
+#endif
+}
+
+
+//2-OPT WITH NEIGHBOR LISTS ALGORITHM:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Improves a path with 2-opt swaps, considering only swaps that join a city to one of its nearest neighbors.
+ * Cities are examined from a queue; a city leaves the queue (its don't-look bit is set) when no improving
+ * swap is found for it, and re-enters it when one of its edges changes
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The path to improve upon
+ * Param:   int len -  The length of the path
+ * Return:  void -  The improved path is left at the location specified by the path pointer
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void two_opt_neighbors(tsp_solver * tsp, int * path, int len) {
+    int i, a, dst, checks;
+
+    if(len < 4)
+        return;
+
+    //Every city starts out in the queue:
+    if(tour_init(tsp, path, len) < 0)
+        return;
+    for(i=0; i<len; i++) {
+        queue_push(tsp, path[i]);
     }
+
+    dst = calc_path_dist(tsp, path, len);
+    checks = 0;
+    while(tsp->queue_len > 0) {
+        if((++checks & (TIME_CHECK_INTERVAL-1)) == 0) {
+            if(should_stop(tsp))
+                break;
+            if(checkpoint_due(tsp)) {
+                tour_get_path(tsp, path);
+                set_best(tsp, dst, path);
+                write_checkpoint(tsp);
+            }
+        }
+        a = queue_pop(tsp);
+        if(two_opt_neighbor_move(tsp, a, &dst)) {
+            if(tsp->debug) {
+                printf("Two-opt (neighbor lists) found new path with distance: %d\n", dst);
+            }
+            stats_improved(tsp, dst);
+        }
+    }
+
+    //Only improving moves are made, so the final path is the best one:
+    tour_get_path(tsp, path);
+    set_best(tsp, dst, path);
+    tour_free(tsp);
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Accepts or rejects a proposed change from a path with old_dst to a path with new_dst, given temperature
- * Param:   int new_dst -  The distance of the new path
- * Param:   int old_dst -  The distance of the old path
- * Param:   double temp -  The temperature
- * Return:  int -  1 if the move is accepted, 0 if not
+ * Looks for an improving 2-opt swap that joins city a to one of its nearest neighbors, and performs the first one found
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The id of the city to examine
+ * Param:   int * dst -  The distance of the tour.  Updated if a swap is made
+ * Return:  int -  1 if a swap was made, 0 if not
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-int anneal_accept(int new_dst, int old_dst, double temp) {
-    double prob, q;
+static int two_opt_neighbor_move(tsp_solver * tsp, int a, int * dst) {
+    int k, dir, b, c, d, d_ab, gain;
 
-    if(new_dst == old_dst)
-        return 0;
+    //Try both the edge to a's successor and the edge to a's predecessor:
+    for(dir=0; dir<2; dir++) {
+        b = dir ? tour_prev(tsp, a) : tour_next(tsp, a);
+        d_ab = get_distance(tsp, a, b);
 
-    prob = exp((old_dst - new_dst)/temp);
-    q = rand() / (double) RAND_MAX;
+        for(k=0; k<NUM_NEIGHBORS && k<tsp->tour_len-1; k++) {
+            c = tsp->neighbors[a*NUM_NEIGHBORS + k];
 
-    if(q < prob)
-        return 1;
-    else
+            //Neighbors are sorted, so no later neighbor can give a shorter new edge:
+            if(get_distance(tsp, a, c) >= d_ab)
+                break;
+
+            //The swap removes edges (a, b) and (c, d) and adds (a, c) and (b, d):
+            d = dir ? tour_prev(tsp, c) : tour_next(tsp, c);
+            if(c == b || d == a)
+                continue;
+            gain = d_ab + get_distance(tsp, c, d) - get_distance(tsp, a, c) - get_distance(tsp, b, d);
+            tsp->stats.evaluated++;
+            if(gain <= 0)
+                continue;
+
+            tour_move(tsp, a, b, c, d);
+            *dst -= gain;
+            tsp->stats.accepted++;
+
+            queue_push(tsp, a);
+            queue_push(tsp, b);
+            queue_push(tsp, c);
+            queue_push(tsp, d);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Allocates the neighbor list tables and fills in the nearest neighbors of each city
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * list -  The list of city ids
+ * Param:   int len -  The number of cities
+ * Param:   int max_id -  The max id of all cities
+ * Return:  int -  0, or -1 if out of memory (nothing is left allocated)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int init_neighbors(tsp_solver * tsp, int * list, int len, int max_id) {
+    int result;
+
+    //(Finding the neighbors is timed with the distances):
+    set_phase(tsp, PHASE_DISTANCES);
+    result = calc_neighbors(tsp, list, len, max_id);
+    set_phase(tsp, PHASE_IMPROVEMENT);
+
+    tsp->queued = mem_calloc(tsp, max_id+1, sizeof(char));
+    tsp->queue = mem_alloc(tsp, len * sizeof(int));
+    if(result < 0 || tsp->queued == NULL || tsp->queue == NULL) {
+        free_neighbors(tsp);
+        return no_memory(tsp);
+    }
+    tsp->queue_size = len;
+    tsp->queue_head = 0;
+    tsp->queue_len = 0;
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Finds the nearest neighbors of each city with the k-d tree, unless the neighbor lists
+ * have already been found (or loaded from the instance cache)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * list -  The list of city ids
+ * Param:   int len -  The number of cities
+ * Param:   int max_id -  The largest city id
+ * Return:  int -  0, or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int calc_neighbors(tsp_solver * tsp, int * list, int len, int max_id) {
+    int i, threads;
+    pthread_t * thread;
+    neighbor_range * range;
+
+    if(tsp->neighbors)
         return 0;
+
+    tsp->neighbors = mem_alloc(tsp, (max_id+1) * NUM_NEIGHBORS * sizeof(int));
+    if(tsp->neighbors == NULL)
+        return no_memory(tsp);
+
+    //The k-d tree is only read by kd_nearest, so large inputs are split
+    //between a thread per processor (each finding its own range of cities):
+    threads = len >= NEIGHBOR_THREAD_MIN ? tsp->num_workers : 1;
+    thread = mem_alloc(tsp, threads * sizeof(pthread_t));
+    range = mem_alloc(tsp, threads * sizeof(*range));
+    if(thread == NULL || range == NULL) {
+        mem_free(tsp, range);
+        mem_free(tsp, thread);
+        mem_free(tsp, tsp->neighbors);
+        tsp->neighbors = NULL;
+        return no_memory(tsp);
+    }
+    for(i=0; i<threads; i++) {
+        range[i].tsp = tsp;
+        range[i].lo = (int)((long)len * i / threads);
+        range[i].hi = (int)((long)len * (i+1) / threads);
+    }
+    tsp->neighbor_list = list;
+    for(i=1; i<threads; i++) {
+        pthread_create(&thread[i], NULL, calc_neighbors_range, &range[i]);
+    }
+    calc_neighbors_range(&range[0]);
+    for(i=1; i<threads; i++) {
+        pthread_join(thread[i], NULL);
+    }
+    mem_free(tsp, thread);
+    mem_free(tsp, range);
+    return 0;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Takes a temperature and returns a decreased temperature
- * Param:   double old_temp -  The temperature to decrease
- * Return:  double -  The new, decreased temperature
+ * Finds the nearest neighbors of a range of the cities being given neighbor lists by calc_neighbors
+ * (run in a thread of its own for all but the first range)
+ * Param:   void * arg -  The neighbor_range
+ * Return:  void * -  NULL
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-double change_temp(double old_temp) {
-    if(old_temp > .01) {
-        return old_temp*DELTA_TEMP;
+static void * calc_neighbors_range(void * arg) {
+    neighbor_range * range = arg;
+    tsp_solver * tsp = range->tsp;
+    int i;
+
+    for(i=range->lo; i<range->hi; i++) {
+        kd_nearest(tsp, tsp->neighbor_list[i], NUM_NEIGHBORS, &tsp->neighbors[tsp->neighbor_list[i]*NUM_NEIGHBORS]);
     }
-    return old_temp;
+    return NULL;
 }
 
 
-//NATHAN'S ALGORITHM:
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets a city's list of nearest neighbors.  While tsp_update repairs a tour, the lists are only found
+ * (with the k-d tree) as they are first needed, since the search stays near the changes
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int id -  The id of the city
+ * Return:  int * -  Its nearest neighbors (NUM_NEIGHBORS of them, or one fewer than the cities), nearest first
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int * neighbor_list(tsp_solver * tsp, int id) {
+    if(tsp->neighbors_found && !tsp->neighbors_found[id]) {
+        kd_nearest(tsp, id, NUM_NEIGHBORS, &tsp->neighbors[id*NUM_NEIGHBORS]);
+        tsp->neighbors_found[id] = 1;
+    }
+    return &tsp->neighbors[id*NUM_NEIGHBORS];
+}
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * A combination of two_opt and simulated anneal algorithms
- * Param:   int * path -  The path to improve
+ * Frees the tables allocated by init_neighbors
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void free_neighbors(tsp_solver * tsp) {
+    if(!tsp->neighbors_cached)
+        mem_free(tsp, tsp->neighbors);
+    tsp->neighbors = NULL;
+    mem_free(tsp, tsp->neighbors_found);
+    tsp->neighbors_found = NULL;
+    mem_free(tsp, tsp->queued);
+    mem_free(tsp, tsp->queue);
+    tsp->queued = NULL;
+    tsp->queue = NULL;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Adds a city to the back of the queue of cities to examine, unless it is already queued
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int id -  The id of the city
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void queue_push(tsp_solver * tsp, int id) {
+    if(tsp->queued[id])
+        return;
+    tsp->queued[id] = 1;
+    tsp->queue[(tsp->queue_head + tsp->queue_len++) % tsp->queue_size] = id;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Removes and returns the city at the front of the queue of cities to examine
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  The id of the city
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int queue_pop(tsp_solver * tsp) {
+    int id;
+
+    id = tsp->queue[tsp->queue_head];
+    tsp->queue_head = (tsp->queue_head + 1) % tsp->queue_size;
+    tsp->queue_len--;
+    tsp->queued[id] = 0;
+    return id;
+}
+
+
+//LIN-KERNIGHAN STYLE ALGORITHM:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Improves a path with chains of 2-opt moves (so including sequential 3-opt moves and deeper) and Or-opt segment moves,
+ * considering only moves that join a city to one of its nearest neighbors.  Cities are examined from a queue,
+ * as in two_opt_neighbors
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The path to improve upon
  * Param:   int len -  The length of the path
- * Return:  void -  The resulting path is left in the location specified by the path pointer
+ * Return:  void -  The improved path is left at the location specified by the path pointer
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void hybrid(int * path, int len) {
-    int i, j, dst, swp_dst, change, best_change, term_cnt;
-    double temp;
-    
-    //Get the current path's distance:
-    dst = calc_path_dist(path, len);
+static void lin_kernighan(tsp_solver * tsp, int * path, int len) {
+    int i;
 
-    term_cnt = 0;
-    temp = 0.01;
+    if(len < 5)
+        return;
 
-    do {
-        change = 0;
-        best_change = 0;
+    //Every city starts out in the queue:
+    if(tour_init(tsp, path, len) < 0)
+        return;
+    for(i=0; i<len; i++) {
+        queue_push(tsp, path[i]);
+    }
+    lk_improve(tsp, path, len, calc_path_dist(tsp, path, len));
+}
 
-        //Iterate through endpoints to be swapped:
-        for(i=1; i<len; i++) {
-            for(j=i; j<len; j++) {
 
-                //Get the path distance of the tentative two-opt swap
-                //(without actually performing the swap):
-                swp_dst = two_opt_dist(dst, i, j, path, len);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The main loop of lin_kernighan: improves the tour (already set up with tour_init) around
+ * the cities in the queue, and those next to the changes made, until the queue is empty
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The path the tour was set up from
+ * Param:   int len -  The length of the path
+ * Param:   int dst -  The distance of the path
+ * Return:  void -  The improved path is left at the location specified by the path pointer
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void lk_improve(tsp_solver * tsp, int * path, int len, int dst) {
+    int t1, gain, checks;
 
-                //Check to see whether the new distance is acceptable:
-                if(anneal_accept(swp_dst, dst, temp)) {
+    checks = 0;
+    while(tsp->queue_len > 0) {
+        if((++checks & (TIME_CHECK_INTERVAL-1)) == 0) {
+            if(should_stop(tsp))
+                break;
+            if(checkpoint_due(tsp)) {
+                tour_get_path(tsp, path);
+                set_best(tsp, dst, path);
+                write_checkpoint(tsp);
+            }
+        }
+        t1 = queue_pop(tsp);
+
+        //Try a chain of moves starting by removing either of t1's edges,
+        //then try moving a segment starting at t1:
+        gain = lk_step(tsp, t1, tour_next(tsp, t1), get_distance(tsp, t1, tour_next(tsp, t1)), 1);
+        if(gain == 0)
+            gain = lk_step(tsp, t1, tour_prev(tsp, t1), get_distance(tsp, t1, tour_prev(tsp, t1)), 1);
+        if(gain == 0)
+            gain = or_opt_move(tsp, t1, &dst);
+        else
+            dst -= gain;
 
-                    //Print debug information:
-                    if(debug) {
-                        printf("Hybrid: temp: %f, old path: %d, new path : %d", temp, dst, swp_dst);
-                        if(swp_dst > dst) 
-                            printf("\t < up");
-                        printf("\n");
-                    }
+        if(gain > 0) {
+            if(tsp->debug) {
+                printf("Lin-kernighan found new path with distance: %d\n", dst);
+            }
+            queue_push(tsp, t1);
+            stats_improved(tsp, dst);
+        }
+    }
 
-                    //Make the swap:
-                    two_opt_swap(i, j, path);
-                    dst = swp_dst;
-                    change = 1;
-   
-                    //If necessary, update the running best path/distance:
-                    if(dst < best_distance) {
-                        set_best(dst, path);
-                        best_change = 1;
-                        term_cnt=0;
+    //As in two_opt_neighbors, the final path is the best one:
+    tour_get_path(tsp, path);
+    set_best(tsp, dst, path);
+    tour_free(tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * One step of a lin-kernighan move chain.  The edge (t1, t2) has been removed (tentatively) and t2 needs a new neighbor t3.
+ * Removing the edge from t3 to t4 (the neighbor on t1's side) and joining t4 to t1 closes up a valid tour
+ * (a 2-opt move).  If that tour is shorter it is kept; if not, the chain continues from (t1, t4)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int t1 -  The city at the fixed end of the chain
+ * Param:   int t2 -  The city at the open end of the chain, adjacent to t1 in the tour
+ * Param:   int gain -  The total length of edges removed minus edges added so far, not counting the edge (t1, t2)
+ * Param:   int depth -  The number of moves in the chain so far, including this one
+ * Return:  int -  The reduction in path length if an improving chain was found and made, 0 if not (the tour is left unchanged)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int lk_step(tsp_solver * tsp, int t1, int t2, int gain, int depth) {
+    int k, t3, t4, g1, closed, result, forward, breadth;
+    int breadths[] = LK_BREADTH;
+    int * neighbors = neighbor_list(tsp, t2);
+
+    breadth = depth <= sizeof(breadths)/sizeof(int) ? breadths[depth-1] : 1;
+
+    for(k=0; k<NUM_NEIGHBORS && k<tsp->tour_len-1 && breadth>0; k++) {
+        t3 = neighbors[k];
+
+        //Neighbors are sorted, so no later neighbor can leave a positive gain:
+        g1 = gain - get_distance(tsp, t2, t3);
+        if(g1 <= 0)
+            break;
+
+        //(Undoing a move can leave the tour running the other way, so check each time):
+        forward = (tour_next(tsp, t1) == t2);
+        t4 = forward ? tour_prev(tsp, t3) : tour_next(tsp, t3);
+        if(t3 == t1 || t4 == t2)
+            continue;
+        breadth--;
+
+        //Replace edges (t1, t2) and (t4, t3) with (t1, t4) and (t2, t3):
+        tour_move(tsp, t1, t2, t4, t3);
+        closed = g1 + get_distance(tsp, t4, t3) - get_distance(tsp, t4, t1);
+        tsp->stats.evaluated++;
+        if(closed > 0) {
+            tsp->stats.accepted++;
+            queue_push(tsp, t2);
+            queue_push(tsp, t3);
+            queue_push(tsp, t4);
+            return closed;
+        }
+
+        if(depth < LK_MAX_DEPTH) {
+            result = lk_step(tsp, t1, t4, g1 + get_distance(tsp, t4, t3), depth+1);
+            if(result > 0) {
+                queue_push(tsp, t2);
+                queue_push(tsp, t3);
+                return result;
+            }
+        }
+
+        //Undo the move:
+        tour_move(tsp, t1, t4, t2, t3);
+    }
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Looks for an improving Or-opt move: moving a segment of up to OR_OPT_MAX_LEN cities starting at s1
+ * (in either direction) to between a neighbor of one of its ends and that neighbor's predecessor or successor,
+ * in either orientation.  Performs the first one found
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int s1 -  The id of the city at the start of the segment
+ * Param:   int * dst -  The distance of the path.  Updated if a move is made
+ * Return:  int -  The reduction in path length if a move was made, 0 if not
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int or_opt_move(tsp_solver * tsp, int s1, int * dst) {
+    int i, k, dir, end, side, seg_len, s2, p, n, e, f, c, c2, a, b, removed, gain;
+    int * neighbors;
+
+    for(seg_len=1; seg_len<=OR_OPT_MAX_LEN && seg_len+3<=tsp->tour_len; seg_len++) {
+        for(dir=0; dir<2; dir++) {
+
+            //The segment runs from s1 to s2 in direction dir, between p and n:
+            s2 = s1;
+            for(i=1; i<seg_len; i++) {
+                s2 = dir ? tour_prev(tsp, s2) : tour_next(tsp, s2);
+            }
+            p = dir ? tour_next(tsp, s1) : tour_prev(tsp, s1);
+            n = dir ? tour_prev(tsp, s2) : tour_next(tsp, s2);
+            removed = get_distance(tsp, p, s1) + get_distance(tsp, s2, n) - get_distance(tsp, p, n);
+            if(removed <= 0)
+                continue;
+
+            //Try putting either end e of the segment next to one of its neighbors c:
+            for(end=0; end<2; end++) {
+                e = end ? s2 : s1;
+                f = end ? s1 : s2;
+                neighbors = neighbor_list(tsp, e);
+
+                for(k=0; k<NUM_NEIGHBORS && k<tsp->tour_len-1; k++) {
+                    c = neighbors[k];
+                    if(get_distance(tsp, e, c) >= removed)
+                        break;
+                    if(dir ? tour_between(tsp, s2, c, s1) : tour_between(tsp, s1, c, s2))
+                        continue;
+
+                    //...on the side of c toward c2:
+                    for(side=0; side<2; side++) {
+                        c2 = side ? tour_prev(tsp, c) : tour_next(tsp, c);
+                        if(dir ? tour_between(tsp, s2, c2, s1) : tour_between(tsp, s1, c2, s2))
+                            continue;
+
+                        gain = removed - (get_distance(tsp, e, c) + get_distance(tsp, f, c2) - get_distance(tsp, c, c2));
+                        tsp->stats.evaluated++;
+                        if(gain <= 0)
+                            continue;
+                        tsp->stats.accepted++;
+
+                        //Name the new edge's ends a and b, with b after a in direction dir:
+                        if(c2 == (dir ? tour_prev(tsp, c) : tour_next(tsp, c))) {
+                            a = c;
+                            b = c2;
+                        }
+                        else {
+                            a = c2;
+                            b = c;
+                        }
+
+                        //Cut the segment out and put it back in between a and b reversed
+                        //(a s2..s1 b), then flip it if it belongs the other way around:
+                        tour_move(tsp, p, s1, a, b);
+                        tour_move(tsp, p, a, n, s2);
+                        if((a == c) == (e == s1))
+                            tour_move(tsp, a, s2, s1, b);
+
+                        *dst -= gain;
+                        queue_push(tsp, p);
+                        queue_push(tsp, n);
+                        queue_push(tsp, s2);
+                        queue_push(tsp, c);
+                        queue_push(tsp, c2);
+                        return gain;
                     }
                 }
             }
         }
+    }
+    return 0;
+}
 
-        //Increment the termination counter if there's been no change
-        //in the best path throughout the entire last loop:
-        if(!best_change) {
-            term_cnt++;
-        }
 
-        //Boost the temperature if there was no change
-        //at all throughout the entire last loop
-        //(i.e. it's stuck in a local optimum):
-        if(!change) {
+//ITERATED LOCAL SEARCH ALGORITHM:
 
-            //The closer the algorithm is to termination,
-            //the larger the temperature boost (getting desperate):
-            
-            temp = get_max(START_TEMP,  END_TEMP * ((double)term_cnt/SATISFIED));
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Iterated local search: repairs the path with 2-opt and Or-opt moves (as in two_opt_neighbors and
+ * lin_kernighan), then repeatedly kicks it out of its local optimum with a random double-bridge
+ * move and repairs only the cities the kick touched.  A kick that ends up longer than the best
+ * path found so far is undone, so each iteration costs about as much as the few moves it made.
+ * Stops after ILS_SATISFIED kicks in a row without a shorter path or, with a time limit,
+ * keeps going until the deadline
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The path to perform iterated local search on
+ * Param:   int len -  The length of the path
+ * Return:  void -  The resulting path is left in the location specified by the path pointer
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void iterated_local_search(tsp_solver * tsp, int * path, int len) {
+    int i, dst, best_dst, attempt;
+
+    if(len < 5)
+        return;
+
+    //Every city starts out in the queue:
+    if(tour_init(tsp, path, len) < 0)
+        return;
+    for(i=0; i<len; i++) {
+        queue_push(tsp, path[i]);
+    }
+
+    dst = calc_path_dist(tsp, path, len);
+    ils_repair(tsp, &dst);
+    best_dst = dst;
+
+    //A double-bridge kick needs at least 8 cities, so smaller tours are only repaired:
+    attempt = 0;
+    while(len >= 8 && !should_stop(tsp) && (tsp->time_limit > 0 || attempt < ILS_SATISFIED)) {
+
+        //Between kicks, the tour is the best one found:
+        if(checkpoint_due(tsp)) {
+            tour_get_path(tsp, path);
+            set_best(tsp, best_dst, path);
+            write_checkpoint(tsp);
         }
 
-        //If there has been some change, put it on ice
-        //(this will get down it back down to a local optimum):
+        //Kick a random part of the tour (path still holds every city, in some order),
+        //then repair it, logging every move in case it has to be undone:
+        tour_log_clear(tsp);
+        dst += ils_kick(tsp, path[rng_int(&tsp->rng, len)]);
+        ils_repair(tsp, &dst);
+        tsp->stats.evaluated++;
+
+        if(dst <= best_dst) {
+            tsp->stats.accepted++;
+            if(dst < best_dst) {
+                if(tsp->debug)
+                    printf("Iterated local search found new path with distance: %d\n", dst);
+                best_dst = dst;
+                attempt = 0;
+                stats_improved(tsp, dst);
+            }
+            else
+                attempt++;
+        }
         else {
-            temp = .01;
+            tour_log_undo(tsp);
+            dst = best_dst;
+            attempt++;
+        }
+    }
+
+    //Worse kicks are undone, so the final path is the best one
+    //(unless the log of moves ran out of memory, when the last kick may have stayed):
+    tour_get_path(tsp, path);
+    if(tsp->out_of_memory)
+        dst = calc_path_dist(tsp, path, len);
+    set_best(tsp, dst, path);
+    tour_free(tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Makes a double-bridge move starting at city a: with a b..c d..e f in the tour (the two segments
+ * being at most ILS_KICK_LEN cities long), swaps the segments to give a d..e b..c f.  This is made
+ * of three tour_moves, each flipping only part of the two segments, and queues the six endpoints
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The city before the two segments
+ * Return:  int -  The change in the length of the tour
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int ils_kick(tsp_solver * tsp, int a) {
+    int i, b, c, d, e, f, max_len, change;
+
+    max_len = (tsp->tour_len - 3) / 2;
+    if(max_len > ILS_KICK_LEN)
+        max_len = ILS_KICK_LEN;
+
+    b = tour_next(tsp, a);
+    c = b;
+    for(i = rng_int(&tsp->rng, max_len); i>0; i--) {
+        c = tour_next(tsp, c);
+    }
+    d = tour_next(tsp, c);
+    e = d;
+    for(i = rng_int(&tsp->rng, max_len); i>0; i--) {
+        e = tour_next(tsp, e);
+    }
+    f = tour_next(tsp, e);
+
+    change = get_distance(tsp, a, d) + get_distance(tsp, e, b) + get_distance(tsp, c, f);
+    change -= get_distance(tsp, a, b) + get_distance(tsp, c, d) + get_distance(tsp, e, f);
+
+    //a c..b d..e f, then a c..b e..d f, then a d..e b..c f:
+    tour_move(tsp, a, b, c, d);
+    tour_move(tsp, b, d, e, f);
+    tour_move(tsp, a, c, d, f);
+
+    queue_push(tsp, a);
+    queue_push(tsp, b);
+    queue_push(tsp, c);
+    queue_push(tsp, d);
+    queue_push(tsp, e);
+    queue_push(tsp, f);
+    return change;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Improves the tour with 2-opt and Or-opt moves around the cities in the queue
+ * until the queue is empty
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * dst -  The distance of the tour, which is updated
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void ils_repair(tsp_solver * tsp, int * dst) {
+    int a, checks;
+
+    checks = 0;
+    while(tsp->queue_len > 0) {
+        if((++checks & (TIME_CHECK_INTERVAL-1)) == 0 && should_stop(tsp))
+            break;
+        a = queue_pop(tsp);
+        if(!two_opt_neighbor_move(tsp, a, dst))
+            or_opt_move(tsp, a, dst);
+    }
+}
+
+
+
+//SIMULATED ANNEAL ALGORITHM:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Version of the simulated anneal algorithm
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The path to perform simulated anneal on
+ * Param:   int len -  The length of the path
+ * Return:  void -  The resulting path is left in the location specified by the path pointer
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void anneal(tsp_solver * tsp, int * path, int len) {
+    int i, j, a, c, dst, swp_dst, best_dst, saved, attempt, checks;
+    double temp, begin, frac;
+
+    //Get the current path's distance:
+    dst = calc_path_dist(tsp, path, len);
+    if(tour_init(tsp, path, len) < 0)
+        return;
+    best_dst = dst;
+    saved = 1;
+
+    temp = START_TEMP;
+    attempt = 0;
+    checks = 0;
+    begin = get_time();
+    while(attempt < SATISFIED) {
+
+        //Every so often, check whether to stop, and with a time limit, cool down in step
+        //with the time used instead of DELTA_TEMP per move, so that the path is cold by the deadline
+        //(and count the moves tried, in bulk):
+        if((++checks & (TIME_CHECK_INTERVAL-1)) == 0) {
+            tsp->stats.evaluated += TIME_CHECK_INTERVAL;
+            if(should_stop(tsp))
+                break;
+            if(checkpoint_due(tsp)) {
+                if(!saved) {
+                    tour_get_path(tsp, path);
+                    set_best(tsp, dst, path);
+                    saved = 1;
+                }
+                write_checkpoint(tsp);
+            }
+            if(tsp->time_limit > 0) {
+                frac = (get_time() - begin) / (tsp->deadline - begin);
+                temp = START_TEMP * pow(.01/START_TEMP, frac);
+            }
+        }
+
+        //Try a random 2-opt swap:
+        i = rng_int(&tsp->rng, len-1) + 1;
+        j = i + rng_int(&tsp->rng, len-i);
+        a = tour_city_at(tsp, i);
+        c = tour_city_at(tsp, j);
+        swp_dst = two_opt_flip_dist(tsp, dst, a, c);
+
+        //If the result is acceptable:
+        if(anneal_accept(swp_dst, dst, temp, &tsp->rng)) {
+            tsp->stats.accepted++;
+            if(swp_dst > dst)
+                tsp->stats.uphill++;
+            if(tsp->debug) {
+                printf("Anneal: temp: %f, old path: %d, new path : %d", temp, dst, swp_dst);
+                if(swp_dst > dst) 
+                    printf("\t < escape local optimum");
+                printf("\n");
+            }
+
+            //Before moving away from a best path that hasn't been saved yet, save it
+            //(getting the path out of the tour takes O(n), so this is only done when needed):
+            if(swp_dst > dst && !saved) {
+                tour_get_path(tsp, path);
+                set_best(tsp, dst, path);
+                saved = 1;
+            }
+
+            //Update the path and it's distance:
+            tour_flip(tsp, a, c);
+            dst = swp_dst;
+
+            //Update the best distance, if necessary:
+            if(dst < best_dst) {
+                best_dst = dst;
+                saved = 0;
+                stats_improved(tsp, dst);
+            }
+
+            //Reset attempt counter:
+            attempt = 0;
+        }
+
+        //If the result is unacceptable:
+        else {
+            attempt++;
+            if(tsp->debug)
+                printf("Decline #%d\n", attempt);
+        }
+
+        //Decrease the temperature:
+        if(tsp->time_limit <= 0)
+            temp = change_temp(temp);
+    }
+    tsp->stats.evaluated += checks & (TIME_CHECK_INTERVAL-1);
+
+    tour_get_path(tsp, path);
+    if(!saved)
+        set_best(tsp, dst, path);
+    tour_free(tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Accepts or rejects a proposed change from a path with old_dst to a path with new_dst, given temperature.
+ * Shorter paths are always accepted and much longer ones always rejected without drawing a random
+ * number; otherwise the probability exp(-(new_dst-old_dst)/temp) is read from exp_table
+ * Param:   int new_dst -  The distance of the new path
+ * Param:   int old_dst -  The distance of the old path
+ * Param:   double temp -  The temperature
+ * Param:   rng_state * r -  The random number generator to use
+ * Return:  int -  1 if the move is accepted, 0 if not
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int anneal_accept(int new_dst, int old_dst, double temp, rng_state * r) {
+    double x;
+
+    if(new_dst < old_dst)
+        return 1;
+    if(new_dst == old_dst)
+        return 0;
+
+    x = (new_dst - old_dst) / temp;
+    if(x >= ACCEPT_MAX_EXP)
+        return 0;
+
+    return rng_double(r) < exp_table[(int)(x*EXP_TABLE_STEPS)];
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Fills the table of exp(-x) used by anneal_accept
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void init_exp_table(void) {
+    int i;
+
+    for(i=0; i<=ACCEPT_MAX_EXP*EXP_TABLE_STEPS; i++) {
+        exp_table[i] = exp(-(double)i/EXP_TABLE_STEPS);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Takes a temperature and returns a decreased temperature
+ * Param:   double old_temp -  The temperature to decrease
+ * Return:  double -  The new, decreased temperature
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static double change_temp(double old_temp) {
+    if(old_temp > .01) {
+        return old_temp*DELTA_TEMP;
+    }
+    return old_temp;
+}
+
+
+//PARALLEL TEMPERING ALGORITHM:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Runs one simulated anneal replica per thread, each at a fixed temperature on a geometric
+ * ladder from PT_MIN_TEMP to PT_MAX_TEMP.  After every PT_EXCHANGE_STEPS moves the replicas
+ * wait for each other and neighboring temperatures may swap their paths, so good paths found
+ * by the hot replicas sink down to the cold ones.  Stops after PT_SATISFIED exchange rounds
+ * without a new best path
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The path to perform parallel tempering on
+ * Param:   int len -  The length of the path
+ * Return:  void -  The best path found is left in the location specified by the path pointer
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void parallel_tempering(tsp_solver * tsp, int * path, int len) {
+    int i, dst;
+
+    //Too few cities to make a 2-opt move:
+    if(len < 3)
+        return;
+
+    dst = calc_path_dist(tsp, path, len);
+
+    //Give every replica a copy of the path, a temperature and a seed:
+    tsp->num_replicas = tsp->num_threads;
+    tsp->replicas = mem_calloc(tsp, tsp->num_replicas, sizeof(replica));
+    if(tsp->replicas == NULL) {
+        no_memory(tsp);
+        return;
+    }
+    for(i=0; i<tsp->num_replicas; i++) {
+        tsp->replicas[i].tsp = tsp;
+        tsp->replicas[i].path = mem_alloc(tsp, len * sizeof(int));
+        if(tsp->replicas[i].path == NULL) {
+            free_replicas(tsp);
+            no_memory(tsp);
+            return;
+        }
+        copy_array(tsp->replicas[i].path, path, len);
+        tsp->replicas[i].dst = dst;
+        tsp->replicas[i].best = dst;
+        tsp->replicas[i].saved = 1;
+        memset(&tsp->replicas[i].stats, 0, sizeof(solver_stats));
+        rng_seed(&tsp->replicas[i].rng, tsp->seed + i + 1);
+        if(tsp->num_replicas > 1)
+            tsp->replicas[i].temp = PT_MIN_TEMP * pow(PT_MAX_TEMP/PT_MIN_TEMP, i/(double)(tsp->num_replicas-1));
+        else
+            tsp->replicas[i].temp = PT_MIN_TEMP;
+    }
+
+    tsp->temper_round = 0;
+    tsp->temper_idle = 0;
+    pthread_barrier_init(&tsp->temper_barrier, NULL, tsp->num_replicas);
+    for(i=0; i<tsp->num_replicas; i++)
+        pthread_create(&tsp->replicas[i].thread, NULL, temper_replica, &tsp->replicas[i]);
+    for(i=0; i<tsp->num_replicas; i++)
+        pthread_join(tsp->replicas[i].thread, NULL);
+    pthread_barrier_destroy(&tsp->temper_barrier);
+
+    //The threads are done (after a last exchange, which saved every best path),
+    //so the best path can be read without the lock:
+    copy_array(path, tsp->best_path, len);
+    free_replicas(tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Frees the replicas allocated by parallel_tempering (and the paths given to them)
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void free_replicas(tsp_solver * tsp) {
+    int i;
+
+    for(i=0; i<tsp->num_replicas; i++)
+        mem_free(tsp, tsp->replicas[i].path);
+    mem_free(tsp, tsp->replicas);
+    tsp->replicas = NULL;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The thread run for each parallel tempering replica: tries random 2-opt moves on the replica's
+ * own path at its temperature, then meets the other replicas at the barrier for an exchange
+ * (made by the first replica's thread alone), until temper_exchange() decides to stop
+ * Param:   void * arg -  The replica to run
+ * Return:  void * -  NULL
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void * temper_replica(void * arg) {
+    replica * r = arg;
+    tsp_solver * tsp = r->tsp;
+    int step, i, j, swp_dst, len;
+
+    len = tsp->num_cities;
+    while(1) {
+        for(step=0; step<PT_EXCHANGE_STEPS; step++) {
+
+            //Try a random 2-opt swap:
+            i = rng_int(&r->rng, len-1) + 1;
+            j = i + rng_int(&r->rng, len-i);
+            swp_dst = two_opt_dist(tsp, r->dst, i, j, r->path, len);
+
+            if(anneal_accept(swp_dst, r->dst, r->temp, &r->rng)) {
+                r->stats.accepted++;
+                if(swp_dst > r->dst)
+                    r->stats.uphill++;
+
+                //As in anneal, only save a best path (taking the lock)
+                //when moving away from it:
+                if(swp_dst > r->dst && !r->saved) {
+                    set_best(tsp, r->dst, r->path);
+                    r->saved = 1;
+                }
+
+                two_opt_swap(i, j, r->path);
+                r->dst = swp_dst;
+                if(r->dst < r->best) {
+                    r->best = r->dst;
+                    r->saved = 0;
+                    r->stats.improvements++;
+                }
+            }
+        }
+
+        r->stats.evaluated += PT_EXCHANGE_STEPS;
+
+        //Wait for every replica to finish its moves, exchange, then wait for the exchange:
+        pthread_barrier_wait(&tsp->temper_barrier);
+        if(r == tsp->replicas)
+            temper_exchange(tsp);
+        pthread_barrier_wait(&tsp->temper_barrier);
+
+        if(tsp->temper_idle >= PT_SATISFIED)
+            break;
+    }
+
+    return NULL;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Offers each pair of replicas at neighboring temperatures (alternating between the even and odd
+ * pairs each round) the chance to swap paths, accepted with probability
+ * exp((1/T_cold - 1/T_hot) * (dst_cold - dst_hot)), and counts the rounds without a new best path.
+ * Only called while all the other replica threads wait at the barrier
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void temper_exchange(tsp_solver * tsp) {
+    int i, tmp_dst, tmp_best;
+    int * tmp_path;
+    double prob, q;
+
+    //Save any unsaved best paths before they change hands,
+    //and add up the replicas' move counters:
+    for(i=0; i<tsp->num_replicas; i++) {
+        if(!tsp->replicas[i].saved) {
+            set_best(tsp, tsp->replicas[i].dst, tsp->replicas[i].path);
+            tsp->replicas[i].saved = 1;
+        }
+        tsp->stats.evaluated += tsp->replicas[i].stats.evaluated;
+        tsp->stats.accepted += tsp->replicas[i].stats.accepted;
+        tsp->stats.uphill += tsp->replicas[i].stats.uphill;
+        tsp->stats.improvements += tsp->replicas[i].stats.improvements;
+        memset(&tsp->replicas[i].stats, 0, sizeof(solver_stats));
+    }
+    stats_trace(tsp, tsp->best_distance);
+    if(checkpoint_due(tsp))
+        write_checkpoint(tsp);
+
+    for(i = tsp->temper_round % 2; i+1 < tsp->num_replicas; i += 2) {
+        prob = exp((1.0/tsp->replicas[i].temp - 1.0/tsp->replicas[i+1].temp) * (tsp->replicas[i].dst - tsp->replicas[i+1].dst));
+        q = rng_double(&tsp->replicas[0].rng);
+        if(q < prob) {
+            if(tsp->debug)
+                printf("Tempering: exchange %d (%d) <-> %d (%d)\n", i, tsp->replicas[i].dst, i+1, tsp->replicas[i+1].dst);
+            tmp_path = tsp->replicas[i].path;
+            tsp->replicas[i].path = tsp->replicas[i+1].path;
+            tsp->replicas[i+1].path = tmp_path;
+            tmp_dst = tsp->replicas[i].dst;
+            tsp->replicas[i].dst = tsp->replicas[i+1].dst;
+            tsp->replicas[i+1].dst = tmp_dst;
+            tmp_best = get_max(tsp->replicas[i].best, tsp->replicas[i+1].best);
+            tsp->replicas[i].best = tsp->replicas[i+1].best = tmp_best;
+        }
+    }
+
+    //Count the rounds since the best path last improved
+    //(stopping at once if out of time):
+    pthread_mutex_lock(&tsp->best_lock);
+    if(tsp->temper_round == 0 || tsp->best_distance < tsp->temper_last_best)
+        tsp->temper_idle = 0;
+    else
+        tsp->temper_idle++;
+    tsp->temper_last_best = tsp->best_distance;
+    pthread_mutex_unlock(&tsp->best_lock);
+    if(should_stop(tsp))
+        tsp->temper_idle = PT_SATISFIED;
+
+    tsp->temper_round++;
+}
+
+
+//NATHAN'S ALGORITHM:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * A combination of two_opt and simulated anneal algorithms
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The path to improve
+ * Param:   int len -  The length of the path
+ * Return:  void -  The resulting path is left in the location specified by the path pointer
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void hybrid(tsp_solver * tsp, int * path, int len) {
+    int a, c, tmp, head, dst, swp_dst, best_dst, saved, change, best_change, term_cnt, checks, stopped;
+    double temp;
+    
+    //Get the current path's distance:
+    dst = calc_path_dist(tsp, path, len);
+    if(tour_init(tsp, path, len) < 0)
+        return;
+    head = tsp->tour_head;
+    best_dst = dst;
+    saved = 1;
+
+    term_cnt = 0;
+    temp = 0.01;
+    checks = 0;
+    stopped = 0;
+
+    do {
+        change = 0;
+        best_change = 0;
+
+        //Iterate through endpoints to be swapped
+        //(cities a and c at every pair of positions i<=j after the head):
+        for(a=tour_next(tsp, head); a!=head && !stopped; a=tour_next(tsp, a)) {
+            for(c=a; c!=head; c=tour_next(tsp, c)) {
+
+                //Skip ahead to the next swap that anneal_accept could accept
+                //(others are rejected without drawing a random number):
+                checks += two_opt_scan(tsp, a, &c, head, ACCEPT_MAX_EXP * temp + 1) + 1;
+                if(c == head)
+                    break;
+
+                //(Moves tried are counted here, in bulk, as in two_opt):
+                if(checks >= TIME_CHECK_INTERVAL) {
+                    tsp->stats.evaluated += checks;
+                    checks = 0;
+                    if(should_stop(tsp)) {
+                        stopped = 1;
+                        break;
+                    }
+                    if(checkpoint_due(tsp)) {
+                        if(!saved) {
+                            tour_get_path(tsp, path);
+                            set_best(tsp, dst, path);
+                            saved = 1;
+                        }
+                        write_checkpoint(tsp);
+                    }
+                }
+
+                //Get the path distance of the tentative two-opt swap
+                //(without actually performing the swap):
+                swp_dst = two_opt_flip_dist(tsp, dst, a, c);
+
+                //Check to see whether the new distance is acceptable:
+                if(anneal_accept(swp_dst, dst, temp, &tsp->rng)) {
+                    tsp->stats.accepted++;
+                    if(swp_dst > dst)
+                        tsp->stats.uphill++;
+
+                    //Print debug information:
+                    if(tsp->debug) {
+                        printf("Hybrid: temp: %f, old path: %d, new path : %d", temp, dst, swp_dst);
+                        if(swp_dst > dst) 
+                            printf("\t < up");
+                        printf("\n");
+                    }
+
+                    //As in anneal, save an unsaved best path before moving away from it:
+                    if(swp_dst > dst && !saved) {
+                        tour_get_path(tsp, path);
+                        set_best(tsp, dst, path);
+                        saved = 1;
+                    }
+
+                    //Make the swap (which leaves c at position i and a at position j):
+                    tour_flip(tsp, a, c);
+                    tmp = a;
+                    a = c;
+                    c = tmp;
+                    dst = swp_dst;
+                    change = 1;
+   
+                    //If necessary, update the running best distance:
+                    if(dst < best_dst) {
+                        best_dst = dst;
+                        saved = 0;
+                        best_change = 1;
+                        term_cnt=0;
+                        stats_improved(tsp, dst);
+                    }
+                }
+            }
+        }
+
+        //Increment the termination counter if there's been no change
+        //in the best path throughout the entire last loop:
+        if(!best_change) {
+            term_cnt++;
+        }
+
+        //Boost the temperature if there was no change
+        //at all throughout the entire last loop
+        //(i.e. it's stuck in a local optimum):
+        if(!change) {
+
+            //The closer the algorithm is to termination,
+            //the larger the temperature boost (getting desperate):
+            
+            temp = get_max(START_TEMP,  END_TEMP * ((double)term_cnt/SATISFIED));
+        }
+
+        //If there has been some change, put it on ice
+        //(this will get down it back down to a local optimum):
+        else {
+            temp = .01;
+        }
+
+    } while(term_cnt<SATISFIED && !stopped);
+    tsp->stats.evaluated += checks;
+
+    tour_get_path(tsp, path);
+    if(!saved)
+        set_best(tsp, dst, path);
+    tour_free(tsp);
+}
+
+
+
+
+//PARTITION ALGORITHM:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Builds a tour by splitting the cities into about num_cells cells (-g: a grid, or k-means clusters
+ * with -K), solving each cell on its own with the algorithms chosen, and joining the cells' tours.  Each cell is solved
+ * by a solver of its own (see solve_cell), on num_workers threads at once.
+ * With a time limit, the cells get CELL_TIME_SHARE of the time left between them
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  Contains the list of cities.  At completion, contains the joined tour
+ * Param:   int len -  The length of the path
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void partition_tour(tsp_solver * tsp, int * path, int len) {
+    int c, i, cells, threads, waves;
+    pthread_t * thread;
+    partition_work work;
+
+    //Each cell's tour goes where its cities are in order:
+    work.tsp = tsp;
+    work.order = mem_alloc(tsp, len * sizeof(int));
+    work.tours = mem_alloc(tsp, len * sizeof(int));
+    thread = mem_alloc(tsp, tsp->num_workers * sizeof(pthread_t));
+    tsp->cell_of = mem_alloc(tsp, len * sizeof(int));
+    cells = -1;
+    if(work.order == NULL || work.tours == NULL || thread == NULL || tsp->cell_of == NULL)
+        no_memory(tsp);
+    else {
+        copy_array(work.order, path, len);
+        if(tsp->use_kmeans)
+            cells = cluster_cells(tsp, work.order, len, &work.cell_start);
+        else
+            cells = partition_cells(tsp, work.order, len, &work.cell_start);
+    }
+    if(cells < 0) {
+        mem_free(tsp, tsp->cell_of);
+        mem_free(tsp, thread);
+        mem_free(tsp, work.tours);
+        mem_free(tsp, work.order);
+        tsp->cell_of = NULL;
+        return;
+    }
+    tsp->num_cells = cells;
+    work.next = 0;
+    pthread_mutex_init(&work.lock, NULL);
+
+    threads = tsp->num_workers < tsp->num_cells ? tsp->num_workers : tsp->num_cells;
+    work.budget = 0;
+    if(tsp->time_limit > 0) {
+        waves = (tsp->num_cells + threads - 1) / threads;
+        work.budget = (tsp->deadline - get_time()) * CELL_TIME_SHARE / waves;
+    }
+
+    for(i=1; i<threads; i++) {
+        pthread_create(&thread[i], NULL, solve_cells, &work);
+    }
+    solve_cells(&work);
+    for(i=1; i<threads; i++) {
+        pthread_join(thread[i], NULL);
+    }
+    pthread_mutex_destroy(&work.lock);
+
+    //Remember which cell each city is in, for partition_repair:
+    for(c=0; c<tsp->num_cells; c++) {
+        for(i=work.cell_start[c]; i<work.cell_start[c+1]; i++) {
+            tsp->cell_of[work.order[i]] = c;
+        }
+    }
+
+    stitch_cells(tsp, work.tours, work.cell_start, path);
+    set_best(tsp, calc_path_dist(tsp, path, len), path);
+
+    mem_free(tsp, thread);
+    mem_free(tsp, work.tours);
+    mem_free(tsp, work.order);
+    mem_free(tsp, work.cell_start);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The thread run for each worker of the partition (and by partition_tour itself):
+ * solves the next cell not yet taken, until there are none left
+ * Param:   void * arg -  The partition_work
+ * Return:  void * -  NULL
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void * solve_cells(void * arg) {
+    partition_work * work = arg;
+    int c;
+
+    while(1) {
+        pthread_mutex_lock(&work->lock);
+        c = work->next++;
+        pthread_mutex_unlock(&work->lock);
+        if(c >= work->tsp->num_cells)
+            break;
+        solve_cell(work->tsp, work, c);
+    }
+    return NULL;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Splits the cities into a grid of cells with about the same number of cities each: columns
+ * split at the x-coordinates, then each column split into rows at the y-coordinates.  Every other
+ * column runs from top to bottom, so that consecutive cells are next to each other
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * order -  The list of cities, which is reordered to group them by cell (in cell order)
+ * Param:   int len -  The number of cities
+ * Param:   int ** cell_start -  Location to store the (allocated) array of each cell's first index in order,
+ *                               followed by len
+ * Return:  int -  The number of cells (which is about num_cells, but with at least CELL_MIN_CITIES cities each),
+ *                 or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int partition_cells(tsp_solver * tsp, int * order, int len, int ** cell_start) {
+    int i, j, c, cells, cols, rows, lo, hi;
+
+    cells = tsp->num_cells;
+    if(cells > len / CELL_MIN_CITIES)
+        cells = len / CELL_MIN_CITIES;
+    if(cells < 1)
+        cells = 1;
+    cols = (int)ceil(sqrt(cells));
+    rows = (cells + cols - 1) / cols;
+    *cell_start = mem_alloc(tsp, (cols*rows + 1) * sizeof(int));
+    if(*cell_start == NULL)
+        return no_memory(tsp);
+
+    qsort_r(order, len, sizeof(int), compare_x, tsp);
+    c = 0;
+    for(i=0; i<cols; i++) {
+        lo = (long)len * i / cols;
+        hi = (long)len * (i+1) / cols;
+        qsort_r(order + lo, hi - lo, sizeof(int), compare_y, tsp);
+        if(i % 2)
+            two_opt_swap(lo, hi-1, order);
+        for(j=0; j<rows; j++) {
+            (*cell_start)[c++] = lo + (long)(hi - lo) * j / rows;
+        }
+    }
+    (*cell_start)[c] = len;
+    return c;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Splits the cities into about num_cells k-means clusters (-K), which follow the gaps between
+ * clustered cities where a grid would cut through them.  The centers are placed by k-means++
+ * and moved with KMEANS_ROUNDS rounds of Lloyd's algorithm on a sample of the cities, then every
+ * city joins its nearest center.  The cells are put in the order of a tour of their centers
+ * (found by a solver of its own), so that consecutive cells are next to each other
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * order -  The list of cities, which is reordered to group them by cell (in cell order)
+ * Param:   int len -  The number of cities
+ * Param:   int ** cell_start -  Location to store the (allocated) array of each cell's first index in order,
+ *                               followed by len
+ * Return:  int -  The number of cells (the clusters left with any cities, at most num_cells), or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int cluster_cells(tsp_solver * tsp, int * order, int len, int ** cell_start) {
+    int i, j, c, k, n, round, cells;
+    int * sample, * cluster, * count, * tour, * rank, * grouped;
+    double * center, * sum, * d2;
+    double total, r, dx, dy;
+    tsp_options options;
+    tsp_solver * centers_tsp;
+
+    k = tsp->num_cells;
+    if(k > len / CELL_MIN_CITIES)
+        k = len / CELL_MIN_CITIES;
+    if(k < 1)
+        k = 1;
+
+    n = (long)k * KMEANS_SAMPLE < len ? k * KMEANS_SAMPLE : len;
+    sample = mem_alloc(tsp, len * sizeof(int));
+    center = mem_alloc(tsp, 2 * k * sizeof(double));
+    sum = mem_alloc(tsp, 3 * k * sizeof(double));
+    d2 = mem_alloc(tsp, n * sizeof(double));
+    cluster = mem_alloc(tsp, len * sizeof(int));
+    count = mem_calloc(tsp, k + 1, sizeof(int));
+    tour = mem_alloc(tsp, k * sizeof(int));
+    rank = mem_alloc(tsp, k * sizeof(int));
+    *cell_start = mem_alloc(tsp, (k + 1) * sizeof(int));
+    if(sample == NULL || center == NULL || sum == NULL || d2 == NULL || cluster == NULL ||
+       count == NULL || tour == NULL || rank == NULL || *cell_start == NULL) {
+        mem_free(tsp, *cell_start);
+        *cell_start = NULL;
+        free_clusters(tsp, sample, center, sum, d2, cluster, count, tour, rank);
+        return no_memory(tsp);
+    }
+
+    //A random sample of the cities (all of them, for small inputs):
+    copy_array(sample, order, len);
+    for(i=0; i<n; i++) {
+        swap(i, i + rng_int(&tsp->rng, len - i), sample);
+    }
+
+    //k-means++: each center is a sampled city, picked with odds growing with
+    //the square of its distance to the nearest center already placed:
+    center[0] = tsp->city_x[sample[0]];
+    center[1] = tsp->city_y[sample[0]];
+    for(i=0; i<n; i++) {
+        d2[i] = -1;
+    }
+    for(c=1; c<k; c++) {
+        total = 0;
+        for(i=0; i<n; i++) {
+            dx = tsp->city_x[sample[i]] - center[2*(c-1)];
+            dy = tsp->city_y[sample[i]] - center[2*(c-1)+1];
+            if(d2[i] < 0 || dx*dx + dy*dy < d2[i])
+                d2[i] = dx*dx + dy*dy;
+            total += d2[i];
+        }
+        r = rng_double(&tsp->rng) * total;
+        for(i=0; i<n-1 && (r -= d2[i]) > 0; i++);
+        center[2*c] = tsp->city_x[sample[i]];
+        center[2*c+1] = tsp->city_y[sample[i]];
+    }
+
+    //Lloyd's algorithm on the sample: each center moves to the middle of the cities nearest it
+    //(a center with none stays where it is):
+    for(round=0; round<KMEANS_ROUNDS; round++) {
+        memset(sum, 0, 3 * k * sizeof(double));
+        for(i=0; i<n; i++) {
+            c = kmeans_nearest(tsp, sample[i], center, k);
+            sum[3*c] += tsp->city_x[sample[i]];
+            sum[3*c+1] += tsp->city_y[sample[i]];
+            sum[3*c+2]++;
+        }
+        for(c=0; c<k; c++) {
+            if(sum[3*c+2] > 0) {
+                center[2*c] = sum[3*c] / sum[3*c+2];
+                center[2*c+1] = sum[3*c+1] / sum[3*c+2];
+            }
+        }
+    }
+
+    //Every city joins its nearest center:
+    for(i=0; i<len; i++) {
+        cluster[i] = kmeans_nearest(tsp, order[i], center, k);
+        count[cluster[i]]++;
+    }
+
+    //Order the clusters by a tour of their centers (in center order if it can't be found):
+    for(c=0; c<k; c++) {
+        tour[c] = c;
+    }
+    tsp_default_options(&options);
+    options.algorithm = TSP_LIN_KERNIGHAN;
+    options.seed = tsp->seed;
+    centers_tsp = k > 1 ? tsp_create(&options, &tsp->alloc) : NULL;
+    if(centers_tsp != NULL) {
+        centers_tsp->parent = tsp;
+        for(c=0; c<k; c++) {
+            if(add_city(centers_tsp, c, (int)(center[2*c] + .5), (int)(center[2*c+1] + .5)) < 0)
+                break;
+        }
+        if(c == k && tsp_solve(centers_tsp) >= 0)
+            tsp_get_tour(centers_tsp, tour);
+        tsp_free(centers_tsp);
+    }
+
+    //Group the cities by cluster, in that order, leaving out the clusters with no cities:
+    cells = 0;
+    j = 0;
+    for(c=0; c<k; c++) {
+        rank[tour[c]] = j;
+        if(count[tour[c]] > 0)
+            (*cell_start)[cells++] = j;
+        j += count[tour[c]];
+    }
+    (*cell_start)[cells] = len;
+    grouped = sample;
+    for(i=0; i<len; i++) {
+        grouped[rank[cluster[i]]++] = order[i];
+    }
+    copy_array(order, grouped, len);
+
+    free_clusters(tsp, sample, center, sum, d2, cluster, count, tour, rank);
+    return cells;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Frees the working arrays of cluster_cells (any of which may be NULL)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * sample -  The sample of the cities
+ * Param:   double * center -  The centers
+ * Param:   double * sum -  The sums for Lloyd's algorithm
+ * Param:   double * d2 -  The squared distances for k-means++
+ * Param:   int * cluster -  Each city's cluster
+ * Param:   int * count -  Each cluster's number of cities
+ * Param:   int * tour -  The tour of the centers
+ * Param:   int * rank -  Each cluster's next index in order
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void free_clusters(tsp_solver * tsp, int * sample, double * center, double * sum, double * d2,
+                          int * cluster, int * count, int * tour, int * rank) {
+    mem_free(tsp, sample);
+    mem_free(tsp, center);
+    mem_free(tsp, sum);
+    mem_free(tsp, d2);
+    mem_free(tsp, cluster);
+    mem_free(tsp, count);
+    mem_free(tsp, tour);
+    mem_free(tsp, rank);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Finds the center nearest a city, for cluster_cells
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int id -  The id of the city
+ * Param:   double * center -  The x and y coordinates of each center
+ * Param:   int k -  The number of centers
+ * Return:  int -  The number of the nearest center
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int kmeans_nearest(tsp_solver * tsp, int id, double * center, int k) {
+    int c, best;
+    double dx, dy, d, best_d;
+
+    best = 0;
+    best_d = -1;
+    for(c=0; c<k; c++) {
+        dx = tsp->city_x[id] - center[2*c];
+        dy = tsp->city_y[id] - center[2*c+1];
+        d = dx*dx + dy*dy;
+        if(best_d < 0 || d < best_d) {
+            best = c;
+            best_d = d;
+        }
+    }
+    return best;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves one cell of the partition with a solver of its own: the cell's cities (with their indices
+ * in this instance as their ids) are its whole instance, solved quietly with the same algorithms,
+ * a seed of the cell's own and the cell's share of the time.  A cell that can't be solved (or isn't,
+ * once the solver is stopped) keeps its cities in order
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   partition_work * work -  The partition
+ * Param:   int c -  The cell's number
+ * Return:  void -  The cell's tour is left in work->tours
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void solve_cell(tsp_solver * tsp, partition_work * work, int c) {
+    int i, len;
+    int * cell, * tour;
+    tsp_options options;
+    tsp_solver * cell_tsp;
+
+    cell = work->order + work->cell_start[c];
+    tour = work->tours + work->cell_start[c];
+    len = work->cell_start[c+1] - work->cell_start[c];
+    copy_array(tour, cell, len);
+    if(tsp->stop_signal)
+        return;
+
+    tsp_default_options(&options);
+    options.algorithm = tsp->algorithm;
+    options.use_hilbert = tsp->use_hilbert;
+    options.num_threads = tsp->num_threads;
+    options.num_workers = 1;
+    options.seed = tsp->seed + c + 1;
+    options.time_limit = work->budget;
+    options.matrix_max_cities = tsp->matrix_max_cities;
+
+    //(The cell's solver stops when this one does):
+    cell_tsp = tsp_create(&options, &tsp->alloc);
+    if(cell_tsp != NULL) {
+        cell_tsp->parent = tsp;
+        for(i=0; i<len; i++) {
+            if(add_city(cell_tsp, cell[i], tsp->city_x[cell[i]], tsp->city_y[cell[i]]) < 0)
+                break;
+        }
+    }
+    if(cell_tsp == NULL || i < len || tsp_solve(cell_tsp) < 0)
+        fprintf(stderr, "Error: cell %d failed, using its cities in order\n", c);
+    else
+        tsp_get_tour(cell_tsp, tour);
+    tsp_free(cell_tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Joins the cells' tours into one, in cell order.  Each cell's tour is broken at the edge that
+ * makes the join from the previous cell shortest for the length of the edge removed (the first
+ * cell's at its longest edge), and walked from there in the direction that join calls for
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * tours -  The cells' tours, one after the other
+ * Param:   int * cell_start -  The index in tours of each cell's tour, followed by the number of cities
+ * Param:   int * path -  Location to store the joined tour
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void stitch_cells(tsp_solver * tsp, int * tours, int * cell_start, int * path) {
+    int c, i, j, m, u, v, dir, cost, pos, best_i, best_dir, best_cost;
+    int * t;
+
+    pos = 0;
+    for(c=0; c<tsp->num_cells; c++) {
+        t = tours + cell_start[c];
+        m = cell_start[c+1] - cell_start[c];
+
+        //Removing the edge (u, v) leaves either v (dir 0) or u (dir 1) to join to:
+        best_i = -1;
+        best_dir = 0;
+        best_cost = 0;
+        for(i=0; i<m; i++) {
+            u = t[i];
+            v = t[(i+1) % m];
+            for(dir=0; dir<2; dir++) {
+                cost = -get_distance(tsp, u, v);
+                if(pos > 0)
+                    cost += get_distance(tsp, path[pos-1], dir ? u : v);
+                if(best_i < 0 || cost < best_cost) {
+                    best_i = i;
+                    best_dir = dir;
+                    best_cost = cost;
+                }
+            }
+        }
+
+        //Walk forward from v round to u, or backward from u round to v:
+        for(j=0; j<m; j++) {
+            path[pos++] = best_dir ? t[(best_i - j + m) % m] : t[(best_i + 1 + j) % m];
+        }
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Improves the tour made by partition_tour where the cells meet, with lin_kernighan's moves
+ * (and Or-opt): the queue starts with every city of the cells on a seam, and grows from there
+ * as moves are made
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The tour to improve
+ * Param:   int len -  The length of the path
+ * Param:   int max_id -  The largest city id
+ * Return:  void -  The improved path is left at the location specified by the path pointer
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void partition_repair(tsp_solver * tsp, int * path, int len, int max_id) {
+    int i, k, a, b;
+    char * seam;
+
+    if(len < 5)
+        return;
+
+    if(tsp->verbose)
+        printf("Calculating neighbor lists...\n");
+    if(init_neighbors(tsp, path, len, max_id) < 0)
+        return;
+
+    //A cell is on a seam if the tour leaves it, or one of its cities has a near neighbor in another cell:
+    seam = mem_calloc(tsp, tsp->num_cells, sizeof(char));
+    if(seam == NULL) {
+        free_neighbors(tsp);
+        no_memory(tsp);
+        return;
+    }
+    for(i=0; i<len; i++) {
+        a = path[i];
+        b = path[(i+1) % len];
+        if(tsp->cell_of[a] != tsp->cell_of[b]) {
+            seam[tsp->cell_of[a]] = 1;
+            seam[tsp->cell_of[b]] = 1;
+        }
+        for(k=0; k<NUM_NEIGHBORS && k<len-1; k++) {
+            if(tsp->cell_of[tsp->neighbors[a*NUM_NEIGHBORS + k]] != tsp->cell_of[a]) {
+                seam[tsp->cell_of[a]] = 1;
+                break;
+            }
+        }
+    }
+    for(i=0; i<len; i++) {
+        if(seam[tsp->cell_of[path[i]]])
+            queue_push(tsp, path[i]);
+    }
+    mem_free(tsp, seam);
+    if(tsp->verbose)
+        printf("Starting from %d cities near the seams...\n", tsp->queue_len);
+
+    if(tour_init(tsp, path, len) == 0)
+        lk_improve(tsp, path, len, calc_path_dist(tsp, path, len));
+    free_neighbors(tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Compares two cities (given by index) by their x-coordinates, for qsort_r
+ * Param:   const void * a -  The first city's index
+ * Param:   const void * b -  The second city's index
+ * Param:   void * arg -  The solver
+ * Return:  int -  Negative, zero or positive as a's x is less than, equal to or greater than b's
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int compare_x(const void * a, const void * b, void * arg) {
+    tsp_solver * tsp = arg;
+    int i = tsp->city_x[*(const int *)a];
+    int j = tsp->city_x[*(const int *)b];
+
+    return (i > j) - (i < j);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Compares two cities (given by index) by their y-coordinates, for qsort_r
+ * Param:   const void * a -  The first city's index
+ * Param:   const void * b -  The second city's index
+ * Param:   void * arg -  The solver
+ * Return:  int -  Negative, zero or positive as a's y is less than, equal to or greater than b's
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int compare_y(const void * a, const void * b, void * arg) {
+    tsp_solver * tsp = arg;
+    int i = tsp->city_y[*(const int *)a];
+    int j = tsp->city_y[*(const int *)b];
+
+    return (i > j) - (i < j);
+}
+
+
+//INCREMENTAL UPDATE:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The steps of tsp_update after the instance is changed: puts the cities added into the tour left
+ * and repairs it with lk_improve.  The caller frees the k-d tree and neighbor lists
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * list -  Location to store the list of city ids
+ * Param:   int * path -  The tour left by update_cut (with room for every city)
+ * Param:   char * bridged -  Marks each position in the tour left that is followed by a joined gap
+ * Param:   int len -  The length of the tour left
+ * Param:   int first -  The first city added
+ * Param:   int dst -  The distance of the tour left
+ * Return:  int -  0, or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int update_repair(tsp_solver * tsp, int * list, int * path, char * bridged, int len, int first, int dst) {
+    int i;
+
+    //Build the k-d tree over the changed instance, and make room for the neighbor lists,
+    //which are only found as they are needed (see neighbor_list):
+    for(i=0; i<tsp->num_cities; i++) {
+        list[i] = i;
+    }
+    if(kd_build(tsp, list, tsp->num_cities, tsp->num_cities-1) < 0)
+        return -1;
+    tsp->neighbors = mem_alloc(tsp, (tsp->num_cities * NUM_NEIGHBORS + 1) * sizeof(int));
+    tsp->neighbors_found = mem_calloc(tsp, tsp->num_cities, sizeof(char));
+    if(tsp->neighbors == NULL || tsp->neighbors_found == NULL)
+        return no_memory(tsp);
+    if(init_neighbors(tsp, list, tsp->num_cities, tsp->num_cities-1) < 0)
+        return -1;
+
+    //Start from the ends of the gaps joined and the cities either side of each city added:
+    for(i=0; i<len; i++) {
+        if(bridged[i]) {
+            queue_push(tsp, path[i]);
+            queue_push(tsp, path[(i+1) % len]);
+        }
+    }
+    if(update_insert(tsp, path, len, first, &dst) < 0)
+        return -1;
+    if(tsp->verbose)
+        printf("Repairing the tour from %d cities near the changes...\n", tsp->queue_len);
+
+    if(tsp->num_cities < 5)
+        set_best(tsp, dst, path);
+    else {
+        if(tour_init(tsp, path, tsp->num_cities) < 0)
+            return -1;
+        lk_improve(tsp, path, tsp->num_cities, dst);
+    }
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Cuts the cities whose ids are to be dropped out of the best tour, joining the cities either side of
+ * each gap, and out of the instance, renumbering the cities left (in the same order)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  Location to store the tour left (as the new city indices)
+ * Param:   char * bridged -  Location to mark each position in the tour left that is followed by a joined gap
+ * Param:   int * drop -  The ids of the cities to cut out (sorted)
+ * Param:   int num_drop -  The number of ids
+ * Param:   int * dst -  The distance of the best tour.  Updated as cities are cut out
+ * Return:  int -  The length of the tour left (the number of cities left), or -1 if out of memory (nothing is cut out)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int update_cut(tsp_solver * tsp, int * path, char * bridged, int * drop, int num_drop, int * dst) {
+    int i, a, b, n, len;
+    int * index;
+    char * gone;
+
+    n = tsp->num_cities;
+    gone = mem_alloc(tsp, n + 1);
+    index = mem_alloc(tsp, (n + 1) * sizeof(int));
+    if(gone == NULL || index == NULL) {
+        mem_free(tsp, index);
+        mem_free(tsp, gone);
+        return no_memory(tsp);
+    }
+    for(i=0; i<n; i++) {
+        gone[i] = num_drop > 0 && bsearch(&tsp->city_ids[i], drop, num_drop, sizeof(int), compare_ints) != NULL;
+    }
+
+    //Only the edges to the cities cut out change, so only they are measured:
+    len = 0;
+    for(i=0; i<n; i++) {
+        a = tsp->best_path[i];
+        b = tsp->best_path[(i+1) % n];
+        if(gone[a] || gone[b])
+            *dst -= get_distance(tsp, a, b);
+        if(!gone[a]) {
+            bridged[len] = gone[b];
+            path[len++] = a;
+        }
+    }
+    for(i=0; i<len; i++) {
+        if(bridged[i])
+            *dst += get_distance(tsp, path[i], path[(i+1) % len]);
+    }
+
+    //Close up the city arrays:
+    len = 0;
+    for(i=0; i<n; i++) {
+        if(gone[i])
+            continue;
+        index[i] = len;
+        tsp->city_ids[len] = tsp->city_ids[i];
+        tsp->city_x[len] = tsp->city_x[i];
+        tsp->city_y[len] = tsp->city_y[i];
+        len++;
+    }
+    tsp->num_cities = len;
+    for(i=0; i<len; i++) {
+        path[i] = index[path[i]];
+    }
+
+    mem_free(tsp, index);
+    mem_free(tsp, gone);
+    return len;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Puts each city added into the tour where it lengthens it least (cheapest insertion): next to one of its
+ * nearest neighbors already in the tour, on either side.  If none of them is in the tour yet, every edge
+ * of the tour is tried.  The cities added and those either side of each are queued for lk_improve
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The tour.  At completion, contains the tour of all of the cities
+ * Param:   int len -  The length of the tour
+ * Param:   int first -  The first city added (the cities from it to the last are added)
+ * Param:   int * dst -  The distance of the tour.  Updated as cities are put in
+ * Return:  int -  0, or -1 if out of memory (the tour is left as it was)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int update_insert(tsp_solver * tsp, int * path, int len, int first, int * dst) {
+    int i, j, k, n, q, a, c, start, best, cost, best_cost;
+    int * next, * prev, * neighbors;
+    char * in_tour;
+
+    n = tsp->num_cities;
+    if(first >= n)
+        return 0;
+
+    //The tour as a doubly linked list, which cities can be put into anywhere:
+    next = mem_alloc(tsp, n * sizeof(int));
+    prev = mem_alloc(tsp, n * sizeof(int));
+    in_tour = mem_calloc(tsp, n, sizeof(char));
+    if(next == NULL || prev == NULL || in_tour == NULL) {
+        mem_free(tsp, in_tour);
+        mem_free(tsp, prev);
+        mem_free(tsp, next);
+        return no_memory(tsp);
+    }
+    for(i=0; i<len; i++) {
+        next[path[i]] = path[(i+1) % len];
+        prev[path[(i+1) % len]] = path[i];
+        in_tour[path[i]] = 1;
+    }
+    start = len > 0 ? path[0] : first;
+
+    for(q=first; q<n; q++) {
+        //The first city into an empty tour is a tour by itself:
+        if(len == 0) {
+            next[q] = prev[q] = q;
+            in_tour[q] = 1;
+            len = 1;
+            queue_push(tsp, q);
+            continue;
+        }
+
+        //Try the edges on either side of each neighbor in the tour (putting q after best):
+        best = -1;
+        best_cost = 0;
+        neighbors = neighbor_list(tsp, q);
+        for(k=0; k<NUM_NEIGHBORS && k<n-1; k++) {
+            c = neighbors[k];
+            if(!in_tour[c])
+                continue;
+            for(j=0; j<2; j++) {
+                a = j ? c : prev[c];
+                cost = get_distance(tsp, a, q) + get_distance(tsp, q, next[a]) - get_distance(tsp, a, next[a]);
+                if(best < 0 || cost < best_cost) {
+                    best = a;
+                    best_cost = cost;
+                }
+            }
+        }
+        if(best < 0) {
+            for(a=0; a<n; a++) {
+                if(!in_tour[a])
+                    continue;
+                cost = get_distance(tsp, a, q) + get_distance(tsp, q, next[a]) - get_distance(tsp, a, next[a]);
+                if(best < 0 || cost < best_cost) {
+                    best = a;
+                    best_cost = cost;
+                }
+            }
+        }
+
+        c = next[best];
+        next[best] = q;
+        prev[q] = best;
+        next[q] = c;
+        prev[c] = q;
+        in_tour[q] = 1;
+        len++;
+        *dst += best_cost;
+        queue_push(tsp, best);
+        queue_push(tsp, q);
+        queue_push(tsp, c);
+    }
+
+    for(i=0, c=start; i<n; i++, c=next[c]) {
+        path[i] = c;
+    }
+
+    mem_free(tsp, in_tour);
+    mem_free(tsp, prev);
+    mem_free(tsp, next);
+    return 0;
+}
+
+
+
+
+//TOUR OPERATIONS:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Sets up the tour that the tour operations work on from a path, in an array for small tours
+ * or a two-level list for large ones.  The first city of the path becomes the tour's head
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  The path (used directly for small tours; the tour operations may change it until tour_free)
+ * Param:   int len -  The length of the path
+ * Return:  int -  0, or -1 if out of memory (nothing is left allocated)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int tour_init(tsp_solver * tsp, int * path, int len) {
+    int i, max_id;
+
+    tsp->tour_path = path;
+    tsp->tour_len = len;
+    tsp->tour_head = path[0];
+
+    max_id = path[0];
+    for(i=1; i<len; i++) {
+        if(path[i] > max_id)
+            max_id = path[i];
+    }
+
+    tsp->two_level = (len >= TWO_LEVEL_MIN_CITIES);
+    if(tsp->two_level) {
+        tsp->nodes = mem_alloc(tsp, (max_id+1) * sizeof(tour_node));
+        tsp->max_segments = 3 * (int)sqrt(len) + 3;
+        tsp->segments = mem_alloc(tsp, tsp->max_segments * sizeof(tour_segment));
+        tsp->seg_scratch = mem_alloc(tsp, tsp->max_segments * sizeof(int));
+        if(tsp->nodes == NULL || tsp->segments == NULL || tsp->seg_scratch == NULL) {
+            tour_free(tsp);
+            return no_memory(tsp);
+        }
+        tour_build_segments(tsp);
+    }
+    else {
+        tsp->position = mem_alloc(tsp, (max_id+1) * sizeof(int));
+        if(tsp->position == NULL)
+            return no_memory(tsp);
+        for(i=0; i<len; i++) {
+            tsp->position[path[i]] = i;
+        }
+    }
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes out the cities of the tour in order (starting from the head, for two-level lists)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  Location to store the path
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_get_path(tsp_solver * tsp, int * path) {
+    int i, c;
+
+    if(!tsp->two_level) {
+        if(path != tsp->tour_path)
+            copy_array(path, tsp->tour_path, tsp->tour_len);
+        return;
+    }
+
+    c = tsp->tour_head;
+    for(i=0; i<tsp->tour_len; i++) {
+        path[i] = c;
+        c = tour_next(tsp, c);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Frees the tables allocated by tour_init
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_free(tsp_solver * tsp) {
+    mem_free(tsp, tsp->tour_log);
+    tsp->tour_log = NULL;
+    tsp->tour_log_size = 0;
+    tsp->tour_logging = 0;
+
+    if(tsp->two_level) {
+        mem_free(tsp, tsp->nodes);
+        mem_free(tsp, tsp->segments);
+        mem_free(tsp, tsp->seg_scratch);
+        tsp->nodes = NULL;
+        tsp->segments = NULL;
+        tsp->seg_scratch = NULL;
+    }
+    else {
+        mem_free(tsp, tsp->position);
+        tsp->position = NULL;
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Returns the city after the specified city in the tour
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The id of the city
+ * Return:  int -  The id of the next city
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int tour_next(tsp_solver * tsp, int a) {
+    int i;
+
+    if(tsp->two_level)
+        return tsp->segments[tsp->nodes[a].parent].reversed ? tsp->nodes[a].prev : tsp->nodes[a].next;
+
+    i = tsp->position[a] + 1;
+    return tsp->tour_path[i == tsp->tour_len ? 0 : i];
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Returns the city before the specified city in the tour
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The id of the city
+ * Return:  int -  The id of the previous city
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int tour_prev(tsp_solver * tsp, int a) {
+    int i;
+
+    if(tsp->two_level)
+        return tsp->segments[tsp->nodes[a].parent].reversed ? tsp->nodes[a].next : tsp->nodes[a].prev;
+
+    i = tsp->position[a];
+    return tsp->tour_path[i == 0 ? tsp->tour_len-1 : i-1];
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Checks whether city b is reached on the way from city a forward to city c (inclusive)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The id of the first city
+ * Param:   int b -  The id of the city to check
+ * Param:   int c -  The id of the last city
+ * Return:  int -  1 if b is between a and c, 0 if not
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int tour_between(tsp_solver * tsp, int a, int b, int c) {
+    long ka, kb, kc;
+
+    ka = tour_key(tsp, a);
+    kb = tour_key(tsp, b);
+    kc = tour_key(tsp, c);
+    if(ka <= kc)
+        return ka <= kb && kb <= kc;
+    else
+        return kb >= ka || kb <= kc;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Returns a number that increases going forward around the tour (from some starting point, which may
+ * change whenever the tour changes).  Used to compare the order of cities
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The id of the city
+ * Return:  long -  The city's key
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static long tour_key(tsp_solver * tsp, int a) {
+    tour_segment * seg;
+
+    if(!tsp->two_level)
+        return tsp->position[a];
+
+    seg = &tsp->segments[tsp->nodes[a].parent];
+    return (long)seg->rank * (tsp->tour_len+1) + (seg->reversed ? tsp->tour_len - tsp->nodes[a].seq : tsp->nodes[a].seq);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Returns the city at the specified position in the tour, counting forward from the head
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int i -  The position
+ * Return:  int -  The id of the city at that position
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int tour_city_at(tsp_solver * tsp, int i) {
+    int s, c;
+    tour_segment * seg;
+
+    if(!tsp->two_level)
+        return tsp->tour_path[(tsp->position[tsp->tour_head] + i) % tsp->tour_len];
+
+    //Count from the start of the head's segment, skipping whole segments:
+    s = tsp->nodes[tsp->tour_head].parent;
+    seg = &tsp->segments[s];
+    i += seg->reversed ? tsp->nodes[seg->last].seq - tsp->nodes[tsp->tour_head].seq : tsp->nodes[tsp->tour_head].seq - tsp->nodes[seg->first].seq;
+    while(i >= seg->size) {
+        i -= seg->size;
+        s = seg->next;
+        seg = &tsp->segments[s];
+    }
+
+    c = seg->reversed ? seg->last : seg->first;
+    while(i-- > 0) {
+        c = tour_next(tsp, c);
+    }
+    return c;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reverses the section of the tour from city b forward to city c, leaving the rest of the tour in place
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int b -  The id of the first city of the section to reverse
+ * Param:   int c -  The id of the last city of the section to reverse
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_flip(tsp_solver * tsp, int b, int c) {
+    if(tsp->two_level)
+        tour_flip_segments(tsp, b, c);
+    else
+        tour_reverse(tsp, tsp->position[b], tsp->position[c]);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Performs a 2-opt move: replaces the edges (a, b) and (c, d) with (a, c) and (b, d), where b follows a in the
+ * same direction that d follows c.  Whichever of the two sections of the tour is cheaper to reverse gets reversed
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The id of the first city of the first edge
+ * Param:   int b -  The id of the second city of the first edge
+ * Param:   int c -  The id of the first city of the second edge
+ * Param:   int d -  The id of the second city of the second edge
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_move(tsp_solver * tsp, int a, int b, int c, int d) {
+    int tmp, * grown;
+
+    //The move that undoes this one replaces edges (a, c) and (b, d) with (a, b) and (c, d).
+    //If the log cannot grow, the moves can no longer be undone, so it is dropped (and the solver stops):
+    if(tsp->tour_logging && tsp->tour_log_len + 4 > tsp->tour_log_size) {
+        grown = mem_realloc(tsp, tsp->tour_log, tsp->tour_log_size * sizeof(int),
+                            (tsp->tour_log_size ? tsp->tour_log_size*2 : 64) * sizeof(int));
+        if(grown == NULL) {
+            no_memory(tsp);
+            tsp->tour_log_len = 0;
+            tsp->tour_logging = 0;
+        }
+        else {
+            tsp->tour_log = grown;
+            tsp->tour_log_size = tsp->tour_log_size ? tsp->tour_log_size*2 : 64;
+        }
+    }
+    if(tsp->tour_logging) {
+        tsp->tour_log[tsp->tour_log_len++] = a;
+        tsp->tour_log[tsp->tour_log_len++] = c;
+        tsp->tour_log[tsp->tour_log_len++] = b;
+        tsp->tour_log[tsp->tour_log_len++] = d;
+    }
+
+    //Orient the move forward: b..c is to be reversed, or equivalently d..a:
+    if(tour_next(tsp, a) != b) {
+        tmp = a;
+        a = b;
+        b = tmp;
+        tmp = c;
+        c = d;
+        d = tmp;
+    }
+
+    if(tour_span(tsp, b, c) <= tour_span(tsp, d, a))
+        tour_flip(tsp, b, c);
+    else
+        tour_flip(tsp, d, a);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Returns the cost of reversing the section of the tour from city b forward to city c:
+ * the number of cities in it for an array, or of segments for a two-level list
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int b -  The id of the first city of the section
+ * Param:   int c -  The id of the last city of the section
+ * Return:  int -  The cost
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int tour_span(tsp_solver * tsp, int b, int c) {
+    int span;
+
+    if(tsp->two_level) {
+        span = tsp->segments[tsp->nodes[c].parent].rank - tsp->segments[tsp->nodes[b].parent].rank;
+        if(span < 0 || (span == 0 && tour_key(tsp, c) < tour_key(tsp, b)))
+            span += tsp->num_segments;
+    }
+    else {
+        span = tsp->position[c] - tsp->position[b];
+        if(span < 0)
+            span += tsp->tour_len;
+    }
+    return span + 1;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reverses the section of the tour array from index i forward to index j, wrapping around the end if needed
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int i -  The first index of the section to reverse
+ * Param:   int j -  The last index of the section to reverse
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_reverse(tsp_solver * tsp, int i, int j) {
+    int k, len;
+
+    len = j - i;
+    if(len < 0)
+        len += tsp->tour_len;
+
+    for(k=0; k<(len+1)/2; k++) {
+        swap(i, j, tsp->tour_path);
+        tsp->position[tsp->tour_path[i]] = i;
+        tsp->position[tsp->tour_path[j]] = j;
+        if(++i == tsp->tour_len)
+            i = 0;
+        if(--j < 0)
+            j = tsp->tour_len - 1;
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * (Re)builds the two-level list from tour_path, with segments of about sqrt(n) cities in path order
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_build_segments(tsp_solver * tsp) {
+    int i, s, size, len;
+    tour_node * node;
+
+    len = tsp->tour_len;
+    size = (int)sqrt(len);
+    tsp->num_segments = (len + size - 1) / size;
+
+    for(i=0; i<len; i++) {
+        node = &tsp->nodes[tsp->tour_path[i]];
+        node->next = tsp->tour_path[i == len-1 ? 0 : i+1];
+        node->prev = tsp->tour_path[i == 0 ? len-1 : i-1];
+        node->seq = i;
+        node->parent = i / size;
+    }
+
+    for(s=0; s<tsp->num_segments; s++) {
+        tsp->segments[s].first = tsp->tour_path[s*size];
+        tsp->segments[s].last = tsp->tour_path[(s+1)*size < len ? (s+1)*size - 1 : len-1];
+        tsp->segments[s].size = (s+1)*size < len ? size : len - s*size;
+        tsp->segments[s].reversed = 0;
+        tsp->segments[s].next = (s+1) % tsp->num_segments;
+        tsp->segments[s].prev = (s+tsp->num_segments-1) % tsp->num_segments;
+        tsp->segments[s].rank = s;
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Splits a city's segment so that the city is the first one reached going forward through its segment.
+ * The smaller part is moved to a new segment; the cities keep their links and sequence numbers
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int x -  The id of the city
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_split(tsp_solver * tsp, int x) {
+    int i, s, t, c, before, count;
+    tour_segment * seg;
+    tour_segment * split;
+
+    s = tsp->nodes[x].parent;
+    seg = &tsp->segments[s];
+    if(x == (seg->reversed ? seg->last : seg->first))
+        return;
+
+    //The number of cities before x going forward through the segment:
+    before = seg->reversed ? tsp->nodes[seg->last].seq - tsp->nodes[x].seq : tsp->nodes[x].seq - tsp->nodes[seg->first].seq;
+
+    t = tsp->num_segments++;
+    split = &tsp->segments[t];
+    split->reversed = seg->reversed;
+
+    //Move x and everything after it into a new segment following this one:
+    if(seg->size - before <= before) {
+        count = seg->size - before;
+        c = x;
+        if(seg->reversed) {
+            split->first = seg->first;
+            split->last = x;
+            seg->first = tsp->nodes[x].next;
+        }
+        else {
+            split->first = x;
+            split->last = seg->last;
+            seg->last = tsp->nodes[x].prev;
+        }
+        split->prev = s;
+        split->next = seg->next;
+        tsp->segments[seg->next].prev = t;
+        seg->next = t;
+    }
+
+    //Or everything before x into a new segment preceding this one:
+    else {
+        count = before;
+        c = seg->reversed ? seg->last : seg->first;
+        if(seg->reversed) {
+            split->first = tsp->nodes[x].next;
+            split->last = seg->last;
+            seg->last = x;
+        }
+        else {
+            split->first = seg->first;
+            split->last = tsp->nodes[x].prev;
+            seg->first = x;
+        }
+        split->next = s;
+        split->prev = seg->prev;
+        tsp->segments[seg->prev].next = t;
+        seg->prev = t;
+    }
+
+    for(i=0; i<count; i++) {
+        tsp->nodes[c].parent = t;
+        c = tour_next(tsp, c);
+    }
+    split->size = count;
+    seg->size -= count;
+
+    //Renumber the segments:
+    i = 0;
+    s = t;
+    do {
+        tsp->segments[s].rank = i++;
+        s = tsp->segments[s].next;
+    } while(s != t);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reverses the section of a two-level list from city b forward to city c: splits segments so the section
+ * is made of whole segments, then reverses the order of those segments and flips their direction
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int b -  The id of the first city of the section to reverse
+ * Param:   int c -  The id of the last city of the section to reverse
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_flip_segments(tsp_solver * tsp, int b, int c) {
+    int i, k, a, d, p, n, s, rank, tmp;
+
+    a = tour_prev(tsp, b);
+    d = tour_next(tsp, c);
+    if(a == c)
+        return;
+
+    //Every flip can add two segments, so start over from the path once there are too many:
+    if(tsp->num_segments + 2 > tsp->max_segments) {
+        tour_get_path(tsp, tsp->tour_path);
+        tour_build_segments(tsp);
+    }
+
+    tour_split(tsp, b);
+    tour_split(tsp, d);
+
+    //Collect the segments making up the section:
+    k = 0;
+    s = tsp->nodes[b].parent;
+    while(1) {
+        tsp->seg_scratch[k++] = s;
+        if(s == tsp->nodes[c].parent)
+            break;
+        s = tsp->segments[s].next;
+    }
+    p = tsp->segments[tsp->seg_scratch[0]].prev;
+    n = tsp->segments[tsp->seg_scratch[k-1]].next;
+    rank = tsp->segments[tsp->seg_scratch[0]].rank;
+
+    //Reverse their order and direction, keeping the same ranks:
+    for(i=0; i<k; i++) {
+        s = tsp->seg_scratch[i];
+        tsp->segments[s].reversed = !tsp->segments[s].reversed;
+        tmp = tsp->segments[s].next;
+        tsp->segments[s].next = tsp->segments[s].prev;
+        tsp->segments[s].prev = tmp;
+        tsp->segments[s].rank = (rank + k-1-i) % tsp->num_segments;
+    }
+    tsp->segments[tsp->seg_scratch[0]].next = n;
+    tsp->segments[tsp->seg_scratch[k-1]].prev = p;
+    tsp->segments[p].next = tsp->seg_scratch[k-1];
+    tsp->segments[n].prev = tsp->seg_scratch[0];
+
+    //Reconnect the cities at the ends of the section:
+    tour_set_next(tsp, a, c);
+    tour_set_prev(tsp, c, a);
+    tour_set_next(tsp, b, d);
+    tour_set_prev(tsp, d, b);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Sets the city after city a in a two-level list (without changing anything else)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The id of the city
+ * Param:   int b -  The id of the city to follow it
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_set_next(tsp_solver * tsp, int a, int b) {
+    if(tsp->segments[tsp->nodes[a].parent].reversed)
+        tsp->nodes[a].prev = b;
+    else
+        tsp->nodes[a].next = b;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Sets the city before city a in a two-level list (without changing anything else)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int a -  The id of the city
+ * Param:   int b -  The id of the city to precede it
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_set_prev(tsp_solver * tsp, int a, int b) {
+    if(tsp->segments[tsp->nodes[a].parent].reversed)
+        tsp->nodes[a].next = b;
+    else
+        tsp->nodes[a].prev = b;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Empties the log of tour_moves, and starts logging them if not already
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_log_clear(tsp_solver * tsp) {
+    tsp->tour_log_len = 0;
+    tsp->tour_logging = 1;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Undoes every tour_move logged since tour_log_clear(), latest first, and empties the log
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void tour_log_undo(tsp_solver * tsp) {
+    int * m;
+
+    tsp->tour_logging = 0;
+    while(tsp->tour_log_len > 0) {
+        tsp->tour_log_len -= 4;
+        m = &tsp->tour_log[tsp->tour_log_len];
+        tour_move(tsp, m[0], m[1], m[2], m[3]);
+    }
+    tsp->tour_logging = 1;
+}
+
+
+//SPATIAL INDEX (K-D TREE):
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Builds the k-d tree over the coordinates of the given cities
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * list -  The list of city ids
+ * Param:   int len -  The number of cities
+ * Param:   int max_id -  The max id of all cities
+ * Return:  int -  0, or -1 if out of memory (nothing is left allocated)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int kd_build(tsp_solver * tsp, int * list, int len, int max_id) {
+    int i;
+
+    tsp->kd_size = len;
+    tsp->kd_ids = mem_alloc(tsp, len * sizeof(int));
+    tsp->kd_dim = mem_alloc(tsp, len * sizeof(char));
+    tsp->kd_alive = mem_alloc(tsp, len * sizeof(int));
+    tsp->kd_removed = mem_calloc(tsp, len, sizeof(char));
+    tsp->kd_slot = mem_alloc(tsp, (max_id+1) * sizeof(int));
+    if(tsp->kd_ids == NULL || tsp->kd_dim == NULL || tsp->kd_alive == NULL ||
+       tsp->kd_removed == NULL || tsp->kd_slot == NULL) {
+        kd_free(tsp);
+        return no_memory(tsp);
+    }
+
+    copy_array(tsp->kd_ids, list, len);
+    kd_build_range(tsp, 0, len);
+
+    for(i=0; i<len; i++) {
+        tsp->kd_slot[tsp->kd_ids[i]] = i;
+    }
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Recursively orders a range of the k-d tree so that its middle element splits it along its widest dimension
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int lo -  The first index of the range
+ * Param:   int hi -  One past the last index of the range
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void kd_build_range(tsp_solver * tsp, int lo, int hi) {
+    int i, mid, min_x, max_x, min_y, max_y;
+
+    if(lo >= hi)
+        return;
+
+    min_x = max_x = tsp->city_x[tsp->kd_ids[lo]];
+    min_y = max_y = tsp->city_y[tsp->kd_ids[lo]];
+    for(i=lo+1; i<hi; i++) {
+        if(tsp->city_x[tsp->kd_ids[i]] < min_x) min_x = tsp->city_x[tsp->kd_ids[i]];
+        if(tsp->city_x[tsp->kd_ids[i]] > max_x) max_x = tsp->city_x[tsp->kd_ids[i]];
+        if(tsp->city_y[tsp->kd_ids[i]] < min_y) min_y = tsp->city_y[tsp->kd_ids[i]];
+        if(tsp->city_y[tsp->kd_ids[i]] > max_y) max_y = tsp->city_y[tsp->kd_ids[i]];
+    }
+
+    mid = (lo + hi) / 2;
+    tsp->kd_dim[mid] = ((double)max_y - min_y > (double)max_x - min_x);
+    tsp->kd_alive[mid] = hi - lo;
+    kd_select(tsp, lo, hi, mid, tsp->kd_dim[mid]);
+
+    kd_build_range(tsp, lo, mid);
+    kd_build_range(tsp, mid+1, hi);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Partially sorts a range of the k-d tree (quickselect) so that the nth element is in its sorted position,
+ * with no greater coordinates before it and no lesser coordinates after it
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int lo -  The first index of the range
+ * Param:   int hi -  One past the last index of the range
+ * Param:   int nth -  The index to put in sorted position
+ * Param:   int dim -  The dimension to compare (0 for x, 1 for y)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void kd_select(tsp_solver * tsp, int lo, int hi, int nth, int dim) {
+    int i, j, pivot;
+    int * coord;
+
+    coord = dim ? tsp->city_y : tsp->city_x;
+    hi--;
+    while(lo < hi) {
+        pivot = coord[tsp->kd_ids[(lo + hi) / 2]];
+        i = lo;
+        j = hi;
+        while(i <= j) {
+            while(coord[tsp->kd_ids[i]] < pivot)
+                i++;
+            while(coord[tsp->kd_ids[j]] > pivot)
+                j--;
+            if(i <= j)
+                swap(i++, j--, tsp->kd_ids);
+        }
+        if(nth <= j)
+            hi = j;
+        else if(nth >= i)
+            lo = i;
+        else
+            return;
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Removes a city from the k-d tree, so that it is no longer returned by kd_nearest
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int id -  The id of the city to remove
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void kd_remove(tsp_solver * tsp, int id) {
+    int lo, hi, mid, slot;
+
+    slot = tsp->kd_slot[id];
+    if(tsp->kd_removed[slot])
+        return;
+    tsp->kd_removed[slot] = 1;
+
+    lo = 0;
+    hi = tsp->kd_size;
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        tsp->kd_alive[mid]--;
+        if(slot == mid)
+            break;
+        else if(slot < mid)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Puts every removed city back into the k-d tree
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void kd_restore(tsp_solver * tsp) {
+    memset(tsp->kd_removed, 0, tsp->kd_size * sizeof(char));
+    kd_restore_range(tsp, 0, tsp->kd_size);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Recursively resets the counts of cities not removed for a range of the k-d tree
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int lo -  The first index of the range
+ * Param:   int hi -  One past the last index of the range
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void kd_restore_range(tsp_solver * tsp, int lo, int hi) {
+    int mid;
+
+    if(lo >= hi)
+        return;
+    mid = (lo + hi) / 2;
+    tsp->kd_alive[mid] = hi - lo;
+    kd_restore_range(tsp, lo, mid);
+    kd_restore_range(tsp, mid+1, hi);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Finds the k cities in the k-d tree that are closest to the specified city (not including the city itself)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int id -  The id of the city to search around
+ * Param:   int k -  The number of cities to find
+ * Param:   int * found -  Location to store the ids of the cities found, sorted from closest to farthest
+ * Return:  int -  The number of cities found (less than k if fewer than k cities remain in the tree)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int kd_nearest(tsp_solver * tsp, int id, int k, int * found) {
+    int num;
+    double found_dst[k];
+
+    num = 0;
+    kd_search(tsp, 0, tsp->kd_size, tsp->city_x[id], tsp->city_y[id], id, k, found, found_dst, &num);
+    return num;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Recursively searches a range of the k-d tree for the cities closest to a point,
+ * skipping subtrees with no cities left and subtrees too far away to improve on those already found
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int lo -  The first index of the range
+ * Param:   int hi -  One past the last index of the range
+ * Param:   double x -  The x coordinate of the point
+ * Param:   double y -  The y coordinate of the point
+ * Param:   int exclude -  The id of a city to skip
+ * Param:   int k -  The number of cities to find
+ * Param:   int * found -  The ids of the cities found so far, sorted from closest to farthest
+ * Param:   double * found_dst -  The squared distances to the cities found so far
+ * Param:   int * num -  The number of cities found so far
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void kd_search(tsp_solver * tsp, int lo, int hi, double x, double y, int exclude, int k, int * found, double * found_dst, int * num) {
+    int i, mid, id;
+    double dx, dy, dst, diff;
+
+    if(lo >= hi)
+        return;
+    mid = (lo + hi) / 2;
+    if(tsp->kd_alive[mid] == 0)
+        return;
+
+    //Consider the city that splits this range:
+    id = tsp->kd_ids[mid];
+    dx = x - tsp->city_x[id];
+    dy = y - tsp->city_y[id];
+    if(!tsp->kd_removed[mid] && id != exclude) {
+        dst = dx*dx + dy*dy;
+        if(*num < k || dst < found_dst[*num-1]) {
+            if(*num < k)
+                (*num)++;
+            for(i=*num-1; i>0 && dst < found_dst[i-1]; i--) {
+                found[i] = found[i-1];
+                found_dst[i] = found_dst[i-1];
+            }
+            found[i] = id;
+            found_dst[i] = dst;
+        }
+    }
+
+    //Search the side of the split containing the point first,
+    //then the other side only if it could hold something closer:
+    diff = tsp->kd_dim[mid] ? dy : dx;
+    if(diff < 0) {
+        kd_search(tsp, lo, mid, x, y, exclude, k, found, found_dst, num);
+        if(*num < k || diff*diff < found_dst[*num-1])
+            kd_search(tsp, mid+1, hi, x, y, exclude, k, found, found_dst, num);
+    }
+    else {
+        kd_search(tsp, mid+1, hi, x, y, exclude, k, found, found_dst, num);
+        if(*num < k || diff*diff < found_dst[*num-1])
+            kd_search(tsp, lo, mid, x, y, exclude, k, found, found_dst, num);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Frees the k-d tree allocated by kd_build
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void kd_free(tsp_solver * tsp) {
+    mem_free(tsp, tsp->kd_ids);
+    mem_free(tsp, tsp->kd_dim);
+    mem_free(tsp, tsp->kd_alive);
+    mem_free(tsp, tsp->kd_removed);
+    mem_free(tsp, tsp->kd_slot);
+    tsp->kd_ids = tsp->kd_alive = tsp->kd_slot = NULL;
+    tsp->kd_dim = tsp->kd_removed = NULL;
+}
+
+
+//MEMORY:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Allocates memory from the solver's allocator
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   size_t size -  The number of bytes
+ * Return:  void * -  The memory, or NULL if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void * mem_alloc(tsp_solver * tsp, size_t size) {
+    return tsp->alloc.alloc(tsp->alloc.data, size);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Allocates zeroed memory for an array from the solver's allocator
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   size_t num -  The number of elements
+ * Param:   size_t size -  The size of each element
+ * Return:  void * -  The memory, or NULL if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void * mem_calloc(tsp_solver * tsp, size_t num, size_t size) {
+    void * p;
+
+    p = tsp->alloc.alloc(tsp->alloc.data, num * size);
+    if(p != NULL)
+        memset(p, 0, num * size);
+    return p;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Resizes memory from the solver's allocator (as realloc)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   void * ptr -  The memory (or NULL)
+ * Param:   size_t old_size -  Its size
+ * Param:   size_t size -  The new size
+ * Return:  void * -  The resized memory, or NULL if out of memory (ptr is left as it was)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void * mem_realloc(tsp_solver * tsp, void * ptr, size_t old_size, size_t size) {
+    return tsp->alloc.realloc(tsp->alloc.data, ptr, old_size, size);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gives memory back to the solver's allocator
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   void * ptr -  The memory (or NULL, for nothing)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void mem_free(tsp_solver * tsp, void * ptr) {
+    if(ptr != NULL)
+        tsp->alloc.free(tsp->alloc.data, ptr);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Records that an allocation failed: the algorithms stop (see should_stop) and
+ * tsp_solve and tsp_update return -1
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  -1, for the caller to return
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int no_memory(tsp_solver * tsp) {
+    if(!tsp->out_of_memory)
+        fprintf(stderr, "Error: out of memory\n");
+    tsp->out_of_memory = 1;
+    return -1;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The default allocator's alloc: malloc
+ * Param:   void * data -  Unused
+ * Param:   size_t size -  The number of bytes
+ * Return:  void * -  The memory, or NULL if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void * std_alloc(void * data, size_t size) {
+    return malloc(size);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The default allocator's realloc: realloc
+ * Param:   void * data -  Unused
+ * Param:   void * ptr -  The memory (or NULL)
+ * Param:   size_t old_size -  Its size (unused)
+ * Param:   size_t size -  The new size
+ * Return:  void * -  The resized memory, or NULL if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void * std_realloc(void * data, void * ptr, size_t old_size, size_t size) {
+    return realloc(ptr, size);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The default allocator's free: free
+ * Param:   void * data -  Unused
+ * Param:   void * ptr -  The memory
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void std_free(void * data, void * ptr) {
+    free(ptr);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Creates an arena: memory that solvers allocate from (see tsp_arena_allocator) with no
+ * more than a pointer bump, and that is all given back at once by tsp_arena_reset
+ * Param:   size_t size -  The size of its first block (it grows as needed), or 0 for the smallest
+ * Return:  tsp_arena * -  The arena, or NULL if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+tsp_arena * tsp_arena_create(size_t size) {
+    tsp_arena * arena;
+
+    arena = malloc(sizeof(tsp_arena));
+    if(arena == NULL)
+        return NULL;
+    arena->blocks = NULL;
+    arena->total = 0;
+    arena->last = 0;
+    pthread_mutex_init(&arena->lock, NULL);
+    if(arena_grow(arena, size) == NULL) {
+        tsp_arena_free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets an allocator (for tsp_create) that allocates from an arena.  Its free only gives
+ * back the latest allocation; anything else stays in use until the arena is reset
+ * Param:   tsp_arena * arena -  The arena
+ * Param:   tsp_allocator * allocator -  Location to store the allocator
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void tsp_arena_allocator(tsp_arena * arena, tsp_allocator * allocator) {
+    allocator->alloc = arena_alloc;
+    allocator->realloc = arena_realloc;
+    allocator->free = arena_free;
+    allocator->data = arena;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gives back everything allocated from an arena, once the solvers using it are freed.
+ * If it had to grow, its blocks are replaced by one as big as all of them, so that
+ * the next solves of the same size allocate from a single block
+ * Param:   tsp_arena * arena -  The arena
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void tsp_arena_reset(tsp_arena * arena) {
+    arena_block * block, * next;
+    size_t total = arena->total;
+
+    if(arena->blocks != NULL && arena->blocks->next != NULL) {
+        for(block=arena->blocks; block!=NULL; block=next) {
+            next = block->next;
+            free(block);
+        }
+        arena->blocks = NULL;
+        arena->total = 0;
+        if(arena_grow(arena, total) != NULL)
+            return;
+    }
+    if(arena->blocks != NULL)
+        arena->blocks->used = 0;
+    arena->last = 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Frees an arena and all of its memory
+ * Param:   tsp_arena * arena -  The arena (may be NULL)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void tsp_arena_free(tsp_arena * arena) {
+    arena_block * block, * next;
+
+    if(arena == NULL)
+        return;
+    for(block=arena->blocks; block!=NULL; block=next) {
+        next = block->next;
+        free(block);
+    }
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Adds a new block to an arena (which becomes the one allocated from): at least twice
+ * the size of the last one, and room for at least size bytes
+ * Param:   tsp_arena * arena -  The arena
+ * Param:   size_t size -  The number of bytes needed
+ * Return:  arena_block * -  The new block, or NULL if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static arena_block * arena_grow(tsp_arena * arena, size_t size) {
+    arena_block * block;
+    size_t block_size = ARENA_MIN_BLOCK;
+
+    if(arena->blocks != NULL && 2 * arena->blocks->size > block_size)
+        block_size = 2 * arena->blocks->size;
+    if(size + ARENA_ALIGN > block_size)
+        block_size = size + ARENA_ALIGN;
+    block_size = (block_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    //The header takes up the first ARENA_ALIGN bytes, keeping the rest aligned:
+    block = aligned_alloc(ARENA_ALIGN, ARENA_ALIGN + block_size);
+    if(block == NULL)
+        return NULL;
+    block->next = arena->blocks;
+    block->size = block_size;
+    block->used = 0;
+    arena->blocks = block;
+    arena->total += block_size;
+    arena->last = 0;
+    return block;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The arena allocator's alloc: hands out the next size bytes of the newest block
+ * (adding a block if it is full)
+ * Param:   void * data -  The arena
+ * Param:   size_t size -  The number of bytes
+ * Return:  void * -  The memory, or NULL if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void * arena_alloc(void * data, size_t size) {
+    tsp_arena * arena = data;
+    arena_block * block;
+    void * ptr = NULL;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    pthread_mutex_lock(&arena->lock);
+    block = arena->blocks;
+    if(block == NULL || block->used + size > block->size)
+        block = arena_grow(arena, size);
+    if(block != NULL) {
+        arena->last = block->used;
+        ptr = (char *)block + ARENA_ALIGN + block->used;
+        block->used += size;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The arena allocator's realloc: grows (or shrinks) the latest allocation in place if
+ * there is room, and otherwise copies to a new allocation (leaving the old one in use)
+ * Param:   void * data -  The arena
+ * Param:   void * ptr -  The memory (or NULL)
+ * Param:   size_t old_size -  Its size
+ * Param:   size_t size -  The new size
+ * Return:  void * -  The resized memory, or NULL if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void * arena_realloc(void * data, void * ptr, size_t old_size, size_t size) {
+    tsp_arena * arena = data;
+    arena_block * block;
+    size_t aligned;
+    void * grown;
+
+    if(ptr == NULL)
+        return arena_alloc(data, size);
+
+    aligned = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    pthread_mutex_lock(&arena->lock);
+    block = arena->blocks;
+    if(ptr == (char *)block + ARENA_ALIGN + arena->last && arena->last + aligned <= block->size) {
+        block->used = arena->last + aligned;
+        pthread_mutex_unlock(&arena->lock);
+        return ptr;
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    grown = arena_alloc(data, size);
+    if(grown != NULL)
+        memcpy(grown, ptr, old_size < size ? old_size : size);
+    return grown;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The arena allocator's free: gives back the latest allocation (as tsp_solve does with
+ * its working path), and leaves anything else until the arena is reset
+ * Param:   void * data -  The arena
+ * Param:   void * ptr -  The memory
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void arena_free(void * data, void * ptr) {
+    tsp_arena * arena = data;
+    arena_block * block;
+
+    pthread_mutex_lock(&arena->lock);
+    block = arena->blocks;
+    if(ptr == (char *)block + ARENA_ALIGN + arena->last)
+        block->used = arena->last;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+
+//UTILITIES:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Sets the solver's record of the best path found thus far, if the new path is shorter
+ * (safe to call from any thread)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int distance -  The distance of the new path
+ * Param:   int * path -  The new path
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void set_best(tsp_solver * tsp, int distance, int * path) {
+    pthread_mutex_lock(&tsp->best_lock);
+
+    //Another thread may have found a better path in the meantime
+    //(a negative best_distance means there is no best path yet):
+    if(tsp->best_distance < 0 || distance < tsp->best_distance) {
+        if(tsp->verbose)
+            printf("New best path found: %d\n", distance);
+        tsp->best_distance = distance;
+        copy_array(tsp->best_path, path, tsp->num_cities);
+    }
+
+    pthread_mutex_unlock(&tsp->best_lock);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Swaps elements at indicies i and j in array
+ * Param:   int i -  First index
+ * Param:   int j -  Second index
+ * Param:   int * array -  The array to perform the swap on
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void swap(int i, int j, int * array) {
+    int temp;
+
+    temp = array[i];
+    array[i] = array[j];
+    array[j] = temp;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Compares two ints, for qsort and bsearch
+ * Param:   const void * a -  The first int
+ * Param:   const void * b -  The second int
+ * Return:  int -  Negative, zero or positive as a is less than, equal to or greater than b
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int compare_ints(const void * a, const void * b) {
+    int i = *(const int *)a;
+    int j = *(const int *)b;
+
+    return (i > j) - (i < j);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copies the elements of one array into another array
+ * Param:   int * to -  The array to copy elements to
+ * Param:   int * from -  The array to copy elements from
+ * Param:   int len -  The length of the array to copy
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void copy_array(int * to, int * from, int len) {
+    int i=0;
+
+    for(i=0; i<len; i++) {
+        to[i] = from[i];
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Returns the max of the two values passed in
+ * Param:   double a -  First element
+ * Param:   double b -  Second element
+ * Return:  double -  The max of the two elements
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static double get_max(double a, double b) {
+    if(a>b)
+        return a;
+    else
+        return b;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the time from a monotonic clock (the coarse one where available, which is read
+ * without a system call, and is accurate enough for a deadline)
+ * Return:  double -  The time, in seconds
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static double get_time(void) {
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Checks whether the algorithms should stop: tsp_stop has been called (e.g. on a SIGINT or SIGTERM)
+ * for this solver or the one it is solving a cell for, or the deadline set by the time limit (-T) has passed
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  1 if the algorithms should stop, 0 otherwise
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int should_stop(tsp_solver * tsp) {
+    //(The algorithms call this regularly, so it also answers tsp_request_stats):
+    if(tsp->stats_signal) {
+        tsp->stats_signal = 0;
+        if(tsp->use_stats)
+            write_stats(tsp);
+    }
+    if(tsp->stop_signal || tsp->out_of_memory || (tsp->parent && tsp->parent->stop_signal))
+        return 1;
+    return tsp->time_limit > 0 && get_time() >= tsp->deadline;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Checks whether it is time for a checkpoint (-C, only when writing to a file), and if so
+ * schedules the next one.  The caller should save its best path, then call write_checkpoint()
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  1 if a checkpoint should be written, 0 otherwise
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int checkpoint_due(tsp_solver * tsp) {
+    double now;
+
+    if(tsp->checkpoint_interval <= 0 || !tsp->out_file)
+        return 0;
+    now = get_time();
+    if(now < tsp->next_checkpoint)
+        return 0;
+    tsp->next_checkpoint = now + tsp->checkpoint_interval;
+    return 1;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes the best path found thus far to the output file (atomically, see print_solution),
+ * so that a run which is killed can be resumed from it with -w
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void write_checkpoint(tsp_solver * tsp) {
+    pthread_mutex_lock(&tsp->best_lock);
+    if(tsp->verbose)
+        printf("Checkpoint: writing path with distance %d to %s\n", tsp->best_distance, tsp->out_filename);
+    print_solution(tsp);
+    pthread_mutex_unlock(&tsp->best_lock);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Seeds a xoshiro256** random number generator, filling its state with splitmix64
+ * Param:   rng_state * r -  The random number generator
+ * Param:   uint64_t seed -  The seed
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void rng_seed(rng_state * r, uint64_t seed) {
+    int i;
+    uint64_t z;
+
+    for(i=0; i<4; i++) {
+        seed += 0x9e3779b97f4a7c15ULL;
+        z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        r->s[i] = z ^ (z >> 31);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the next number from a xoshiro256** random number generator
+ * Param:   rng_state * r -  The random number generator
+ * Return:  uint64_t -  A random 64-bit number
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static uint64_t rng_next(rng_state * r) {
+    uint64_t * s = r->s;
+    uint64_t result, t;
+
+    result = s[1] * 5;
+    result = ((result << 7) | (result >> 57)) * 9;
+    t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+
+    return result;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets a random integer from 0 to n-1 (by scaling rather than %, which is slower)
+ * Param:   rng_state * r -  The random number generator
+ * Param:   int n -  The number of possible values
+ * Return:  int -  The random integer
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int rng_int(rng_state * r, int n) {
+    return (int)(((rng_next(r) >> 32) * (uint64_t)n) >> 32);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets a random number in [0, 1)
+ * Param:   rng_state * r -  The random number generator
+ * Return:  double -  The random number
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static double rng_double(rng_state * r) {
+    return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+//INPUT/OUTPUT: 
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets a list of all cities (by index, in input order) into the array specfied by list.
+ * Useful for setting up the initial path
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * list -  Location to store the list of cities
+ * Return:  int -  The max id (index) of all the cities, which is always num_cities-1
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int get_list_of_cities(tsp_solver * tsp, int * list) {
+    int i;
+
+    for(i=0; i<tsp->num_cities; i++) {
+        list[i] = i;
+    }
+    return tsp->num_cities-1;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads the input (from stdin or a file, depending on tsp_read's arguments) into the city arrays.
+ * A file (or stdin redirected from one) is memory-mapped, and anything else is read into a buffer;
+ * either way it is parsed in place by parse_input
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  0, or -1 if the input could not be read
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int read_input(tsp_solver * tsp) {
+    int fd, mapped, result;
+    char * buf, * p;
+    long len, size, n;
+    struct stat st;
+
+    tsp->num_cities = 0;
+
+    fd = tsp->in_file ? open(tsp->in_filename, O_RDONLY) : STDIN_FILENO;
+    if(fd < 0) {
+        fprintf(stderr, "Error: could not open %s\n", tsp->in_filename);
+        return -1;
+    }
+
+    //Map regular files, and read anything else (like a pipe) in chunks:
+    buf = NULL;
+    len = 0;
+    mapped = 0;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        len = st.st_size;
+        buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(buf == MAP_FAILED)
+            buf = NULL;
+        else {
+            mapped = 1;
+            madvise(buf, len, MADV_SEQUENTIAL);
+        }
+    }
+    if(!mapped) {
+        len = 0;
+        size = 0;
+        do {
+            if(len + READ_CHUNK > size) {
+                p = mem_realloc(tsp, buf, size, size ? 2*size : 4*READ_CHUNK);
+                if(p == NULL) {
+                    fprintf(stderr, "Error: out of memory reading the input\n");
+                    mem_free(tsp, buf);
+                    if(tsp->in_file)
+                        close(fd);
+                    return -1;
+                }
+                buf = p;
+                size = size ? 2*size : 4*READ_CHUNK;
+            }
+            n = read(fd, buf + len, READ_CHUNK);
+            if(n > 0)
+                len += n;
+        } while(n > 0);
+    }
+
+    result = parse_input(tsp, buf, buf + len);
+    if(mapped)
+        munmap(buf, len);
+    else
+        mem_free(tsp, buf);
+    if(tsp->in_file)
+        close(fd);
+    return result;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Parses the input into the city arrays: lines of "id x y", or a TSPLIB file (recognized
+ * by starting with a keyword) with the cities in its NODE_COORD_SECTION.  Blank lines are
+ * skipped, and an "EOF" line ends the cities; any other line that isn't a city is an error
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   char * p -  The start of the input
+ * Param:   char * end -  The end of the input
+ * Return:  int -  0, or -1 if a line is not a city, the TSPLIB header is not supported, or out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int parse_input(tsp_solver * tsp, char * p, char * end) {
+    char * start, * eol, * q;
+    long line;
+    int result;
+
+    start = p;
+    p = skip_space(p, end);
+    if(p < end && ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z'))) {
+        p = read_tsplib_header(tsp, p, end);
+        if(p == NULL)
+            return -1;
+    }
+    else
+        p = start;
+
+    //Number the lines from the start of the input, for error messages:
+    line = 1;
+    for(q = start; (q = memchr(q, '\n', p - q)) != NULL; q++)
+        line++;
+
+    for(; p < end; p = eol < end ? eol + 1 : end, line++) {
+        eol = memchr(p, '\n', end - p);
+        if(eol == NULL)
+            eol = end;
+        q = skip_space(p, eol);
+        if(q == eol)
+            continue;
+        if(eol - q >= 3 && strncmp(q, "EOF", 3) == 0 && skip_space(q + 3, eol) == eol)
+            break;
+
+        result = read_city(tsp, q, eol);
+        if(result < 0) {
+            fprintf(stderr, "Error: out of memory reading the input\n");
+            return -1;
         }
-
-    } while(term_cnt<SATISFIED);
+        if(result == 0) {
+            fprintf(stderr, "Error: line %ld of the input is not a city (id x y): %.*s\n", line, (int)(eol - q), q);
+            return -1;
+        }
+    }
+    return 0;
 }
 
 
-
-
-//UTILITIES:
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads the header of a TSPLIB file, up to the start of its NODE_COORD_SECTION.  Makes room
+ * for the number of cities given by DIMENSION, and fails if the EDGE_WEIGHT_TYPE isn't EUC_2D
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   char * p -  The start of the header
+ * Param:   char * end -  The end of the input
+ * Return:  char * -  The start of the first city, end if there is no NODE_COORD_SECTION, or NULL if it fails
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static char * read_tsplib_header(tsp_solver * tsp, char * p, char * end) {
+    char * key, * value, * eol;
+    int key_len, value_len;
+    long dimension;
+
+    while(p < end) {
+
+        //Split the line into "KEY : VALUE" (the colon is optional):
+        eol = memchr(p, '\n', end - p);
+        if(eol == NULL)
+            eol = end;
+        key = p;
+        while(p < eol && *p != ':' && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+        key_len = p - key;
+        while(p < eol && (*p == ':' || *p == ' ' || *p == '\t'))
+            p++;
+        value = p;
+        value_len = eol - value;
+        while(value_len > 0 && (value[value_len-1] == ' ' || value[value_len-1] == '\t' || value[value_len-1] == '\r'))
+            value_len--;
+        p = eol < end ? eol + 1 : end;
+
+        if(key_len == 18 && strncmp(key, "NODE_COORD_SECTION", 18) == 0)
+            return p;
+        if(key_len == 9 && strncmp(key, "DIMENSION", 9) == 0) {
+            if(parse_int(value, value + value_len, &dimension) != NULL && dimension > tsp->cities_size &&
+               dimension <= INT_MAX) {
+                if(grow_cities(tsp, dimension) < 0)
+                    return NULL;
+            }
+        }
+        if(key_len == 16 && strncmp(key, "EDGE_WEIGHT_TYPE", 16) == 0) {
+            if(value_len != 6 || strncmp(value, "EUC_2D", 6) != 0) {
+                fprintf(stderr, "Error: unsupported EDGE_WEIGHT_TYPE %.*s (only EUC_2D)\n", value_len, value);
+                return NULL;
+            }
+        }
+    }
+    return end;
+}
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Sets the static variables which hold the best path found thus far
- * Param:   int distance -  The distance of the new path
- * Param:   int * path -  The new path
- * Return:  void
+ * Reads one city ("id x y") from a line of the input, ignoring any further fields on the line.
+ * Coordinates with a fraction or exponent are rounded to the nearest integer.  The id and
+ * coordinates must be within the range of an int
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   char * p -  The start of the city's line
+ * Param:   char * eol -  The end of the line
+ * Return:  int -  1 if the city was added, 0 if the line is not a city, or -1 if out of memory
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void set_best(int distance, int * path) {
-    sigset_t set;
+static int read_city(tsp_solver * tsp, char * p, char * eol) {
+    long id;
+    int x, y;
+
+    if((p = parse_int(p, eol, &id)) == NULL || id < INT_MIN || id > INT_MAX)
+        return 0;
+    if((p = parse_coord(p, eol, &x)) == NULL)
+        return 0;
+    if((p = parse_coord(p, eol, &y)) == NULL)
+        return 0;
+    if(p < eol && *p != ' ' && *p != '\t' && *p != '\r')
+        return 0;
+    if(add_city(tsp, id, x, y) < 0)
+        return -1;
+    return 1;
+}
 
-    sigemptyset(&set);
-    sigaddset(&set, SIGTERM);
-    sigaddset(&set, SIGINT);
-    sigprocmask(SIG_BLOCK, &set, NULL);
 
-    if(verbose)
-        printf("New best path found: %d\n", distance);
-    best_distance = distance;
-    copy_array(best_path, path, num_cities);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Adds a city (as the next city index) with its original id and coordinates, growing the arrays if needed
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int id -  The original id of the city
+ * Param:   int x -  Its x coordinate
+ * Param:   int y -  Its y coordinate
+ * Return:  int -  0, or -1 if out of memory
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int add_city(tsp_solver * tsp, int id, int x, int y) {
+    if(tsp->num_cities >= tsp->cities_size) {
+        if(grow_cities(tsp, tsp->cities_size ? 2*tsp->cities_size : 1024) < 0)
+            return -1;
+    }
 
-    sigprocmask(SIG_UNBLOCK, &set, NULL);
+    tsp->city_ids[tsp->num_cities] = id;
+    tsp->city_x[tsp->num_cities] = x;
+    tsp->city_y[tsp->num_cities] = y;
+    tsp->num_cities++;
+    return 0;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Swaps elements at indicies i and j in array
- * Param:   int i -  First index
- * Param:   int j -  Second index
- * Param:   int * array -  The array to perform the swap on
- * Return:  void
+ * Makes room in the city arrays for more cities
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int size -  The number of cities to make room for
+ * Return:  int -  0, or -1 if out of memory (the arrays are left as they were)
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void swap(int i, int j, int * array) {
-    int temp;
-
-    temp = array[i];
-    array[i] = array[j];
-    array[j] = temp;
+static int grow_cities(tsp_solver * tsp, int size) {
+    int * ids, * x, * y;
+    long old_size = tsp->cities_size * sizeof(int);
+
+    ids = mem_realloc(tsp, tsp->city_ids, old_size, size * sizeof(int));
+    if(ids != NULL)
+        tsp->city_ids = ids;
+    x = mem_realloc(tsp, tsp->city_x, old_size, size * sizeof(int));
+    if(x != NULL)
+        tsp->city_x = x;
+    y = mem_realloc(tsp, tsp->city_y, old_size, size * sizeof(int));
+    if(y != NULL)
+        tsp->city_y = y;
+    if(ids == NULL || x == NULL || y == NULL)
+        return -1;
+
+    tsp->cities_size = size;
+    return 0;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Copies the elements of one array into another array
- * Param:   int * to -  The array to copy elements to
- * Param:   int * from -  The array to copy elements from
- * Param:   int len -  The length of the array to copy
- * Return:  void
+ * Reads a tour (as written by print_solution, in standard or binary format) to start from,
+ * keeping its original ids for start_tour to check and translate
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   const char * filename -  The name of the tour file
+ * Return:  int -  1 if the tour was read, 0 if not
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void copy_array(int * to, int * from, int len) {
-    int i=0;
+static int read_tour(tsp_solver * tsp, const char * filename) {
+    int fd, n, size, ok;
+    int * ids, * grown;
+    int32_t header[3];
+    long value;
+    char * buf, * p, * end;
+    struct stat st;
+
+    fd = open(filename, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: could not read tour %s\n", filename);
+        if(fd >= 0)
+            close(fd);
+        return 0;
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(buf == MAP_FAILED)
+        return 0;
+    end = buf + st.st_size;
+
+    //Get the original ids, in tour order:
+    ids = NULL;
+    n = 0;
+    ok = 1;
+    if(st.st_size >= 16 && memcmp(buf, TOUR_MAGIC, 4) == 0) {
+        memcpy(header, buf + 4, sizeof(header));
+        if(header[0] != TOUR_VERSION || header[1] < 0 || st.st_size < 16 + 4L*header[1])
+            ok = 0;
+        else {
+            n = header[1];
+            ids = mem_alloc(tsp, (n > 0 ? n : 1) * sizeof(int));
+            ok = (ids != NULL);
+            if(ok)
+                memcpy(ids, buf + 16, n * sizeof(int));
+        }
+    }
+    else {
+        //Skip the tour length on the first line:
+        size = 0;
+        p = parse_int(buf, end, &value);
+        while(p != NULL && (p = parse_int(p, end, &value)) != NULL) {
+            if(value < INT_MIN || value > INT_MAX) {
+                ok = 0;
+                break;
+            }
+            if(n == size) {
+                grown = mem_realloc(tsp, ids, size * sizeof(int), (size ? 2*size : 1024) * sizeof(int));
+                if(grown == NULL) {
+                    ok = 0;
+                    break;
+                }
+                ids = grown;
+                size = size ? 2*size : 1024;
+            }
+            ids[n++] = value;
+        }
+    }
+    munmap(buf, st.st_size);
 
-    for(i=0; i<len; i++) {
-        to[i] = from[i];
+    if(ok) {
+        mem_free(tsp, tsp->start_ids);
+        tsp->start_ids = ids;
+        tsp->start_len = n;
+    }
+    else {
+        fprintf(stderr, "Error: could not read tour %s\n", filename);
+        mem_free(tsp, ids);
     }
+    return ok;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Returns the max of the two values passed in
- * Param:   double a -  First element
- * Param:   double b -  Second element
- * Return:  double -  The max of the two elements
+ * Translates the tour to start from (given with tsp_set_tour or tsp_read_tour) from original ids
+ * to city indices.  The tour must visit every city exactly once
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * path -  Location to store the tour (as city indices)
+ * Return:  int -  0, or -1 if it isn't a tour of these cities or out of memory
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-double get_max(double a, double b) {
-    if(a>b)
-        return a;
-    else
-        return b;
-}
+static int start_tour(tsp_solver * tsp, int * path) {
+    int i, lo, hi, mid, ok;
+    int * order, * tour_ids, * seen;
 
+    if(tsp->start_len != tsp->num_cities) {
+        fprintf(stderr, "Error: the tour to start from is not a tour of these cities\n");
+        return -1;
+    }
 
-//INPUT/OUTPUT: 
+    //Translate the ids to city indices (by binary search in the indices sorted by id),
+    //checking that each city appears exactly once:
+    tour_ids = mem_alloc(tsp, tsp->num_cities * sizeof(int));
+    order = mem_alloc(tsp, tsp->num_cities * sizeof(int));
+    seen = mem_calloc(tsp, tsp->num_cities, sizeof(int));
+    if(tour_ids == NULL || order == NULL || seen == NULL) {
+        mem_free(tsp, seen);
+        mem_free(tsp, order);
+        mem_free(tsp, tour_ids);
+        return no_memory(tsp);
+    }
+    for(i=0; i<tsp->num_cities; i++) {
+        order[i] = i;
+    }
+    qsort_r(order, tsp->num_cities, sizeof(int), compare_city_ids, tsp);
+    ok = 1;
+    for(i=0; i<tsp->num_cities && ok; i++) {
+        lo = 0;
+        hi = tsp->num_cities-1;
+        while(lo < hi) {
+            mid = (lo + hi) / 2;
+            if(tsp->city_ids[order[mid]] < tsp->start_ids[i])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if(tsp->city_ids[order[lo]] != tsp->start_ids[i] || seen[order[lo]])
+            ok = 0;
+        else {
+            seen[order[lo]] = 1;
+            tour_ids[i] = order[lo];
+        }
+    }
 
+    if(ok)
+        copy_array(path, tour_ids, tsp->num_cities);
+    else
+        fprintf(stderr, "Error: the tour to start from is not a tour of these cities\n");
 
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Gets the command line options and sets the appropriate static variables representing them
- * Param:   int argc -  The length of the argument vector
- * Param:   char ** argv -  The argument vector
- * Return:  void
- * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void get_options(int argc, char ** argv) {
-    char opt;
+    mem_free(tsp, order);
+    mem_free(tsp, seen);
+    mem_free(tsp, tour_ids);
+    return ok ? 0 : -1;
+}
 
-    while((opt = getopt(argc, argv, "adf:hntv")) != -1) {
-        switch(opt) {
-            case 'a':
-                use_anneal = 1;
-                break;
-            case 'n':
-                use_nearest_neighbor = 1;
-                break;
-            case 'f':
-                in_file = 1;
-                out_file = 1;
-                strncpy(in_filename, optarg, WORD_MAX);
-                snprintf(out_filename, WORD_MAX, "%s%s", in_filename, ".tour");
-                break;
-            case 't':
-                use_two_opt = 1;
-                break;
-            case 'v':
-                verbose = 1;
-                break;
-            case 'd':
-                verbose = 1;
-                debug = 1;
-                break;
-            case 'h':
-            default:
-                printf("Usage: %s -[adntv] -[f filename]\n", argv[0]);
-                printf("Algorithms:\n");
-                printf("\t-Default: Nathan's Hybrid (honestly the best choice)\n");
-                printf("\t-n: Nearest Neighbor (only)\n");
-                printf("\t-t: Two-opt\n");
-                printf("\t-a: Simulated Anneal\n");
-                printf("Display modes:\n");
-                printf("\t-v: Verbose (minor progress messages)\n");
-                printf("\t-d: Debug (lots of detailed messages)\n");
-                printf("Input/Output:\n");
-                printf("\t-f: Specify file to use as input/source file\n");
-                printf("\t    Note: this will result in a output file named [input file].tour\n");
 
-                exit(EXIT_SUCCESS);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Checks that no two cities have the same original id (as the tours given back would then
+ * list one id twice), by sorting the city indices by id as start_tour does
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  0, or -1 if an id appears more than once (or out of memory)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int check_city_ids(tsp_solver * tsp) {
+    int i, result;
+    int * order;
+
+    order = mem_alloc(tsp, tsp->num_cities * sizeof(int));
+    if(order == NULL)
+        return no_memory(tsp);
+    for(i=0; i<tsp->num_cities; i++) {
+        order[i] = i;
+    }
+    qsort_r(order, tsp->num_cities, sizeof(int), compare_city_ids, tsp);
+
+    result = 0;
+    for(i=1; i<tsp->num_cities; i++) {
+        if(tsp->city_ids[order[i]] == tsp->city_ids[order[i-1]]) {
+            fprintf(stderr, "Error: city id %d appears more than once in the input\n", tsp->city_ids[order[i]]);
+            result = -1;
+            break;
         }
     }
+
+    mem_free(tsp, order);
+    return result;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Gets a list of all cities into the array specfied by list.  Useful for setting up the initial path
- * Param:   int * list -  Location to store the list of cities
- * Return:  int -  The max id of all the cities
+ * Compares two cities (given by index) by their original ids, for qsort_r
+ * Param:   const void * a -  The first city's index
+ * Param:   const void * b -  The second city's index
+ * Param:   void * arg -  The solver
+ * Return:  int -  Negative, zero or positive as a's id is less than, equal to or greater than b's
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-int get_list_of_cities(int * list) {
-    int i, max_id;
-    max_id = cities[0]->id;
+static int compare_city_ids(const void * a, const void * b, void * arg) {
+    tsp_solver * tsp = arg;
+    int i = tsp->city_ids[*(const int *)a];
+    int j = tsp->city_ids[*(const int *)b];
 
-    for(i=0; i<num_cities; i++) {
-        list[i] = cities[i]->id;
-        if(list[i] > max_id) {
-            max_id = list[i];
-        }
-    }
-    return max_id;
+    return (i > j) - (i < j);
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Reads the input (from stdin or a file, depending on command line options) and stores it in the cities array
- * Param:   void
- * Return:  void
+ * Skips whitespace (including line breaks)
+ * Param:   char * p -  Where to start
+ * Param:   char * end -  The end of the input
+ * Return:  char * -  The first character that isn't whitespace, or end
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void read_input(void) {
-    FILE * f;
-    char line[LINE_MAX];
-    num_cities = 0;
+static char * skip_space(char * p, char * end) {
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
 
-    f = in_file ? fopen(in_filename, "r") : stdin;
 
-    while(fgets(line, LINE_MAX, f) != NULL) {
-        cities[num_cities++] = read_city(line);
-        if(num_cities >= MAX_CITIES) {
-            printf("Error: too many cities");
-            exit(EXIT_SUCCESS);
-        }
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Parses a (possibly negative) integer, after any whitespace.  One too large for an int
+ * is read as one that is still too large (it stops growing past INT_MAX, so it can't overflow)
+ * Param:   char * p -  Where to start
+ * Param:   char * end -  The end of the input
+ * Param:   long * value -  Location to store the integer
+ * Return:  char * -  The character after the integer, or NULL if there isn't one
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static char * parse_int(char * p, char * end, long * value) {
+    long v;
+    int neg;
+
+    p = skip_space(p, end);
+    neg = (p < end && *p == '-');
+    if(p < end && (*p == '-' || *p == '+'))
+        p++;
+    if(p == end || *p < '0' || *p > '9')
+        return NULL;
+
+    v = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+        if(v <= INT_MAX)
+            v = v*10 + (*p - '0');
+        p++;
     }
-
-    if(in_file)
-        fclose(f);
+    *value = neg ? -v : v;
+    return p;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Reads a line of input text into a city struct, returning a pointer to the city struct
- * Param:   char * line -  Line of text containing three integers: the city's id, x coordinate, and y coordinate
- * Return:  city * -  Pointer to a struct with the city's information
+ * Parses a coordinate, after any whitespace: an integer, or a number with a fraction
+ * and/or exponent (e.g. 1.5e+03, as in some TSPLIB files), rounded to the nearest integer
+ * Param:   char * p -  Where to start
+ * Param:   char * end -  The end of the input
+ * Param:   int * value -  Location to store the coordinate
+ * Return:  char * -  The character after the number, or NULL if there isn't one (or it is outside the range of an int)
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-city * read_city(char * line) {
-    city * c;
+static char * parse_coord(char * p, char * end, int * value) {
+    long whole, e;
+    double v, scale;
+    int neg;
+
+    p = skip_space(p, end);
+    neg = (p < end && *p == '-');
+    if(p < end && (*p == '-' || *p == '+'))
+        p++;
+    if(p == end || ((*p < '0' || *p > '9') && *p != '.'))
+        return NULL;
+
+    //(Stops growing past INT_MAX, as in parse_int):
+    whole = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+        if(whole <= INT_MAX)
+            whole = whole*10 + (*p - '0');
+        p++;
+    }
 
-    c = malloc(sizeof(struct city));
-    c->id = (int)strtol(line, &line, 10);
-    c->x = (int)strtol(line, &line, 10);
-    c->y = (int)strtol(line, &line, 10);
+    //Plain integers (the usual case) don't need any floating point:
+    if(p == end || (*p != '.' && *p != 'e' && *p != 'E')) {
+        if((neg ? -whole : whole) < INT_MIN || (neg ? -whole : whole) > INT_MAX)
+            return NULL;
+        *value = neg ? -whole : whole;
+        return p;
+    }
 
-    return c;
+    v = whole;
+    if(*p == '.') {
+        p++;
+        scale = .1;
+        while(p < end && *p >= '0' && *p <= '9') {
+            v += (*p++ - '0') * scale;
+            scale *= .1;
+        }
+    }
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        if((p = parse_int(p+1, end, &e)) == NULL)
+            return NULL;
+        if(v != 0)
+            v *= pow(10, e);
+    }
+
+    v = neg ? -v - .5 : v + .5;
+    if(!(v > (double)INT_MIN - 1 && v < (double)INT_MAX + 1))
+        return NULL;
+    *value = (int)v;
+    return p;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Prints out all the distances between all the cities
+ * Param:   tsp_solver * tsp -  The solver
  * Return:  void
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void print_distances() {
+void print_distances(tsp_solver * tsp) {
     int i, j;
-    for(i=0; i<num_cities; i++) {
-        for(j=i+1; j<num_cities; j++) {
-            print_distance(cities[i]->id, cities[j]->id);
+    for(i=0; i<tsp->num_cities; i++) {
+        for(j=i+1; j<tsp->num_cities; j++) {
+            print_distance(tsp, i, j);
         }
     }
 }
@@ -678,181 +5489,690 @@ void print_distances() {
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Prints the distance between the two cities represented by ids i and j
+ * Param:   tsp_solver * tsp -  The solver
  * Param:   int i -  The id of the first city
  * Param:   int j -  The id of the second city
  * Return:  void
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void print_distance(int i, int j) {
-    printf("Distance between %d and %d: %d\n", i, j, get_distance(i, j));
+void print_distance(tsp_solver * tsp, int i, int j) {
+    printf("Distance between %d and %d: %d\n", tsp->city_ids[i], tsp->city_ids[j], get_distance(tsp, i, j));
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Prints a list of all cities and their coordinates
- * Param:   void
+ * Param:   tsp_solver * tsp -  The solver
  * Return:  void
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void print_cities(void) {
+void print_cities(tsp_solver * tsp) {
     int i;
-    for(i=0; i<num_cities; i++) {
-        print_city(cities[i]);
+    for(i=0; i<tsp->num_cities; i++) {
+        print_city(tsp, i);
     }
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Prints a single city's id and coordinates
- * Param:   city * c -  The city to print to stdout
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int id -  The id of the city to print to stdout
  * Return:  void
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void print_city(city * c) {
-    printf("City: %d, X: %d, Y: %d\n", c->id, c->x, c->y);
+void print_city(tsp_solver * tsp, int id) {
+    printf("City: %d, X: %d, Y: %d\n", tsp->city_ids[id], tsp->city_x[id], tsp->city_y[id]);
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Prints the solution (to stdout or a file, depending on command line arguments) in standard format
- * Param:   void
- * Return:  void
+ * Prints the solution (to stdout or a file, depending on command line arguments) in standard format,
+ * or in the binary format with -b.  The whole solution is formatted into out_buf and written with
+ * write(), so this allocates nothing and uses no stdio (apart from flushing earlier messages)
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  0, or -1 if it could not be written
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void print_solution(void) {
-    int i;
-    FILE * f;
+static int print_solution(tsp_solver * tsp) {
+    int fd, result;
+    long len;
+    char tmp_filename[FILENAME_LEN+16];
+
+    //A file is written under a temporary name and renamed into place,
+    //so that it always holds a whole solution (even if interrupted):
+    if(tsp->out_file) {
+        snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", tsp->out_filename);
+        fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    else {
+        fflush(stdout);
+        fd = STDOUT_FILENO;
+    }
+    if(fd < 0) {
+        fprintf(stderr, "Error: could not open %s\n", tmp_filename);
+        return -1;
+    }
 
-    if(out_file)
-        f = fopen(out_filename, "w");
+    if(tsp->binary_output)
+        len = format_tour_binary(tsp, tsp->out_buf, tsp->best_distance, tsp->best_path, tsp->num_cities);
     else
-        f = stdout;
+        len = format_tour(tsp, tsp->out_buf, tsp->best_distance, tsp->best_path, tsp->num_cities);
+    result = write_all(fd, tsp->out_buf, len);
+
+    //(A file that could not be written whole is not renamed over the last one):
+    if(tsp->out_file) {
+        if(close(fd) != 0)
+            result = -1;
+        if(result == 0)
+            rename(tmp_filename, tsp->out_filename);
+        else {
+            fprintf(stderr, "Error: could not write %s\n", tmp_filename);
+            unlink(tmp_filename);
+        }
+    }
+    return result;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Formats a tour in standard format: its distance, then the original id of each city, one per line
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   char * buf -  Location to store the text (at least 12 bytes per number)
+ * Param:   int distance -  The distance of the tour
+ * Param:   int * path -  The tour (city indices)
+ * Param:   int len -  The length of the tour
+ * Return:  long -  The number of bytes stored
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static long format_tour(tsp_solver * tsp, char * buf, int distance, int * path, int len) {
+    int i;
+    char * p;
+
+    p = format_int(buf, distance);
+    *p++ = '\n';
+    for(i=0; i<len; i++) {
+        p = format_int(p, tsp->city_ids[path[i]]);
+        *p++ = '\n';
+    }
+    return p - buf;
+}
+
 
-    fprintf(f, "%d\n", best_distance);
-    for(i=0; i<num_cities; i++) {
-        fprintf(f, "%d\n", best_path[i]);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Formats a tour in binary format: TOUR_MAGIC, then the format version, the number of cities
+ * and the distance of the tour, then the original id of each city (all 32-bit, in native byte order)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   char * buf -  Location to store the tour (at least 16 + 4*len bytes)
+ * Param:   int distance -  The distance of the tour
+ * Param:   int * path -  The tour (city indices)
+ * Param:   int len -  The length of the tour
+ * Return:  long -  The number of bytes stored
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static long format_tour_binary(tsp_solver * tsp, char * buf, int distance, int * path, int len) {
+    int i;
+    int32_t header[3], * ids;
+
+    memcpy(buf, TOUR_MAGIC, 4);
+    header[0] = TOUR_VERSION;
+    header[1] = len;
+    header[2] = distance;
+    memcpy(buf + 4, header, sizeof(header));
+
+    ids = (int32_t *)(buf + 16);
+    for(i=0; i<len; i++) {
+        ids[i] = tsp->city_ids[path[i]];
+    }
+    return 16 + 4L*len;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Formats an integer in decimal (a much faster replacement for sprintf's %d)
+ * Param:   char * p -  Location to store the digits (at least 11 bytes)
+ * Param:   int value -  The integer
+ * Return:  char * -  The location after the last digit
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static char * format_int(char * p, int value) {
+    char digits[10];
+    unsigned int v;
+    int n;
+
+    if(value < 0) {
+        *p++ = '-';
+        v = -(unsigned int)value;
     }
+    else
+        v = value;
+
+    //Digits come out backwards, so collect them first:
+    n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v > 0);
+    while(n > 0)
+        *p++ = digits[--n];
+
+    return p;
+}
+
 
-    if(out_file)
-        fclose(f);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes a whole buffer to a file descriptor, continuing after partial writes and interruptions
+ * Param:   int fd -  The file descriptor
+ * Param:   char * buf -  The data to write
+ * Param:   long len -  The number of bytes to write
+ * Return:  int -  0, or -1 if it could not be written (e.g. the other end of a socket was closed)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int write_all(int fd, char * buf, long len) {
+    long n;
+
+    while(len > 0) {
+        n = write(fd, buf, len);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Calculates the distances between all cities, storing them in the static distances matrix
+ * Calculates the distances between all cities, storing them in the static triangular distances matrix
+ * (with 16-bit entries if the largest possible distance fits, 32-bit entries otherwise)
+ * Param:   tsp_solver * tsp -  The solver
  * Param:   int max_id -  The max id of all cities
- * Return:  void
+ * Return:  int -  0, or -1 if out of memory
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void calc_distances(int max_id) {
-    int i, j;
+static int calc_distances(tsp_solver * tsp, int max_id) {
+    int i, j, dst;
+    long size;
     unsigned long sum;
 
     sum=0;
-    distances = malloc((max_id+1) * sizeof(int *));
+    size = tri_index(max_id, max_id) + 1;
+    if(calc_max_distance(tsp) <= MAX_DISTANCE_16)
+        tsp->distances16 = mem_alloc(tsp, size * sizeof(unsigned short));
+    else
+        tsp->distances32 = mem_alloc(tsp, size * sizeof(unsigned int));
+    if(tsp->distances16 == NULL && tsp->distances32 == NULL)
+        return no_memory(tsp);
+
+    for(i=0; i<tsp->num_cities; i++) {
+        for(j=i; j<tsp->num_cities; j++) {
+            dst = calc_distance(tsp, i, j);
+            if(tsp->distances16)
+                tsp->distances16[tri_index(i, j)] = dst;
+            else
+                tsp->distances32[tri_index(i, j)] = dst;
+            sum += dst;
+        }
+    }
+
+    //(With only one city, there is no distance to average, and it is left at 0):
+    if(max_id > 0)
+        tsp->avg_distance = (sum/pow(max_id, 2));
+    return 0;
+}
 
-    for(i=0; i<num_cities; i++) {
-        distances[cities[i]->id] = malloc((max_id+1) * sizeof(int));
 
-        for(j=i+1; j<num_cities; j++) {
-            sum += distances[cities[i]->id][cities[j]->id] = calc_distance(cities[i], cities[j]);
-        }
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Returns the largest distance possible between any two cities (the diagonal of their bounding box)
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  The distance, rounded to the nearest integer, across the bounding box of all cities
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int calc_max_distance(tsp_solver * tsp) {
+    int i;
+    double min_x, max_x, min_y, max_y;
+
+    min_x = max_x = tsp->city_x[0];
+    min_y = max_y = tsp->city_y[0];
+    for(i=1; i<tsp->num_cities; i++) {
+        if(tsp->city_x[i] < min_x) min_x = tsp->city_x[i];
+        if(tsp->city_x[i] > max_x) max_x = tsp->city_x[i];
+        if(tsp->city_y[i] < min_y) min_y = tsp->city_y[i];
+        if(tsp->city_y[i] > max_y) max_y = tsp->city_y[i];
+    }
+
+    return (int) (sqrt((max_x-min_x)*(max_x-min_x) + (max_y-min_y)*(max_y-min_y)) + 0.5);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Returns the index of the distance between cities with ids i and j in the packed triangular distance matrix,
+ * in which row r holds the distances from city r to cities 0 through r
+ * Param:   int i -  The first city's id
+ * Param:   int j -  The second city's id
+ * Return:  long -  The index into the distance matrix
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static long tri_index(int i, int j) {
+    long lo, hi;
+
+    lo = i < j ? i : j;
+    hi = i ^ j ^ lo;
+    return ((hi * (hi+1)) >> 1) + lo;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Estimates the average distance between cities by sampling city pairs, for use when there is no distance matrix.
+ * The pairs are picked at random: cities near each other in the list are near each other on the Hilbert curve,
+ * so pairs of them would be much closer than average.  The result is scaled the same way as the one computed
+ * by calc_distances (and, as there, left at 0 for a single city)
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int * list -  The list of city ids
+ * Param:   int len -  The number of cities
+ * Param:   int max_id -  The max id of all cities
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void calc_avg_distance(tsp_solver * tsp, int * list, int len, int max_id) {
+    int i, a, num;
+    double sum;
+
+    sum = 0;
+    num = 0;
+    for(i=0; i<AVG_SAMPLES && len>1; i++) {
+        a = rng_int(&tsp->rng, len);
+        sum += calc_distance(tsp, list[a], list[(a + 1 + rng_int(&tsp->rng, len-1)) % len]);
+        num++;
+    }
+    if(num > 0 && max_id > 0) {
+        sum = (sum / num) * ((double)len * (len-1) / 2);
+        tsp->avg_distance = (sum/pow(max_id, 2));
     }
-    avg_distance = (sum/pow(max_id, 2));
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Calculates the distance between the specified cities
- * Param:   city * a -  The first city
- * Param:   city * b -  The second city
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int i -  The first city's id
+ * Param:   int j -  The second city's id
  * Return:  int -  The distance, rounded to the nearest integer, between the two cities
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-int calc_distance(city * a, city * b) {
-    int x_dif, y_dif;
-    double distance;
-
-    x_dif = a->x - b->x;
-    y_dif = a->y - b->y;
+static int calc_distance(tsp_solver * tsp, int i, int j) {
+    double x_dif, y_dif;
 
-    distance = sqrt(pow((double) x_dif, 2.0) + pow((double) y_dif, 2.0));
+    x_dif = (double) tsp->city_x[i] - tsp->city_x[j];
+    y_dif = (double) tsp->city_y[i] - tsp->city_y[j];
 
-    return (int) round(distance);
+    return (int) (sqrt(x_dif*x_dif + y_dif*y_dif) + 0.5);
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Returns the distance between cities with ids i and j
+ * Param:   tsp_solver * tsp -  The solver
  * Param:   int i -  The first city's id
  * Param:   int j -  The second city's id
  * Return:  int -  The distance between the two cities
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-int get_distance(int i, int j) {
-    if(i<j)
-        return distances[i][j];
+static int get_distance(tsp_solver * tsp, int i, int j) {
+    if(tsp->distances16)
+        return tsp->distances16[tri_index(i, j)];
+    else if(tsp->distances32)
+        return tsp->distances32[tri_index(i, j)];
     else
-        return distances[j][i];
+        return calc_distance(tsp, i, j);
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Calculates the distance of the specified path
+ * Param:   tsp_solver * tsp -  The solver
  * Param:   int * path -  The path whose distance is desired
  * Param:   int len -  The length of the path
  * Return:  int -  The path's distance (including the return to the origin city)
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-int calc_path_dist(int * path, int len) {
+static int calc_path_dist(tsp_solver * tsp, int * path, int len) {
     int i, dist;
 
     dist = 0;
     for(i=0; i<len-1; i++) {
-        dist += get_distance(path[i], path[i+1]);
+        dist += get_distance(tsp, path[i], path[i+1]);
     }
-    dist += get_distance(path[i], path[0]);
+    dist += get_distance(tsp, path[i], path[0]);
     return dist;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Frees the matrix of distances allocated by calc_distances
- * Param:   void
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void free_distances(tsp_solver * tsp) {
+    if(!tsp->distances_cached) {
+        mem_free(tsp, tsp->distances16);
+        mem_free(tsp, tsp->distances32);
+    }
+    tsp->distances16 = NULL;
+    tsp->distances32 = NULL;
+}
+
+
+//STATISTICS:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Ends the current phase of the run (adding the time since it started to its total) and starts another
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int next -  The phase to start (PHASE_READ, etc.)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void set_phase(tsp_solver * tsp, int next) {
+    double now = get_time();
+
+    tsp->phase_time[tsp->phase] += now - tsp->phase_start;
+    tsp->phase_start = now;
+    tsp->phase = next;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Counts an improvement of the best tour found by a (single-threaded) algorithm
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int dst -  The new best distance
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void stats_improved(tsp_solver * tsp, int dst) {
+    tsp->stats.improvements++;
+    if(tsp->use_stats)
+        stats_trace(tsp, dst);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Adds a point to the improvement trace (-S).  A point less than TRACE_INTERVAL seconds after
+ * the last one replaces that one's distance instead, so the trace stays small however often it is called
+ * Param:   tsp_solver * tsp -  The solver
+ * Param:   int dst -  The best distance found thus far
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static void stats_trace(tsp_solver * tsp, int dst) {
+    double now;
+    trace_point * grown;
+
+    if(!tsp->use_stats)
+        return;
+
+    now = get_time() - tsp->run_start;
+    pthread_mutex_lock(&tsp->best_lock);
+    if(tsp->trace_len > 0 && now - tsp->trace[tsp->trace_len-1].time < TRACE_INTERVAL)
+        tsp->trace[tsp->trace_len-1].distance = dst;
+    else {
+        if(tsp->trace_len == tsp->trace_size) {
+            grown = mem_realloc(tsp, tsp->trace, tsp->trace_size * sizeof(trace_point),
+                                (tsp->trace_size ? tsp->trace_size*2 : 256) * sizeof(trace_point));
+            if(grown != NULL) {
+                tsp->trace = grown;
+                tsp->trace_size = tsp->trace_size ? tsp->trace_size*2 : 256;
+            }
+            else
+                no_memory(tsp);
+        }
+        if(tsp->trace_len < tsp->trace_size) {
+            tsp->trace[tsp->trace_len].time = now;
+            tsp->trace[tsp->trace_len].distance = dst;
+            tsp->trace_len++;
+        }
+    }
+    pthread_mutex_unlock(&tsp->best_lock);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes the statistics as JSON to the file given with -S (under a temporary name, then renamed
+ * into place like print_solution, so that it can be read at any time): the number of cities, the seed,
+ * the best distance, the move counters, the time spent in each phase thus far and the improvement trace
+ * Param:   tsp_solver * tsp -  The solver
  * Return:  void
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void free_distances(void) {
+static void write_stats(tsp_solver * tsp) {
     int i;
+    double now, times[NUM_PHASES];
+    char tmp_filename[FILENAME_LEN+8];
+    FILE * file;
+
+    //Count the current phase up to now:
+    now = get_time();
+    for(i=0; i<NUM_PHASES; i++) {
+        times[i] = tsp->phase_time[i];
+    }
+    times[tsp->phase] += now - tsp->phase_start;
+
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", tsp->stats_filename);
+    file = fopen(tmp_filename, "w");
+    if(file == NULL) {
+        fprintf(stderr, "Error: could not open %s\n", tmp_filename);
+        return;
+    }
 
-    for(i=0; i<num_cities; i++) {
-        free(distances[(cities[i]->id)]);
+    pthread_mutex_lock(&tsp->best_lock);
+    fprintf(file, "{\n  \"cities\": %d,\n  \"seed\": %llu,\n  \"best_distance\": %d,\n  \"elapsed\": %.6f,\n",
+            tsp->num_cities, (unsigned long long)tsp->seed, tsp->best_distance, now - tsp->run_start);
+    fprintf(file, "  \"moves\": {\"evaluated\": %lld, \"accepted\": %lld, \"uphill\": %lld, \"improvements\": %lld},\n",
+            tsp->stats.evaluated, tsp->stats.accepted, tsp->stats.uphill, tsp->stats.improvements);
+    fprintf(file, "  \"phases\": {\"read\": %.6f, \"distances\": %.6f, \"construction\": %.6f, \"improvement\": %.6f, \"output\": %.6f},\n",
+            times[PHASE_READ], times[PHASE_DISTANCES], times[PHASE_CONSTRUCTION], times[PHASE_IMPROVEMENT], times[PHASE_OUTPUT]);
+    fprintf(file, "  \"trace\": [");
+    for(i=0; i<tsp->trace_len; i++) {
+        fprintf(file, "%s[%.3f, %d]", i ? ", " : "", tsp->trace[i].time, tsp->trace[i].distance);
     }
-    free(distances);
+    fprintf(file, "]\n}\n");
+    pthread_mutex_unlock(&tsp->best_lock);
+
+    fclose(file);
+    rename(tmp_filename, tsp->stats_filename);
 }
 
 
-//SIGNAL HANDLERS:
+//INSTANCE CACHE:
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Signal handler for SIGINT or SIGTERM signals.  Prints solution before exiting
- * Param:   int sig -  The signal received
- * Return:  void
+ * Loads the instance cache for the input file, if there is one that was made from the input file
+ * as it is now (same size and modification time).  The cache is memory-mapped, and the city arrays
+ * (and the neighbor lists and distance matrix, if it has them) point straight into it.  A cached
+ * distance matrix is only used if it is still wanted (see -m), and a cache with a neighbor that
+ * is not one of its cities is ignored
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  1 if the cache was loaded, 0 if not (the input must be read)
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void sig_handler(int sig) {
-    if(verbose)
-        printf("Received signal %d: exiting...\n", sig);
-    print_solution();
-    exit(EXIT_SUCCESS);
+static int load_cache(tsp_solver * tsp) {
+    int fd, n, k, len;
+    long i, expected;
+    char * map, * p;
+    int32_t * neighbors;
+    struct stat in_st, st;
+    cache_header * h;
+
+    if(stat(tsp->in_filename, &in_st) != 0)
+        return 0;
+    fd = open(tsp->cache_filename, O_RDONLY);
+    if(fd < 0)
+        return 0;
+    if(fstat(fd, &st) != 0 || st.st_size < (long)sizeof(cache_header)) {
+        close(fd);
+        return 0;
+    }
+
+    //Mapped copy-on-write, so the arrays in it can be changed like allocated ones:
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return 0;
+
+    //Check that the cache is usable and up to date:
+    h = (cache_header *)map;
+    n = h->num_cities;
+    expected = sizeof(cache_header) + 3L*n*sizeof(int32_t) + (long)n*h->num_neighbors*sizeof(int32_t);
+    if(h->matrix_bits)
+        expected += (((long)n*(n+1))/2) * (h->matrix_bits/8);
+    if(memcmp(h->magic, CACHE_MAGIC, 4) != 0 || h->version != CACHE_VERSION || n <= 0
+            || h->source_size != in_st.st_size || h->source_mtime != in_st.st_mtim.tv_sec
+            || h->source_mtime_nsec != in_st.st_mtim.tv_nsec || expected != st.st_size
+            || (h->num_neighbors != 0 && h->num_neighbors != NUM_NEIGHBORS)) {
+        if(tsp->verbose)
+            printf("Cache %s is out of date, ignoring it...\n", tsp->cache_filename);
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    //Each neighbor list holds NUM_NEIGHBORS cities (or one fewer than the cities), the rest unused:
+    neighbors = (int32_t *)(map + sizeof(cache_header) + 3L*n*sizeof(int32_t));
+    len = n-1 < NUM_NEIGHBORS ? n-1 : NUM_NEIGHBORS;
+    for(i=0; i<n && h->num_neighbors; i++) {
+        for(k=0; k<len; k++) {
+            if(neighbors[i*NUM_NEIGHBORS + k] < 0 || neighbors[i*NUM_NEIGHBORS + k] >= n) {
+                if(tsp->verbose)
+                    printf("Cache %s has a neighbor that is not a city, ignoring it...\n", tsp->cache_filename);
+                munmap(map, st.st_size);
+                return 0;
+            }
+        }
+    }
+
+    if(tsp->verbose)
+        printf("Loading cache %s...\n", tsp->cache_filename);
+    tsp->cache_map = map;
+    tsp->cache_len = st.st_size;
+
+    p = map + sizeof(cache_header);
+    tsp->num_cities = tsp->cities_size = n;
+    tsp->city_ids = (int *)p;
+    p += n*sizeof(int32_t);
+    tsp->city_x = (int *)p;
+    p += n*sizeof(int32_t);
+    tsp->city_y = (int *)p;
+    p += n*sizeof(int32_t);
+    tsp->avg_distance = h->avg_distance;
+
+    if(h->num_neighbors) {
+        tsp->neighbors = (int *)p;
+        tsp->neighbors_cached = 1;
+        p += (long)n*NUM_NEIGHBORS*sizeof(int32_t);
+    }
+
+    if(h->matrix_bits && n <= tsp->matrix_max_cities) {
+        if(h->matrix_bits == 16)
+            tsp->distances16 = (unsigned short *)p;
+        else
+            tsp->distances32 = (unsigned int *)p;
+        tsp->distances_cached = 1;
+    }
+
+    return 1;
 }
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Installs the signal handler for SIGINT and SIGTERM
- * Param:   void
+ * Writes the instance cache for the input file: the cities, their neighbor lists, and the distance
+ * matrix if there is one.  It is written to a temporary file and renamed into place, so a run that
+ * is interrupted (or a write that fails) never leaves a partial cache behind
+ * Param:   tsp_solver * tsp -  The solver
  * Return:  void
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-void install_sig_handlers(void) {
-    struct sigaction siga;
+static void write_cache(tsp_solver * tsp) {
+    int fd, result;
+    char tmp_filename[sizeof(tsp->cache_filename) + 4];
+    struct stat in_st;
+    cache_header h;
+
+    if(stat(tsp->in_filename, &in_st) != 0)
+        return;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, 4);
+    h.version = CACHE_VERSION;
+    h.num_cities = tsp->num_cities;
+    h.num_neighbors = tsp->neighbors ? NUM_NEIGHBORS : 0;
+    h.matrix_bits = tsp->distances16 ? 16 : tsp->distances32 ? 32 : 0;
+    h.avg_distance = tsp->avg_distance;
+    h.source_size = in_st.st_size;
+    h.source_mtime = in_st.st_mtim.tv_sec;
+    h.source_mtime_nsec = in_st.st_mtim.tv_nsec;
+
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", tsp->cache_filename);
+    fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        if(tsp->verbose)
+            printf("Could not write cache %s\n", tmp_filename);
+        return;
+    }
+
+    result = write_all(fd, (char *)&h, sizeof(h));
+    if(result == 0)
+        result = write_all(fd, (char *)tsp->city_ids, (long)tsp->num_cities*sizeof(int32_t));
+    if(result == 0)
+        result = write_all(fd, (char *)tsp->city_x, (long)tsp->num_cities*sizeof(int32_t));
+    if(result == 0)
+        result = write_all(fd, (char *)tsp->city_y, (long)tsp->num_cities*sizeof(int32_t));
+    if(result == 0 && tsp->neighbors)
+        result = write_all(fd, (char *)tsp->neighbors, (long)tsp->num_cities*NUM_NEIGHBORS*sizeof(int32_t));
+    if(result == 0 && tsp->distances16)
+        result = write_all(fd, (char *)tsp->distances16, cache_matrix_size(tsp) * sizeof(unsigned short));
+    else if(result == 0 && tsp->distances32)
+        result = write_all(fd, (char *)tsp->distances32, cache_matrix_size(tsp) * sizeof(unsigned int));
+
+    //(A cache that could not be written whole is not renamed over the last one):
+    if(close(fd) != 0)
+        result = -1;
+    if(result == 0)
+        rename(tmp_filename, tsp->cache_filename);
+    else {
+        if(tsp->verbose)
+            printf("Could not write cache %s\n", tmp_filename);
+        unlink(tmp_filename);
+    }
+}
 
-    siga.sa_handler = sig_handler;
-    sigemptyset(&siga.sa_mask);
-    siga.sa_flags = 0;
 
-    sigaction(SIGTERM, &siga, NULL);
-    sigaction(SIGINT, &siga, NULL);
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the number of entries in the distance matrix
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  long -  The number of entries
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static long cache_matrix_size(tsp_solver * tsp) {
+    return tri_index(tsp->num_cities-1, tsp->num_cities-1) + 1;
 }
 
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copies the city arrays out of the instance cache (if one was loaded) and unmaps it, so that
+ * the instance can be changed (see tsp_update).  The neighbor lists and distance matrix
+ * in it must no longer be in use
+ * Param:   tsp_solver * tsp -  The solver
+ * Return:  int -  0, or -1 if out of memory (the cache is left as it was)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+static int uncache_cities(tsp_solver * tsp) {
+    int * ids, * x, * y;
+    long size = (tsp->num_cities + 1) * sizeof(int);
+
+    if(!tsp->cache_map)
+        return 0;
+
+    ids = mem_alloc(tsp, size);
+    x = mem_alloc(tsp, size);
+    y = mem_alloc(tsp, size);
+    if(ids == NULL || x == NULL || y == NULL) {
+        mem_free(tsp, ids);
+        mem_free(tsp, x);
+        mem_free(tsp, y);
+        return -1;
+    }
+    memcpy(ids, tsp->city_ids, tsp->num_cities * sizeof(int));
+    memcpy(x, tsp->city_x, tsp->num_cities * sizeof(int));
+    memcpy(y, tsp->city_y, tsp->num_cities * sizeof(int));
+
+    munmap(tsp->cache_map, tsp->cache_len);
+    tsp->cache_map = NULL;
+    tsp->distances_cached = 0;
+    tsp->neighbors_cached = 0;
+    tsp->city_ids = ids;
+    tsp->city_x = x;
+    tsp->city_y = y;
+    tsp->cities_size = tsp->num_cities + 1;
+    return 0;
+}
+
@@ -0,0 +1,120 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * tsp.h
+ * Analysis of Algorithms - TSP Project
+ *
+ * The solver library (libtsp.a).  Everything a solve works on is kept
+ * in a tsp_solver, so a process can run any number of solves at once,
+ * each on a thread of its own.  A solve looks like:
+ *
+ *     tsp_options options;
+ *     tsp_default_options(&options);
+ *     options.time_limit = 10;
+ *     tsp = tsp_create(&options, NULL);
+ *     tsp_add_city(tsp, id, x, y);      (for each city, or tsp_read)
+ *     distance = tsp_solve(tsp);
+ *     tsp_get_tour(tsp, ids);
+ *     tsp_free(tsp);
+ *
+ * The tsp command (main.c) is a thin wrapper around these calls
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TSP_H
+#define TSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+//CONSTANTS:
+
+//The algorithms that improve the first tour (tsp_options.algorithm).
+//TSP_NONE keeps the first tour as it is:
+#define TSP_HYBRID 0
+#define TSP_NONE 1
+#define TSP_TWO_OPT 2
+#define TSP_TWO_OPT_NEIGHBORS 3
+#define TSP_LIN_KERNIGHAN 4
+#define TSP_ITERATED_LOCAL_SEARCH 5
+#define TSP_ANNEAL 6
+#define TSP_PARALLEL_TEMPERING 7
+
+
+//STRUCTS:
+
+//A solver: the cities of one instance, the best tour found for them, and
+//everything the algorithms work with along the way (see tsp.c):
+typedef struct tsp_solver tsp_solver;
+
+//Where a solver gets its memory from: alloc and realloc (given the old size of the block,
+//for allocators that can't look it up) return NULL when out of memory, and free may be a no-op,
+//e.g. for an arena that is reset between solves.  data is passed to each of them.
+//With a partition (num_cells), the cells are solved on several threads at once, each
+//allocating from the same allocator, so it must then be safe to call from any thread:
+typedef struct tsp_allocator {
+    void * (* alloc)(void *data, size_t size);
+    void * (* realloc)(void *data, void *ptr, size_t old_size, size_t size);
+    void (* free)(void *data, void *ptr);
+    void * data;
+} tsp_allocator;
+
+//An arena: memory solvers can allocate from (with tsp_arena_allocator) with no more than
+//a pointer bump, given back all at once by tsp_arena_reset, e.g. between the solves of
+//many small instances one after another.  Safe to allocate from on several threads:
+typedef struct tsp_arena tsp_arena;
+
+//The options of a solve (the tsp command's options, see README).  Filled in with
+//the defaults by tsp_default_options, then copied by tsp_create:
+typedef struct tsp_options {
+    int algorithm;              //TSP_HYBRID, etc.
+    int use_hilbert;            //Build the first tour along a Hilbert curve, not with nearest neighbor (-H)
+    int num_threads;            //Replicas for TSP_PARALLEL_TEMPERING (-p)
+    int num_cells;              //Solve a grid of about this many cells, then join them (-g), or 0
+    int use_kmeans;             //Make the cells k-means clusters instead of a grid (-K)
+    int num_workers;            //Cells solved (and threads finding neighbor lists) at once, or 0 for one per processor
+    uint64_t seed;              //Seed for the random number generator (-s)
+    double time_limit;          //Seconds from tsp_create to the end of tsp_solve, or 0 for none (-T)
+    double checkpoint_interval; //Seconds between writing the best tour to out_filename, or 0 for none (-C)
+    int matrix_max_cities;      //Largest number of cities to use a distance matrix for (-m)
+    int use_cache;              //Cache the instance read by tsp_read from a file (-c)
+    int binary_output;          //Write tours in the binary format (-b)
+    const char * out_filename;  //File tsp_write_tour writes to, or NULL for stdout (-f)
+    const char * stats_filename;//File tsp_write_stats writes to, or NULL for none (-S)
+    int verbose;                //Print progress messages (-v)
+    int debug;                  //Print lots of detailed messages (-d)
+} tsp_options;
+
+
+//FUNCTIONS:
+
+//Setting up and freeing a solver:
+void tsp_default_options(tsp_options *options);
+tsp_solver * tsp_create(const tsp_options *options, const tsp_allocator *allocator);
+void tsp_free(tsp_solver *tsp);
+
+//The instance, and the tour to start from (if not built by the solver):
+int tsp_add_city(tsp_solver *tsp, int id, int x, int y);
+int tsp_read(tsp_solver *tsp, const char *filename);
+int tsp_parse(tsp_solver *tsp, const char *text, long len);
+int tsp_set_tour(tsp_solver *tsp, const int *ids, int len);
+int tsp_read_tour(tsp_solver *tsp, const char *filename);
+
+//Solving, and the results:
+int tsp_solve(tsp_solver *tsp);
+int tsp_update(tsp_solver *tsp, const int *cities, int num_add, const int *ids, int num_remove);
+int tsp_num_cities(tsp_solver *tsp);
+int tsp_get_tour(tsp_solver *tsp, int *ids);
+int tsp_write_tour(tsp_solver *tsp);
+int tsp_write_tour_fd(tsp_solver *tsp, int fd);
+int tsp_write_stats(tsp_solver *tsp);
+
+//Safe to call from a signal handler or another thread while tsp_solve runs:
+void tsp_stop(tsp_solver *tsp, int sig);
+void tsp_request_stats(tsp_solver *tsp);
+
+//Arenas:
+tsp_arena * tsp_arena_create(size_t size);
+void tsp_arena_allocator(tsp_arena *arena, tsp_allocator *allocator);
+void tsp_arena_reset(tsp_arena *arena);
+void tsp_arena_free(tsp_arena *arena);
+
+#endif
@@ -0,0 +1,337 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * tspbench.c
+ * Analysis of Algorithms - TSP Project
+ *
+ * Benchmark harness for tsp: runs each of the given algorithms on
+ * each of the given instances with a fixed seed and time limit, and
+ * records the wall time, peak memory use (RSS) and tour length of each
+ * run, along with the tour length over time (read from the checkpoints
+ * tsp writes with -C).  Results are appended to [output].csv (one line
+ * per run) and [output].jsonl (one JSON object per run, with the trace),
+ * labelled with the build they came from, so that builds can be compared.
+ *
+ * Use tspbench -h for usage information
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+
+//CONSTANTS:
+
+//Limits and buffer sizes:
+#define WORD_MAX 64
+#define TRACE_MAX 4096
+
+//Default time limit (seconds) for each run, and time between checkpoints:
+#define DEFAULT_TIME 10
+#define DEFAULT_CHECKPOINT .25
+
+
+//STRUCTS:
+
+//A point on the tour length over time trace:
+typedef struct {
+    double time;
+    int length;
+} trace_point;
+
+//The results of one run:
+typedef struct {
+    double wall;
+    long max_rss;
+    int length;
+    int status;
+    int num_points;
+    trace_point trace[TRACE_MAX];
+} run_result;
+
+
+//FUNCTION PROTOTYPES:
+
+void get_options(int argc, char **argv);
+void run(char *instance, char algorithm, run_result *result);
+int read_length(char *filename);
+void algorithm_args(char algorithm, char **args, char *threads);
+void write_results(char *instance, char algorithm, run_result *result);
+double get_time(void);
+
+
+//STATIC VARIABLES:
+
+//Options:
+static char * tsp_path = "./tsp";
+static char * algorithms = "tkia";
+static char * label = "unknown";
+static char * out_base = "bench";
+static double time_limit = DEFAULT_TIME;
+static double checkpoint_interval = DEFAULT_CHECKPOINT;
+static char seed[WORD_MAX] = "1";
+
+//The result files:
+static FILE * csv_file;
+static FILE * json_file;
+
+int main (int argc, char * argv[]) {
+    int i;
+    char * a;
+    char filename[WORD_MAX+8];
+    struct stat st;
+    static run_result result;
+
+    get_options(argc, argv);
+    if(optind >= argc) {
+        fprintf(stderr, "Error: no instances given\n");
+        return EXIT_FAILURE;
+    }
+
+    //Open the result files for appending (with a header for a new CSV file):
+    snprintf(filename, sizeof(filename), "%s.csv", out_base);
+    i = stat(filename, &st) == 0 && st.st_size > 0;
+    csv_file = fopen(filename, "a");
+    snprintf(filename, sizeof(filename), "%s.jsonl", out_base);
+    json_file = fopen(filename, "a");
+    if(csv_file == NULL || json_file == NULL) {
+        fprintf(stderr, "Error: could not open the result files %s.csv and %s.jsonl\n", out_base, out_base);
+        return EXIT_FAILURE;
+    }
+    if(!i)
+        fprintf(csv_file, "label,instance,algorithm,seed,time_limit,wall_seconds,max_rss_kb,length,status\n");
+
+    for(i=optind; i<argc; i++) {
+        for(a=algorithms; *a; a++) {
+            printf("%s -%c: ", argv[i], *a);
+            fflush(stdout);
+            run(argv[i], *a, &result);
+            printf("%d in %.2fs, %ld KB\n", result.length, result.wall, result.max_rss);
+            write_results(argv[i], *a, &result);
+        }
+    }
+
+    fclose(csv_file);
+    fclose(json_file);
+    return EXIT_SUCCESS;
+}
+
+
+//RUNNING:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Runs tsp on an instance with one algorithm, polling its output file for checkpoints
+ * until it exits
+ * Param:   char * instance -  The instance file
+ * Param:   char algorithm -  The algorithm's option letter ('h' for the default hybrid)
+ * Param:   run_result * result -  Location to store the results
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void run(char * instance, char algorithm, run_result * result) {
+    pid_t pid;
+    int status, length, i, fd;
+    double start, now;
+    char tour_filename[WORD_MAX*4];
+    char time_arg[WORD_MAX], checkpoint_arg[WORD_MAX], threads[WORD_MAX];
+    char * args[WORD_MAX];
+    struct rusage usage;
+    struct timespec poll = {0, 10000000};
+
+    snprintf(tour_filename, sizeof(tour_filename), "%s.tour", instance);
+    snprintf(time_arg, sizeof(time_arg), "%g", time_limit);
+    snprintf(checkpoint_arg, sizeof(checkpoint_arg), "%g", checkpoint_interval);
+    unlink(tour_filename);
+
+    args[0] = tsp_path;
+    algorithm_args(algorithm, args + 1, threads);
+    for(i=1; args[i] != NULL; i++);
+    args[i++] = "-s";
+    args[i++] = seed;
+    args[i++] = "-T";
+    args[i++] = time_arg;
+    args[i++] = "-C";
+    args[i++] = checkpoint_arg;
+    args[i++] = "-f";
+    args[i++] = instance;
+    args[i] = NULL;
+
+    result->num_points = 0;
+    start = get_time();
+    pid = fork();
+    if(pid == 0) {
+        //Keep tsp's (verbose) output out of the report:
+        fd = open("/dev/null", O_WRONLY);
+        if(fd < 0) {
+            fprintf(stderr, "Error: could not open /dev/null\n");
+            _exit(127);
+        }
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+        execv(tsp_path, args);
+        _exit(127);
+    }
+
+    //Poll for checkpoints, recording the tour length each time it changes:
+    while(wait4(pid, &status, WNOHANG, &usage) == 0) {
+        nanosleep(&poll, NULL);
+        length = read_length(tour_filename);
+        now = get_time() - start;
+        if(length > 0 && result->num_points < TRACE_MAX &&
+           (result->num_points == 0 || result->trace[result->num_points-1].length != length)) {
+            result->trace[result->num_points].time = now;
+            result->trace[result->num_points].length = length;
+            result->num_points++;
+        }
+    }
+
+    result->wall = get_time() - start;
+    result->max_rss = usage.ru_maxrss;
+    result->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    result->length = read_length(tour_filename);
+    if(result->length > 0 && result->num_points < TRACE_MAX &&
+       (result->num_points == 0 || result->trace[result->num_points-1].length != result->length)) {
+        result->trace[result->num_points].time = result->wall;
+        result->trace[result->num_points].length = result->length;
+        result->num_points++;
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the command line arguments which select an algorithm in tsp
+ * Param:   char algorithm -  The algorithm's option letter ('h' for the default hybrid,
+ *                            'p' for parallel tempering with one thread per processor)
+ * Param:   char ** args -  Location to store the arguments (followed by NULL)
+ * Param:   char * threads -  Buffer for the thread count argument
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void algorithm_args(char algorithm, char ** args, char * threads) {
+    static char option[3] = "-?";
+    int n = 0;
+
+    if(algorithm != 'h') {
+        option[1] = algorithm;
+        args[n++] = option;
+    }
+    if(algorithm == 'p') {
+        snprintf(threads, WORD_MAX, "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+        args[n++] = threads;
+    }
+    args[n] = NULL;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads the tour length from the first line of a tour file (in the standard format)
+ * Param:   char * filename -  The tour file
+ * Return:  int -  The tour length, or 0 if there is no tour (yet)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int read_length(char * filename) {
+    int length = 0;
+    FILE * file = fopen(filename, "r");
+
+    if(file == NULL)
+        return 0;
+    if(fscanf(file, "%d", &length) != 1)
+        length = 0;
+    fclose(file);
+    return length;
+}
+
+
+//OUTPUT:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Appends the results of a run to the CSV and JSON result files
+ * Param:   char * instance -  The instance file
+ * Param:   char algorithm -  The algorithm's option letter
+ * Param:   run_result * result -  The results
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void write_results(char * instance, char algorithm, run_result * result) {
+    int i;
+
+    fprintf(csv_file, "%s,%s,%c,%s,%g,%.3f,%ld,%d,%d\n", label, instance, algorithm,
+            seed, time_limit, result->wall, result->max_rss, result->length, result->status);
+
+    fprintf(json_file, "{\"label\":\"%s\",\"instance\":\"%s\",\"algorithm\":\"%c\",\"seed\":%s,"
+            "\"time_limit\":%g,\"wall_seconds\":%.3f,\"max_rss_kb\":%ld,\"length\":%d,\"status\":%d,\"trace\":[",
+            label, instance, algorithm, seed, time_limit, result->wall, result->max_rss,
+            result->length, result->status);
+    for(i=0; i<result->num_points; i++) {
+        fprintf(json_file, "%s[%.3f,%d]", i ? "," : "", result->trace[i].time, result->trace[i].length);
+    }
+    fprintf(json_file, "]}\n");
+    fflush(csv_file);
+    fflush(json_file);
+}
+
+
+//UTILITIES:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the current time
+ * Return:  double -  Seconds since an arbitrary starting point
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+double get_time(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the command line options
+ * Param:   int argc -  The number of command line arguments
+ * Param:   char ** argv -  The command line arguments
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void get_options(int argc, char ** argv) {
+    int opt;
+
+    while((opt = getopt(argc, argv, "a:C:hl:o:s:T:x:")) != -1) {
+        switch(opt) {
+            case 'a':
+                algorithms = optarg;
+                break;
+            case 'C':
+                checkpoint_interval = atof(optarg);
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            case 'o':
+                out_base = optarg;
+                break;
+            case 's':
+                snprintf(seed, WORD_MAX, "%llu", strtoull(optarg, NULL, 10));
+                break;
+            case 'T':
+                time_limit = atof(optarg);
+                break;
+            case 'x':
+                tsp_path = optarg;
+                break;
+            case 'h':
+            default:
+                printf("Usage: %s -[a algorithms] -[s seed] -[T seconds] -[C seconds] -[l label] -[o output] -[x tsp] instance...\n", argv[0]);
+                printf("\t-a: Algorithms to run, as tsp option letters (default tkia;\n");
+                printf("\t    h is the default hybrid, p is parallel tempering with a thread per processor)\n");
+                printf("\t-s: Seed given to tsp for every run (default 1)\n");
+                printf("\t-T: Time limit for each run, in seconds (default %d)\n", DEFAULT_TIME);
+                printf("\t-C: Time between checkpoints, for the tour length over time (default %g)\n", DEFAULT_CHECKPOINT);
+                printf("\t-l: Label for the results, e.g. the build's git revision\n");
+                printf("\t-o: Results are appended to [output].csv and [output].jsonl (default bench)\n");
+                printf("\t-x: The tsp executable to benchmark (default ./tsp)\n");
+                exit(EXIT_SUCCESS);
+        }
+    }
+}
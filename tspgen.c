@@ -0,0 +1,262 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * tspgen.c
+ * Analysis of Algorithms - TSP Project
+ *
+ * Generates TSP instances (in the "id x y" input format of tsp)
+ * for benchmarking: uniformly random, clustered, or grid cities.
+ * The same type, size and seed always give the same instance.
+ *
+ * Use tspgen -h for usage information
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdint.h>
+
+
+//CONSTANTS:
+
+//Default side of the square the cities are placed in:
+#define DEFAULT_RANGE 1000000
+
+//Average number of cities per cluster, and the spread of each
+//cluster (as a fraction of the range) for clustered instances:
+#define CLUSTER_SIZE 1000
+#define CLUSTER_SPREAD .02
+
+
+//STRUCTS:
+
+//State of a xoshiro256** random number generator (as in tsp.c):
+typedef struct {
+    uint64_t s[4];
+} rng_state;
+
+
+//FUNCTION PROTOTYPES:
+
+void get_options(int argc, char **argv);
+void gen_uniform(void);
+void gen_clustered(void);
+void gen_grid(void);
+void print_city(int id, double x, double y);
+void rng_seed(rng_state *r, uint64_t seed);
+uint64_t rng_next(rng_state *r);
+double rng_double(rng_state *r);
+double rng_gaussian(rng_state *r);
+
+
+//STATIC VARIABLES:
+
+//Options:
+static char * type = "uniform";
+static int num_cities = 1000;
+static int range = DEFAULT_RANGE;
+static uint64_t seed = 1;
+
+//The random number generator:
+static rng_state rng;
+
+int main (int argc, char * argv[]) {
+    get_options(argc, argv);
+    rng_seed(&rng, seed);
+
+    if(strcmp(type, "uniform") == 0)
+        gen_uniform();
+    else if(strcmp(type, "clustered") == 0)
+        gen_clustered();
+    else if(strcmp(type, "grid") == 0)
+        gen_grid();
+    else {
+        fprintf(stderr, "Error: unknown instance type %s\n", type);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+//INSTANCE TYPES:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Generates cities placed uniformly at random in the square
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void gen_uniform(void) {
+    int i;
+
+    for(i=0; i<num_cities; i++) {
+        print_city(i, rng_double(&rng) * range, rng_double(&rng) * range);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Generates cities in normally distributed clusters around centers placed uniformly at random
+ * (cities that would fall outside the square are moved to its edge)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void gen_clustered(void) {
+    int i, c, num_clusters;
+    double * center_x, * center_y;
+    double spread = range * CLUSTER_SPREAD;
+
+    num_clusters = (num_cities + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    center_x = malloc(num_clusters * sizeof(double));
+    center_y = malloc(num_clusters * sizeof(double));
+    for(c=0; c<num_clusters; c++) {
+        center_x[c] = rng_double(&rng) * range;
+        center_y[c] = rng_double(&rng) * range;
+    }
+
+    for(i=0; i<num_cities; i++) {
+        c = (int)(rng_double(&rng) * num_clusters);
+        print_city(i, center_x[c] + rng_gaussian(&rng) * spread,
+                   center_y[c] + rng_gaussian(&rng) * spread);
+    }
+
+    free(center_x);
+    free(center_y);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Generates cities on the points of an evenly spaced square grid (filled row by row).
+ * The seed is not used: grids are a worst case for ties between equal distances
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void gen_grid(void) {
+    int i, side;
+    double spacing;
+
+    side = (int)ceil(sqrt((double)num_cities));
+    spacing = (double)range / side;
+    for(i=0; i<num_cities; i++) {
+        print_city(i, (i % side) * spacing, (i / side) * spacing);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Prints a city, rounding its coordinates and clamping them into the square
+ * Param:   int id -  The city's id
+ * Param:   double x -  The city's x-coordinate
+ * Param:   double y -  The city's y-coordinate
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void print_city(int id, double x, double y) {
+    x = x < 0 ? 0 : (x > range ? range : x);
+    y = y < 0 ? 0 : (y > range ? range : y);
+    printf("%d %d %d\n", id, (int)lround(x), (int)lround(y));
+}
+
+
+//UTILITIES:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Seeds a xoshiro256** random number generator, filling its state with splitmix64
+ * Param:   rng_state * r -  The random number generator
+ * Param:   uint64_t seed -  The seed
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void rng_seed(rng_state * r, uint64_t seed) {
+    int i;
+    uint64_t z;
+
+    for(i=0; i<4; i++) {
+        seed += 0x9e3779b97f4a7c15ULL;
+        z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        r->s[i] = z ^ (z >> 31);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the next number from a xoshiro256** random number generator
+ * Param:   rng_state * r -  The random number generator
+ * Return:  uint64_t -  A random 64-bit number
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+uint64_t rng_next(rng_state * r) {
+    uint64_t * s = r->s;
+    uint64_t result, t;
+
+    result = s[1] * 5;
+    result = ((result << 7) | (result >> 57)) * 9;
+    t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+
+    return result;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets a random double from a xoshiro256** random number generator
+ * Param:   rng_state * r -  The random number generator
+ * Return:  double -  A random number in [0, 1)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+double rng_double(rng_state * r) {
+    return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets a normally distributed random number (Box-Muller transform)
+ * Param:   rng_state * r -  The random number generator
+ * Return:  double -  A random number with mean 0 and standard deviation 1
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+double rng_gaussian(rng_state * r) {
+    double u = 1.0 - rng_double(r);
+    double v = rng_double(r);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the command line options
+ * Param:   int argc -  The number of command line arguments
+ * Param:   char ** argv -  The command line arguments
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void get_options(int argc, char ** argv) {
+    int opt;
+
+    while((opt = getopt(argc, argv, "ht:n:r:s:")) != -1) {
+        switch(opt) {
+            case 't':
+                type = optarg;
+                break;
+            case 'n':
+                num_cities = atoi(optarg);
+                break;
+            case 'r':
+                range = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'h':
+            default:
+                printf("Usage: %s -[t type] -[n cities] -[r range] -[s seed]\n", argv[0]);
+                printf("\t-t: Instance type: uniform (default), clustered or grid\n");
+                printf("\t-n: Number of cities (default 1000)\n");
+                printf("\t-r: Cities are placed in the square from 0 to this (default %d)\n", DEFAULT_RANGE);
+                printf("\t-s: Seed for the random number generator (default 1)\n");
+                printf("The instance is written to stdout\n");
+                exit(EXIT_SUCCESS);
+        }
+    }
+}
@@ -0,0 +1,1312 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * tsptest.c
+ * Analysis of Algorithms - TSP Project
+ *
+ * Tests for the solver library and the tsp command (run by make check):
+ * reads instances in each input format, solves generated instances with
+ * every algorithm, updates tours with tsp_update, resumes solves from
+ * their checkpoints, writes and reads tours in the binary format, reuses
+ * and rebuilds instance caches, sends requests to a tsp server (-D), and
+ * runs two solvers at once on one arena.  Each tour is checked to visit
+ * every city exactly once, with the length given being the length of the
+ * tour.
+ * Prints each failure, and exits with failure if there were any
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "tsp.h"
+
+
+//CONSTANTS:
+
+//Time limit (seconds) for the algorithms that would otherwise run for long:
+#define TIME_LIMIT .3
+
+//Square the cities are placed in:
+#define RANGE 100000
+
+//Size of the buffer for a server's answer, and how long to wait for the server to start:
+#define REPLY_MAX (1 << 20)
+#define CONNECT_TRIES 500
+
+//Instance types:
+#define UNIFORM 0
+#define CLUSTERED 1
+#define GRID 2
+
+
+//STRUCTS:
+
+//An instance, as the cities' ids and coordinates:
+typedef struct {
+    int num_cities;
+    int * ids;
+    int * x;
+    int * y;
+} instance;
+
+//A solve on a thread of its own, for test_arena:
+typedef struct {
+    instance * inst;
+    tsp_allocator * allocator;
+    int num_cells;
+    int distance;
+    int * tour;
+} arena_solve;
+
+
+//FUNCTION PROTOTYPES:
+
+void test_parsing(void);
+void test_algorithms(void);
+void test_updates(void);
+void test_warm_start(void);
+void test_binary_tour(void);
+void test_cache(void);
+void test_server(void);
+void test_arena(void);
+void * solve_on_arena(void *arg);
+tsp_solver * create_solver(tsp_options *options, tsp_allocator *allocator, instance *inst);
+void solve_and_check(const char *name, tsp_options *options, instance *inst);
+void read_and_check(const char *name, tsp_options *options, const char *path, instance *inst);
+void parse_and_check(const char *name, const char *text, instance *inst);
+int check_tour(const char *name, instance *inst, int *tour, int distance);
+void update_instance(instance *inst, int *cities, int num_add, int *ids, int num_remove);
+int server_connect(const char *path);
+int server_text(int fd, instance *inst, char *reply);
+int server_binary(int fd, instance *inst, int version, int *tour);
+int write_instance(const char *path, instance *inst);
+int read_tour_file(const char *path, int num_cities, int *tour);
+int run_tsp(char * const argv[]);
+int write_all(int fd, const void *buf, long len);
+long read_all(int fd, void *buf, long len);
+void gen_instance(instance *inst, int type, int num_cities, uint64_t seed);
+void free_instance(instance *inst);
+void fail(const char *format, ...);
+uint64_t rng_next(void);
+
+
+//STATIC VARIABLES:
+
+//The number of failed checks:
+static int failures = 0;
+
+//The state of the xoshiro256** random number generator (as in tspgen.c):
+static uint64_t rng[4] = {1, 2, 3, 4};
+
+int main (int argc, char * argv[]) {
+    //Writes to a server that has gone away should fail, not end the tests:
+    signal(SIGPIPE, SIG_IGN);
+
+    test_parsing();
+    test_algorithms();
+    test_updates();
+    test_warm_start();
+    test_binary_tour();
+    test_cache();
+    test_server();
+    test_arena();
+
+    if(failures > 0) {
+        printf("%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All tests passed\n");
+    return EXIT_SUCCESS;
+}
+
+
+//TESTS:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads the same instance as lines of "id x y" (with blank lines, extra fields and CRLF line
+ * ends) and as TSPLIB files (with fractions and exponents in the coordinates), then checks
+ * that unsupported TSPLIB files, lines that are not cities, and ids or coordinates outside
+ * the range of an int are refused
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void test_parsing(void) {
+    static int ids[] = {7, 3, 12, 1, 40};
+    static int x[] = {0, 1000, 1000, -2, 500};
+    static int y[] = {0, 0, 1000, 1000, -300};
+    static const char * good[][2] = {
+        {"id x y", "7 0 0\n3 1000 0\n\n12 1000 1000 extra\n1 -2 1000\n40 500 -300\n"},
+        {"id x y with CRLF", "7 0 0\r\n  3\t1000 0\r\n12 1000 1000\r\n1 -2 1000\r\n40 500 -300\r\nEOF\r\n"},
+        {"TSPLIB", "NAME : test\nCOMMENT : five cities\nTYPE : TSP\nDIMENSION : 5\nEDGE_WEIGHT_TYPE : EUC_2D\n"
+                   "NODE_COORD_SECTION\n7 0 0\n3 1000 0\n12 1000 1000\n1 -2 1000\n40 500 -300\nEOF\n"},
+        {"TSPLIB with fractions and exponents", "NAME: test\nTYPE: TSP\nDIMENSION: 5\nEDGE_WEIGHT_TYPE: EUC_2D\n"
+                   "NODE_COORD_SECTION\n7 0.4 -0.4\n3 1.0e+03 0\n12 999.5 1e3\n1 -1.5 .1e4\n"
+                   "40 5e2 -3.0E2\nEOF\nthis is not read\n"}
+    };
+    static const char * bad[][2] = {
+        {"an unsupported EDGE_WEIGHT_TYPE", "NAME : test\nDIMENSION : 2\nEDGE_WEIGHT_TYPE : GEO\nNODE_COORD_SECTION\n1 0 0\n2 1 1\nEOF\n"},
+        {"a line that is not a city", "1 0 0\n2 1 1\n3 x 2\n"},
+        {"a city with no y", "1 0 0\n2 1\n"},
+        {"an id past the range of an int", "1 0 0\n4294967297 1 2\n"},
+        {"an id just past the range of an int", "1 0 0\n2147483648 1 2\n"},
+        {"an x past the range of an int", "1 0 0\n2 99999999999 2\n"},
+        {"a y just past the range of an int", "1 0 0\n2 1 -2147483649\n"},
+        {"a coordinate with an exponent past the range of an int", "1 0 0\n2 1 3e10\n"}
+    };
+    static const char edges[] = "2147483647 -2147483648 2147483647\n-2147483648 2.147483647e9 -2147483648.4\n";
+    int i;
+    instance inst = {5, ids, x, y};
+    tsp_options options;
+    tsp_solver * tsp;
+
+    printf("Testing the input formats...\n");
+    for(i=0; i<(int)(sizeof(good)/sizeof(good[0])); i++) {
+        parse_and_check(good[i][0], good[i][1], &inst);
+    }
+
+    //The largest and smallest ints are read as they are:
+    tsp_default_options(&options);
+    tsp = tsp_create(&options, NULL);
+    if(tsp == NULL || tsp_parse(tsp, edges, strlen(edges)) < 0 || tsp_num_cities(tsp) != 2)
+        fail("input with ids and coordinates at the ends of the range of an int was refused");
+    tsp_free(tsp);
+
+    for(i=0; i<(int)(sizeof(bad)/sizeof(bad[0])); i++) {
+        tsp = tsp_create(&options, NULL);
+        if(tsp != NULL && tsp_parse(tsp, bad[i][1], strlen(bad[i][1])) == 0)
+            fail("input with %s was not refused", bad[i][0]);
+        tsp_free(tsp);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves uniform, clustered and grid instances (and ones of only a few cities) with every
+ * algorithm, then with the other ways of building the first tour and of finding distances
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void test_algorithms(void) {
+    static const char * names[] = {"hybrid", "none", "two-opt", "two-opt with neighbor lists",
+                                   "lin-kernighan", "iterated local search", "anneal", "parallel tempering"};
+    static const int sizes[] = {1, 2, 3, 4, 5, 7, 8, 9};
+    char name[128];
+    int a, i, type;
+    instance inst;
+    tsp_options options;
+
+    printf("Testing the algorithms...\n");
+    for(type=UNIFORM; type<=GRID; type++) {
+        gen_instance(&inst, type, 400, type + 1);
+        for(a=TSP_HYBRID; a<=TSP_PARALLEL_TEMPERING; a++) {
+            tsp_default_options(&options);
+            options.algorithm = a;
+            options.num_threads = 4;
+            options.seed = 1;
+            options.time_limit = TIME_LIMIT;
+            snprintf(name, sizeof(name), "%s, instance type %d", names[a], type);
+            solve_and_check(name, &options, &inst);
+        }
+        free_instance(&inst);
+    }
+
+    for(i=0; i<(int)(sizeof(sizes)/sizeof(sizes[0])); i++) {
+        gen_instance(&inst, UNIFORM, sizes[i], i + 1);
+        for(a=TSP_HYBRID; a<=TSP_PARALLEL_TEMPERING; a++) {
+            tsp_default_options(&options);
+            options.algorithm = a;
+            options.num_threads = 2;
+            options.seed = 1;
+            options.time_limit = TIME_LIMIT;
+            snprintf(name, sizeof(name), "%s, %d cities", names[a], sizes[i]);
+            solve_and_check(name, &options, &inst);
+        }
+        free_instance(&inst);
+    }
+
+    //The two-level list tours of large instances, a Hilbert curve first tour, grid and
+    //k-means cells, and distances calculated on the fly:
+    gen_instance(&inst, CLUSTERED, 6000, 7);
+    tsp_default_options(&options);
+    options.algorithm = TSP_LIN_KERNIGHAN;
+    options.seed = 1;
+    solve_and_check("lin-kernighan, 6000 cities", &options, &inst);
+    options.algorithm = TSP_ITERATED_LOCAL_SEARCH;
+    options.time_limit = TIME_LIMIT;
+    solve_and_check("iterated local search, 6000 cities", &options, &inst);
+    options.algorithm = TSP_LIN_KERNIGHAN;
+    options.time_limit = 0;
+    options.use_hilbert = 1;
+    solve_and_check("lin-kernighan, Hilbert curve first tour", &options, &inst);
+    options.use_hilbert = 0;
+    options.num_cells = 16;
+    options.num_workers = 4;
+    solve_and_check("lin-kernighan, grid cells", &options, &inst);
+    options.use_kmeans = 1;
+    solve_and_check("lin-kernighan, k-means cells", &options, &inst);
+    options.algorithm = TSP_HYBRID;
+    options.time_limit = 1;
+    solve_and_check("hybrid, k-means cells", &options, &inst);
+    options.algorithm = TSP_LIN_KERNIGHAN;
+    options.time_limit = 0;
+    options.num_cells = 0;
+    options.matrix_max_cities = 100;
+    solve_and_check("lin-kernighan, distances on the fly", &options, &inst);
+    free_instance(&inst);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves instances, then adds, moves and removes cities with tsp_update (a few at a time,
+ * then most of them), checking the tour of the changed instance after each update
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void test_updates(void) {
+    static const int sizes[] = {300, 6000};
+    char name[128];
+    int i, j, round, n, num_add, num_remove, distance;
+    int * cities, * ids, * tour;
+    instance inst;
+    tsp_options options;
+    tsp_solver * tsp;
+
+    printf("Testing tsp_update...\n");
+    for(i=0; i<(int)(sizeof(sizes)/sizeof(sizes[0])); i++) {
+        gen_instance(&inst, UNIFORM, sizes[i], 11 + i);
+        tsp_default_options(&options);
+        options.algorithm = TSP_LIN_KERNIGHAN;
+        options.seed = 1;
+        tsp = create_solver(&options, NULL, &inst);
+        if(tsp == NULL || tsp_solve(tsp) < 0) {
+            fail("could not solve %d cities to update", sizes[i]);
+            tsp_free(tsp);
+            free_instance(&inst);
+            continue;
+        }
+
+        cities = malloc(3 * inst.num_cities * sizeof(int));
+        ids = malloc(inst.num_cities * sizeof(int));
+        for(round=0; round<4; round++) {
+            //Remove every 37th city (or all but 3 of them, in the last round), add as many new ones,
+            //and move some of those left (by adding cities with their ids):
+            n = inst.num_cities;
+            num_remove = 0;
+            for(j=0; j<n; j++) {
+                if(round == 3 ? j >= 3 : j % 37 == round)
+                    ids[num_remove++] = inst.ids[j];
+            }
+            num_add = round == 3 ? 2 : num_remove;
+            for(j=0; j<num_add; j++) {
+                cities[3*j] = 10 * RANGE + round * n + j;
+                if(j % 5 == 4 && j < n)
+                    cities[3*j] = inst.ids[n - 1 - j];
+                cities[3*j+1] = (int)(rng_next() % RANGE);
+                cities[3*j+2] = (int)(rng_next() % RANGE);
+            }
+
+            distance = tsp_update(tsp, cities, num_add, ids, num_remove);
+            update_instance(&inst, cities, num_add, ids, num_remove);
+            snprintf(name, sizeof(name), "update %d of %d cities", round + 1, sizes[i]);
+            if(distance < 0 || tsp_num_cities(tsp) != inst.num_cities) {
+                fail("%s: returned %d with %d cities (expected %d)", name, distance,
+                     tsp_num_cities(tsp), inst.num_cities);
+                break;
+            }
+            tour = malloc(inst.num_cities * sizeof(int));
+            if(tsp_get_tour(tsp, tour) != distance)
+                fail("%s: tsp_get_tour gave a different length", name);
+            check_tour(name, &inst, tour, distance);
+            free(tour);
+        }
+
+        //A city added twice is refused, leaving the tour as it was:
+        cities[0] = cities[3] = 20 * RANGE;
+        cities[1] = cities[2] = cities[4] = cities[5] = 0;
+        if(tsp_update(tsp, cities, 2, NULL, 0) >= 0)
+            fail("update adding a city twice was not refused");
+        tour = malloc(inst.num_cities * sizeof(int));
+        distance = tsp_get_tour(tsp, tour);
+        if(distance < 0)
+            fail("the tour was lost when an update was refused");
+        else
+            check_tour("tour after a refused update", &inst, tour, distance);
+        free(tour);
+
+        free(cities);
+        free(ids);
+        tsp_free(tsp);
+        free_instance(&inst);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves an instance with checkpoints (-C) and starts new solves from the tour saved (-w),
+ * then checks that a tour which is missing, or not a tour of the instance, is refused
+ * (by the library, and by ./tsp with -u, which must then fail rather than update another tour)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void test_warm_start(void) {
+    char in_path[64], tour_path[64], missing[64];
+    int saved, distance;
+    int * tour, * start;
+    instance inst;
+    tsp_options options;
+    tsp_solver * tsp;
+
+    printf("Testing checkpoints and warm starts...\n");
+    snprintf(in_path, sizeof(in_path), "/tmp/tsptest-%d.txt", (int)getpid());
+    snprintf(tour_path, sizeof(tour_path), "/tmp/tsptest-%d.tour", (int)getpid());
+    snprintf(missing, sizeof(missing), "/tmp/tsptest-%d.missing", (int)getpid());
+    unlink(tour_path);
+    gen_instance(&inst, UNIFORM, 2000, 41);
+    tour = malloc(inst.num_cities * sizeof(int));
+    start = malloc(inst.num_cities * sizeof(int));
+
+    //The checkpoints are written during the solve, before tsp_write_tour is called:
+    tsp_default_options(&options);
+    options.algorithm = TSP_ITERATED_LOCAL_SEARCH;
+    options.seed = 1;
+    options.time_limit = 4 * TIME_LIMIT;
+    options.checkpoint_interval = TIME_LIMIT / 4;
+    options.out_filename = tour_path;
+    tsp = create_solver(&options, NULL, &inst);
+    distance = tsp != NULL ? tsp_solve(tsp) : -1;
+    tsp_free(tsp);
+    saved = read_tour_file(tour_path, inst.num_cities, start);
+    if(distance < 0)
+        fail("checkpoints: could not solve");
+    else if(saved < 0)
+        fail("checkpoints: no tour was saved in %s", tour_path);
+    else if(check_tour("checkpoint", &inst, start, saved) == 0 && saved < distance)
+        fail("checkpoints: the tour saved (%d) is shorter than the best found (%d)", saved, distance);
+
+    //Starting from the tour saved, and keeping it as it is, gives that tour back:
+    if(saved >= 0) {
+        tsp_default_options(&options);
+        options.algorithm = TSP_NONE;
+        tsp = create_solver(&options, NULL, &inst);
+        if(tsp == NULL || tsp_read_tour(tsp, tour_path) < 0)
+            fail("warm start: could not read %s", tour_path);
+        else if(tsp_solve(tsp) != saved || tsp_get_tour(tsp, tour) != saved ||
+                memcmp(tour, start, inst.num_cities * sizeof(int)) != 0)
+            fail("warm start: the tour started from was not kept");
+        tsp_free(tsp);
+
+        //And improving it gives a tour no longer than it:
+        options.algorithm = TSP_LIN_KERNIGHAN;
+        options.seed = 1;
+        tsp = create_solver(&options, NULL, &inst);
+        if(tsp == NULL || tsp_set_tour(tsp, start, inst.num_cities) < 0 || (distance = tsp_solve(tsp)) < 0)
+            fail("warm start: could not improve the tour saved");
+        else if(tsp_get_tour(tsp, tour) == distance && check_tour("warm start", &inst, tour, distance) == 0 &&
+                distance > saved)
+            fail("warm start: improving the tour saved lengthened it from %d to %d", saved, distance);
+        tsp_free(tsp);
+    }
+
+    //A tour missing a city, or visiting one twice, is refused (as is a file that isn't there):
+    tsp_default_options(&options);
+    options.algorithm = TSP_NONE;
+    tsp = create_solver(&options, NULL, &inst);
+    if(tsp != NULL && tsp_set_tour(tsp, inst.ids, inst.num_cities - 1) == 0 && tsp_solve(tsp) >= 0)
+        fail("warm start: a tour missing a city was not refused");
+    tsp_free(tsp);
+    memcpy(tour, inst.ids, inst.num_cities * sizeof(int));
+    tour[1] = tour[0];
+    tsp = create_solver(&options, NULL, &inst);
+    if(tsp != NULL && tsp_set_tour(tsp, tour, inst.num_cities) == 0 && tsp_solve(tsp) >= 0)
+        fail("warm start: a tour visiting a city twice was not refused");
+    tsp_free(tsp);
+    unlink(missing);
+    tsp = create_solver(&options, NULL, &inst);
+    if(tsp != NULL && tsp_read_tour(tsp, missing) == 0)
+        fail("warm start: reading a tour that isn't there did not fail");
+    tsp_free(tsp);
+
+    //./tsp fails when the tour to update can't be used, rather than updating a tour of its own
+    //(the instance itself stands in for a file of changes, and for a tour of other cities):
+    if(write_instance(in_path, &inst) < 0)
+        fail("could not write %s", in_path);
+    else {
+        char * missing_tour[] = {"tsp", "-f", in_path, "-w", missing, "-u", in_path, NULL};
+        char * wrong_tour[] = {"tsp", "-f", in_path, "-w", in_path, "-u", in_path, NULL};
+        if(run_tsp(missing_tour) == 0)
+            fail("./tsp -w with a tour that isn't there did not fail");
+        if(run_tsp(wrong_tour) == 0)
+            fail("./tsp -w with a tour of other cities did not fail");
+    }
+
+    unlink(in_path);
+    unlink(tour_path);
+    free(tour);
+    free(start);
+    free_instance(&inst);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes a tour in the binary format (-b) and checks it, then starts a solve from it, and checks
+ * that a binary tour of an unknown version, or cut short, is refused
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void test_binary_tour(void) {
+    char tour_path[64];
+    int i, fd, distance, written;
+    int header[3];
+    int * tour, * start;
+    instance inst;
+    tsp_options options;
+    tsp_solver * tsp;
+
+    printf("Testing the binary tour format...\n");
+    snprintf(tour_path, sizeof(tour_path), "/tmp/tsptest-%d.tour", (int)getpid());
+    gen_instance(&inst, CLUSTERED, 1000, 61);
+    tour = malloc(inst.num_cities * sizeof(int));
+    start = malloc(inst.num_cities * sizeof(int));
+
+    tsp_default_options(&options);
+    options.algorithm = TSP_LIN_KERNIGHAN;
+    options.seed = 1;
+    options.binary_output = 1;
+    options.out_filename = tour_path;
+    tsp = create_solver(&options, NULL, &inst);
+    distance = tsp != NULL ? tsp_solve(tsp) : -1;
+    if(distance < 0 || tsp_write_tour(tsp) < 0)
+        fail("binary tour: could not solve and write %s", tour_path);
+    tsp_free(tsp);
+    written = read_tour_file(tour_path, inst.num_cities, start);
+    if(written != distance)
+        fail("binary tour: read a length of %d, not %d", written, distance);
+    else if(check_tour("binary tour", &inst, start, written) == 0) {
+        //Started from, and kept as it is:
+        tsp_default_options(&options);
+        options.algorithm = TSP_NONE;
+        tsp = create_solver(&options, NULL, &inst);
+        if(tsp == NULL || tsp_read_tour(tsp, tour_path) < 0)
+            fail("binary tour: could not start from %s", tour_path);
+        else if(tsp_solve(tsp) != written || tsp_get_tour(tsp, tour) != written ||
+                memcmp(tour, start, inst.num_cities * sizeof(int)) != 0)
+            fail("binary tour: the tour started from was not kept");
+        tsp_free(tsp);
+    }
+
+    //Of a version not known, then cut short by one city:
+    for(i=0; i<2; i++) {
+        header[0] = i == 0 ? 2 : 1;
+        header[1] = inst.num_cities;
+        header[2] = 0;
+        fd = open(tour_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0 || write_all(fd, "TSPT", 4) < 0 || write_all(fd, header, sizeof(header)) < 0 ||
+           write_all(fd, inst.ids, (inst.num_cities - i) * sizeof(int)) < 0)
+            fail("binary tour: could not write %s", tour_path);
+        if(fd >= 0)
+            close(fd);
+        tsp_default_options(&options);
+        tsp = create_solver(&options, NULL, &inst);
+        if(tsp != NULL && tsp_read_tour(tsp, tour_path) == 0)
+            fail("binary tour: a tour %s was not refused", i == 0 ? "of version 2" : "cut short");
+        tsp_free(tsp);
+    }
+
+    unlink(tour_path);
+    free(tour);
+    free(start);
+    free_instance(&inst);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves an instance read from a file with a cache (-c), then again from the cache, which
+ * must be reused as it is, then after the input (or the cache) has changed, when the cache
+ * must be ignored and rewritten.  The input is changed within the same second, and keeps
+ * its size, so only the modification time's nanoseconds tell the caches apart
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void test_cache(void) {
+    char in_path[64], cache_path[72];
+    int fd, t, bad = -1;
+    struct stat st, last;
+    struct timespec wait = {0, 20000000};
+    instance inst;
+    tsp_options options;
+
+    printf("Testing the instance cache...\n");
+    snprintf(in_path, sizeof(in_path), "/tmp/tsptest-%d.txt", (int)getpid());
+    snprintf(cache_path, sizeof(cache_path), "%s.cache", in_path);
+    unlink(cache_path);
+    gen_instance(&inst, UNIFORM, 500, 51);
+    if(write_instance(in_path, &inst) < 0) {
+        fail("could not write %s", in_path);
+        free_instance(&inst);
+        return;
+    }
+    tsp_default_options(&options);
+    options.algorithm = TSP_LIN_KERNIGHAN;
+    options.seed = 1;
+    options.use_cache = 1;
+    options.matrix_max_cities = 100;
+
+    //Written by the first run, and reused (not rewritten) by the next:
+    read_and_check("cache written", &options, in_path, &inst);
+    if(stat(cache_path, &last) != 0)
+        fail("cache: %s was not written", cache_path);
+    read_and_check("cache reused", &options, in_path, &inst);
+    if(stat(cache_path, &st) != 0 || st.st_ino != last.st_ino || st.st_mtim.tv_nsec != last.st_mtim.tv_nsec)
+        fail("cache: %s was rewritten, not reused", cache_path);
+
+    //A city moved (by swapping its coordinates, so the input's size stays the same), a moment
+    //later (still longer than the file system's timestamps take to change):
+    t = inst.x[7];
+    inst.x[7] = inst.y[7];
+    inst.y[7] = t;
+    nanosleep(&wait, NULL);
+    last = st;
+    if(write_instance(in_path, &inst) < 0)
+        fail("could not write %s", in_path);
+    read_and_check("cache after the input changed", &options, in_path, &inst);
+    if(stat(cache_path, &st) != 0 || st.st_ino == last.st_ino)
+        fail("cache: %s was not rewritten after the input changed", cache_path);
+
+    //A neighbor list with a city that isn't one (with no distance matrix, the neighbor lists
+    //are at the end of the cache):
+    last = st;
+    fd = open(cache_path, O_WRONLY);
+    if(fd < 0 || pwrite(fd, &bad, sizeof(bad), st.st_size - sizeof(int)) != sizeof(bad))
+        fail("cache: could not change %s", cache_path);
+    if(fd >= 0)
+        close(fd);
+    read_and_check("cache with a bad neighbor", &options, in_path, &inst);
+    if(stat(cache_path, &st) != 0 || st.st_ino == last.st_ino)
+        fail("cache: %s was not rewritten when one of its neighbors was not a city", cache_path);
+
+    unlink(cache_path);
+    unlink(in_path);
+    free_instance(&inst);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Starts ./tsp as a server (-D) and sends it a text and a binary request on one connection,
+ * then a malformed text request, and a binary request of an unknown version on another
+ * (which must be answered with a length of -1, closing the connection only for the binary one)
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void test_server(void) {
+    char path[108];
+    char * reply, * p;
+    int i, fd, status, distance;
+    int * tour;
+    pid_t pid;
+    instance inst;
+    static const char bad[] = "1 10 10\n2 20 20\nnot a city\nEOF\n";
+
+    printf("Testing the server...\n");
+    snprintf(path, sizeof(path), "/tmp/tsptest-%d.sock", (int)getpid());
+    unlink(path);
+
+    pid = fork();
+    if(pid == 0) {
+        //Keep tsp's messages (for the malformed request) out of the report:
+        fd = open("/dev/null", O_WRONLY);
+        if(fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        execl("./tsp", "tsp", "-l", "-s", "1", "-T", "1", "-D", path, (char *)NULL);
+        _exit(127);
+    }
+    if(pid < 0) {
+        fail("could not start ./tsp");
+        return;
+    }
+
+    gen_instance(&inst, UNIFORM, 500, 21);
+    reply = malloc(REPLY_MAX);
+    tour = malloc(inst.num_cities * sizeof(int));
+    fd = server_connect(path);
+    if(fd < 0)
+        fail("could not connect to the server at %s", path);
+    else {
+        //Text, then binary, on the same connection:
+        if(server_text(fd, &inst, reply) < 0 || sscanf(reply, "%d", &distance) != 1 || distance < 0)
+            fail("text request: no tour in the answer");
+        else {
+            p = strchr(reply, '\n');
+            for(i=0; i<inst.num_cities && p && sscanf(p, "%d", &tour[i]) == 1; i++)
+                p = strchr(p + 1, '\n');
+            if(i < inst.num_cities)
+                fail("text request: only %d of %d cities in the answer", i, inst.num_cities);
+            else
+                check_tour("text request", &inst, tour, distance);
+        }
+
+        distance = server_binary(fd, &inst, 1, tour);
+        if(distance < 0)
+            fail("binary request: answered with %d", distance);
+        else
+            check_tour("binary request", &inst, tour, distance);
+
+        //Then an instance with a line that is not a city:
+        if(write_all(fd, bad, sizeof(bad) - 1) < 0 || server_text(fd, NULL, reply) < 0 ||
+           strcmp(reply, "-1\nEOF\n") != 0)
+            fail("malformed text request: not answered with -1");
+        close(fd);
+    }
+
+    //A binary request of an unknown version is answered with -1, and the connection closed:
+    fd = server_connect(path);
+    if(fd >= 0) {
+        if(server_binary(fd, &inst, 99, tour) != -1)
+            fail("binary request of an unknown version: not answered with -1");
+        if(read_all(fd, reply, 1) != 0)
+            fail("binary request of an unknown version: the connection was not closed");
+        close(fd);
+    }
+
+    //SIGTERM stops the server, which removes its socket:
+    kill(pid, SIGTERM);
+    if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fail("the server did not exit cleanly on SIGTERM");
+    if(access(path, F_OK) == 0) {
+        fail("the server did not remove its socket");
+        unlink(path);
+    }
+
+    free(tour);
+    free(reply);
+    free_instance(&inst);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Runs two solvers at once, each on a thread of its own, allocating from one arena (one of them
+ * with cells, so that its cells' solvers allocate from it on several threads too), then again
+ * after the arena is reset
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void test_arena(void) {
+    int i, round;
+    char name[64];
+    pthread_t thread[2];
+    arena_solve solve[2];
+    instance inst[2];
+    tsp_arena * arena;
+    tsp_allocator allocator;
+
+    printf("Testing two solvers on one arena...\n");
+    arena = tsp_arena_create(0);
+    if(arena == NULL) {
+        fail("could not create an arena");
+        return;
+    }
+    tsp_arena_allocator(arena, &allocator);
+    gen_instance(&inst[0], UNIFORM, 3000, 31);
+    gen_instance(&inst[1], CLUSTERED, 3000, 32);
+
+    for(round=0; round<2; round++) {
+        for(i=0; i<2; i++) {
+            solve[i].inst = &inst[i];
+            solve[i].allocator = &allocator;
+            solve[i].num_cells = i ? 8 : 0;
+            solve[i].tour = malloc(inst[i].num_cities * sizeof(int));
+            pthread_create(&thread[i], NULL, solve_on_arena, &solve[i]);
+        }
+        for(i=0; i<2; i++) {
+            pthread_join(thread[i], NULL);
+            snprintf(name, sizeof(name), "solver %d on the arena, round %d", i + 1, round + 1);
+            if(solve[i].distance < 0)
+                fail("%s: could not solve", name);
+            else
+                check_tour(name, &inst[i], solve[i].tour, solve[i].distance);
+            free(solve[i].tour);
+        }
+        tsp_arena_reset(arena);
+    }
+
+    tsp_arena_free(arena);
+    free_instance(&inst[0]);
+    free_instance(&inst[1]);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The thread run for each solver of test_arena: solves its instance with lin_kernighan
+ * Param:   void * arg -  The arena_solve
+ * Return:  void * -  NULL
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void * solve_on_arena(void * arg) {
+    arena_solve * solve = arg;
+    tsp_options options;
+    tsp_solver * tsp;
+
+    tsp_default_options(&options);
+    options.algorithm = TSP_LIN_KERNIGHAN;
+    options.seed = 1;
+    options.num_cells = solve->num_cells;
+    options.num_workers = 4;
+    solve->distance = -1;
+    tsp = create_solver(&options, solve->allocator, solve->inst);
+    if(tsp != NULL && tsp_solve(tsp) >= 0)
+        solve->distance = tsp_get_tour(tsp, solve->tour);
+    tsp_free(tsp);
+    return NULL;
+}
+
+
+//CHECKING TOURS:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Creates a solver for an instance
+ * Param:   tsp_options * options -  The options
+ * Param:   tsp_allocator * allocator -  The allocator, or NULL for the default
+ * Param:   instance * inst -  The instance
+ * Return:  tsp_solver * -  The solver, or NULL if it could not be created
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+tsp_solver * create_solver(tsp_options * options, tsp_allocator * allocator, instance * inst) {
+    int i;
+    tsp_solver * tsp;
+
+    tsp = tsp_create(options, allocator);
+    for(i=0; tsp != NULL && i<inst->num_cities; i++) {
+        if(tsp_add_city(tsp, inst->ids[i], inst->x[i], inst->y[i]) < 0) {
+            tsp_free(tsp);
+            tsp = NULL;
+        }
+    }
+    return tsp;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves an instance and checks its tour
+ * Param:   const char * name -  What is being tested, for the report
+ * Param:   tsp_options * options -  The options
+ * Param:   instance * inst -  The instance
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void solve_and_check(const char * name, tsp_options * options, instance * inst) {
+    int distance;
+    int * tour;
+    tsp_solver * tsp;
+
+    tsp = create_solver(options, NULL, inst);
+    distance = tsp != NULL ? tsp_solve(tsp) : -1;
+    if(distance < 0) {
+        fail("%s: could not solve", name);
+        tsp_free(tsp);
+        return;
+    }
+    tour = malloc(inst->num_cities * sizeof(int));
+    if(tsp_get_tour(tsp, tour) != distance)
+        fail("%s: tsp_get_tour gave a different length", name);
+    check_tour(name, inst, tour, distance);
+    free(tour);
+    tsp_free(tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves an instance read from a file (with tsp_read) and checks its tour
+ * Param:   const char * name -  What is being tested, for the report
+ * Param:   tsp_options * options -  The options
+ * Param:   const char * path -  The file
+ * Param:   instance * inst -  The instance in it
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void read_and_check(const char * name, tsp_options * options, const char * path, instance * inst) {
+    int distance = -1;
+    int * tour;
+    tsp_solver * tsp;
+
+    tsp = tsp_create(options, NULL);
+    if(tsp != NULL && tsp_read(tsp, path) == 0)
+        distance = tsp_solve(tsp);
+    if(distance < 0 || tsp_num_cities(tsp) != inst->num_cities) {
+        fail("%s: could not read and solve %s", name, path);
+        tsp_free(tsp);
+        return;
+    }
+    tour = malloc(inst->num_cities * sizeof(int));
+    if(tsp_get_tour(tsp, tour) != distance)
+        fail("%s: tsp_get_tour gave a different length", name);
+    check_tour(name, inst, tour, distance);
+    free(tour);
+    tsp_free(tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Solves an instance given as text (with tsp_parse), and checks that it has the cities
+ * expected and that its tour is right (by the expected cities' coordinates)
+ * Param:   const char * name -  What is being tested, for the report
+ * Param:   const char * text -  The instance, in any input format
+ * Param:   instance * inst -  The cities it should be read as
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void parse_and_check(const char * name, const char * text, instance * inst) {
+    int distance = -1;
+    int * tour;
+    tsp_options options;
+    tsp_solver * tsp;
+
+    tsp_default_options(&options);
+    options.algorithm = TSP_LIN_KERNIGHAN;
+    options.seed = 1;
+    tsp = tsp_create(&options, NULL);
+    if(tsp != NULL && tsp_parse(tsp, text, strlen(text)) == 0 && tsp_num_cities(tsp) == inst->num_cities)
+        distance = tsp_solve(tsp);
+    if(distance < 0) {
+        fail("%s: could not read and solve %d cities", name, inst->num_cities);
+        tsp_free(tsp);
+        return;
+    }
+    tour = malloc(inst->num_cities * sizeof(int));
+    if(tsp_get_tour(tsp, tour) != distance)
+        fail("%s: tsp_get_tour gave a different length", name);
+    check_tour(name, inst, tour, distance);
+    free(tour);
+    tsp_free(tsp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Checks that a tour visits every city of an instance exactly once, and that its
+ * length is the one given (with distances rounded to the nearest integer, as in tsp.c)
+ * Param:   const char * name -  What is being tested, for the report
+ * Param:   instance * inst -  The instance
+ * Param:   int * tour -  The tour, as the cities' ids
+ * Param:   int distance -  Its length, as given
+ * Return:  int -  0, or -1 if the tour is wrong
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int check_tour(const char * name, instance * inst, int * tour, int distance) {
+    int i, j, n, max_id;
+    long length;
+    double dx, dy;
+    int * index;
+
+    //The cities' indices by id (the ids are small enough for a table):
+    n = inst->num_cities;
+    max_id = 0;
+    for(i=0; i<n; i++) {
+        if(inst->ids[i] > max_id)
+            max_id = inst->ids[i];
+    }
+    index = malloc((max_id + 1) * sizeof(int));
+    for(i=0; i<=max_id; i++) {
+        index[i] = -1;
+    }
+    for(i=0; i<n; i++) {
+        index[inst->ids[i]] = i;
+    }
+
+    //Each id must be a city's, and seen only once (marked by making its index negative):
+    for(i=0; i<n; i++) {
+        if(tour[i] < 0 || tour[i] > max_id || index[tour[i]] < 0) {
+            fail("%s: stop %d is id %d, which is not a city (or is visited twice)", name, i, tour[i]);
+            free(index);
+            return -1;
+        }
+        index[tour[i]] = -index[tour[i]] - 2;
+    }
+
+    length = 0;
+    for(i=0; i<n; i++) {
+        j = -index[tour[(i+1) % n]] - 2;
+        dx = (double)inst->x[-index[tour[i]] - 2] - inst->x[j];
+        dy = (double)inst->y[-index[tour[i]] - 2] - inst->y[j];
+        length += (long)(sqrt(dx*dx + dy*dy) + 0.5);
+    }
+    free(index);
+    if(length != distance) {
+        fail("%s: the tour's length is %ld, not %d", name, length, distance);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Makes the changes of a tsp_update to the instance: removes the cities with the given ids, and
+ * adds the cities given (one with the id of a city left moves it)
+ * Param:   instance * inst -  The instance
+ * Param:   int * cities -  The cities to add, as the id, x and y coordinates of each
+ * Param:   int num_add -  The number of cities to add
+ * Param:   int * ids -  The ids of the cities to remove
+ * Param:   int num_remove -  The number of ids
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void update_instance(instance * inst, int * cities, int num_add, int * ids, int num_remove) {
+    int i, j, n, gone;
+
+    n = 0;
+    for(i=0; i<inst->num_cities; i++) {
+        gone = 0;
+        for(j=0; j<num_remove && !gone; j++)
+            gone = inst->ids[i] == ids[j];
+        for(j=0; j<num_add && !gone; j++)
+            gone = inst->ids[i] == cities[3*j];
+        if(gone)
+            continue;
+        inst->ids[n] = inst->ids[i];
+        inst->x[n] = inst->x[i];
+        inst->y[n] = inst->y[i];
+        n++;
+    }
+    inst->ids = realloc(inst->ids, (n + num_add) * sizeof(int));
+    inst->x = realloc(inst->x, (n + num_add) * sizeof(int));
+    inst->y = realloc(inst->y, (n + num_add) * sizeof(int));
+    for(j=0; j<num_add; j++, n++) {
+        inst->ids[n] = cities[3*j];
+        inst->x[n] = cities[3*j+1];
+        inst->y[n] = cities[3*j+2];
+    }
+    inst->num_cities = n;
+}
+
+
+//FILES, AND RUNNING ./tsp:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes an instance to a file, as a line of "id x y" for each city
+ * Param:   const char * path -  The file
+ * Param:   instance * inst -  The instance
+ * Return:  int -  0, or -1 if it could not be written
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int write_instance(const char * path, instance * inst) {
+    int i, result;
+    FILE * file;
+
+    file = fopen(path, "w");
+    if(file == NULL)
+        return -1;
+    for(i=0; i<inst->num_cities; i++) {
+        fprintf(file, "%d %d %d\n", inst->ids[i], inst->x[i], inst->y[i]);
+    }
+    result = ferror(file) ? -1 : 0;
+    if(fclose(file) != 0)
+        result = -1;
+    return result;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads a tour written by tsp_write_tour: in the standard format, its length, then an id on each
+ * line, or in the binary format, "TSPT", the format version (1), the number of cities and the
+ * length, then the ids (all 32-bit integers), with nothing after them
+ * Param:   const char * path -  The file
+ * Param:   int num_cities -  The number of cities the tour should have
+ * Param:   int * tour -  Location to store the tour (room for num_cities ids)
+ * Return:  int -  The length of the tour, or -1 if it could not be read or has another number of cities
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int read_tour_file(const char * path, int num_cities, int * tour) {
+    int i, distance, extra;
+    int header[3];
+    char magic[4];
+    FILE * file;
+
+    file = fopen(path, "r");
+    if(file == NULL)
+        return -1;
+    if(fread(magic, 1, 4, file) == 4 && memcmp(magic, "TSPT", 4) == 0) {
+        if(fread(header, sizeof(int), 3, file) != 3 || header[0] != 1 || header[1] != num_cities ||
+           fread(tour, sizeof(int), num_cities, file) != (size_t)num_cities || fgetc(file) != EOF)
+            header[2] = -1;
+        fclose(file);
+        return header[2];
+    }
+    rewind(file);
+    if(fscanf(file, "%d", &distance) != 1)
+        distance = -1;
+    for(i=0; i<num_cities && distance >= 0; i++) {
+        if(fscanf(file, "%d", &tour[i]) != 1)
+            distance = -1;
+    }
+    if(fscanf(file, "%d", &extra) == 1)
+        distance = -1;
+    fclose(file);
+    return distance;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Runs ./tsp, with its output (and messages) thrown away, and waits for it to exit
+ * Param:   char * const argv[] -  Its arguments, starting with the program name and ending with NULL
+ * Return:  int -  Its exit status, or -1 if it could not be run (or did not exit normally)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int run_tsp(char * const argv[]) {
+    int fd, status;
+    pid_t pid;
+
+    pid = fork();
+    if(pid == 0) {
+        fd = open("/dev/null", O_WRONLY);
+        if(fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execv("./tsp", argv);
+        _exit(127);
+    }
+    if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+
+//SERVER REQUESTS:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Connects to a server, waiting for it to start listening
+ * Param:   const char * path -  The server's socket
+ * Return:  int -  The connection, or -1 if it could not connect
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int server_connect(const char * path) {
+    int i, fd;
+    struct sockaddr_un addr;
+    struct timespec wait = {0, 10000000};
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    for(i=0; i<CONNECT_TRIES; i++) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0)
+            return -1;
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            return fd;
+        close(fd);
+        nanosleep(&wait, NULL);
+    }
+    return -1;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Sends an instance to a server as text (unless it is NULL, when the request has already been
+ * sent), and reads the answer: the text up to and including its line of EOF
+ * Param:   int fd -  The connection
+ * Param:   instance * inst -  The instance, or NULL
+ * Param:   char * reply -  Location to store the answer (REPLY_MAX bytes)
+ * Return:  int -  0, or -1 if the answer could not be read
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int server_text(int fd, instance * inst, char * reply) {
+    int i;
+    long len, n;
+    char * text;
+
+    reply[0] = '\0';
+    if(inst != NULL) {
+        text = malloc(inst->num_cities * 36L + 8);
+        len = 0;
+        for(i=0; i<inst->num_cities; i++) {
+            len += sprintf(text + len, "%d %d %d\n", inst->ids[i], inst->x[i], inst->y[i]);
+        }
+        len += sprintf(text + len, "EOF\n");
+        i = write_all(fd, text, len);
+        free(text);
+        if(i < 0)
+            return -1;
+    }
+
+    len = 0;
+    while(len < 4 || (strcmp(reply + len - 4, "EOF\n") != 0)) {
+        if(len >= REPLY_MAX - 1)
+            return -1;
+        n = read(fd, reply + len, REPLY_MAX - 1 - len);
+        if(n <= 0)
+            return -1;
+        len += n;
+        reply[len] = '\0';
+    }
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Sends an instance to a server in binary, and reads the tour it answers with
+ * Param:   int fd -  The connection
+ * Param:   instance * inst -  The instance
+ * Param:   int version -  The format version to send
+ * Param:   int * tour -  Location to store the tour (room for every city)
+ * Return:  int -  The length of the tour, or -1 if it was answered with no tour (or could not be read)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int server_binary(int fd, instance * inst, int version, int * tour) {
+    int i;
+    int header[3];
+    char magic[4];
+    int * request;
+
+    request = malloc((3L * inst->num_cities + 3) * sizeof(int));
+    memcpy(request, "TSPI", 4);
+    request[1] = version;
+    request[2] = inst->num_cities;
+    for(i=0; i<inst->num_cities; i++) {
+        request[3 + 3*i] = inst->ids[i];
+        request[4 + 3*i] = inst->x[i];
+        request[5 + 3*i] = inst->y[i];
+    }
+    i = write_all(fd, request, (3L * inst->num_cities + 3) * sizeof(int));
+    free(request);
+
+    //The answer: "TSPT", the format version, the number of cities and the length, then the tour:
+    if(i < 0 || read_all(fd, magic, 4) != 4 || memcmp(magic, "TSPT", 4) != 0 ||
+       read_all(fd, header, sizeof(header)) != sizeof(header) || header[0] != 1)
+        return -1;
+    if(header[2] < 0 || header[1] != inst->num_cities)
+        return header[1] == 0 ? header[2] : -1;
+    if(read_all(fd, tour, header[1] * sizeof(int)) != header[1] * (long)sizeof(int))
+        return -1;
+    return header[2];
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Writes all of a buffer to a connection
+ * Param:   int fd -  The connection
+ * Param:   const void * buf -  The buffer
+ * Param:   long len -  Its length
+ * Return:  int -  0, or -1 if it could not be written
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int write_all(int fd, const void * buf, long len) {
+    long n;
+
+    while(len > 0) {
+        n = write(fd, buf, len);
+        if(n <= 0)
+            return -1;
+        buf = (const char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reads from a connection until a buffer is full or the connection is closed
+ * Param:   int fd -  The connection
+ * Param:   void * buf -  The buffer
+ * Param:   long len -  Its length
+ * Return:  long -  The number of bytes read
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+long read_all(int fd, void * buf, long len) {
+    long n, total = 0;
+
+    while(total < len) {
+        n = read(fd, (char *)buf + total, len - total);
+        if(n <= 0)
+            break;
+        total += n;
+    }
+    return total;
+}
+
+
+//UTILITIES:
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Generates an instance: cities placed uniformly at random, in tight clusters (with many
+ * sharing their coordinates), or on a square grid.  The ids are spread out, not 0, 1, 2...
+ * Param:   instance * inst -  Location to store the instance
+ * Param:   int type -  UNIFORM, CLUSTERED or GRID
+ * Param:   int num_cities -  The number of cities
+ * Param:   uint64_t seed -  Seed for the random number generator
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void gen_instance(instance * inst, int type, int num_cities, uint64_t seed) {
+    int i, c, side;
+
+    rng[0] = seed;
+    rng[1] = seed * 0x9e3779b97f4a7c15ULL + 1;
+    rng[2] = 0xbf58476d1ce4e5b9ULL;
+    rng[3] = 0x94d049bb133111ebULL;
+    for(i=0; i<16; i++)
+        rng_next();
+
+    inst->num_cities = num_cities;
+    inst->ids = malloc(num_cities * sizeof(int));
+    inst->x = malloc(num_cities * sizeof(int));
+    inst->y = malloc(num_cities * sizeof(int));
+    side = (int)ceil(sqrt((double)num_cities));
+    for(i=0; i<num_cities; i++) {
+        inst->ids[i] = 3 * i + 1;
+        if(type == GRID) {
+            inst->x[i] = (i % side) * (RANGE / side);
+            inst->y[i] = (i / side) * (RANGE / side);
+        }
+        else if(type == CLUSTERED) {
+            c = (int)(rng_next() % 10);
+            inst->x[i] = c * (RANGE / 10) + (int)(rng_next() % 50);
+            inst->y[i] = (c * 7 % 10) * (RANGE / 10) + (int)(rng_next() % 50);
+        }
+        else {
+            inst->x[i] = (int)(rng_next() % RANGE);
+            inst->y[i] = (int)(rng_next() % RANGE);
+        }
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Frees an instance made by gen_instance
+ * Param:   instance * inst -  The instance
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void free_instance(instance * inst) {
+    free(inst->ids);
+    free(inst->x);
+    free(inst->y);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Reports a failed check
+ * Param:   const char * format -  The message, as for printf
+ * Return:  void
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void fail(const char * format, ...) {
+    va_list args;
+
+    printf("FAIL: ");
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+    failures++;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Gets the next number from the xoshiro256** random number generator
+ * Return:  uint64_t -  A random 64-bit number
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+uint64_t rng_next(void) {
+    uint64_t * s = rng;
+    uint64_t result, t;
+
+    result = s[1] * 5;
+    result = ((result << 7) | (result >> 57)) * 9;
+    t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+
+    return result;
+}